@@ -0,0 +1,246 @@
+/*
+ * audio.c - Reading and writing the audio files the tools render
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ladspa.h"
+#include "audio.h"
+
+static unsigned long read_le(const unsigned char *bytes, int count)
+{
+  unsigned long value = 0;
+
+  while(count -- > 0)
+    value = value << 8 | bytes[count];
+
+  return value;
+}
+
+static void write_le(unsigned char *bytes, unsigned long value, int count)
+{
+  while(count -- > 0) {
+    *bytes ++ = value & 0xff;
+    value >>= 8;
+  }
+}
+
+/**
+ * Find the format and the samples of a WAV file. Returns 0 if it's
+ * not one we can read.
+ */
+static int parse_wav(audio_input_type *input, const char *path)
+{
+  const unsigned char *chunk = input->map + 12;
+  const unsigned char *end = input->map + input->map_size;
+  unsigned long size, bits = 0, tag = 0, data_size = 0;
+
+  input->samples = NULL;
+  while(chunk + 8 <= end) {
+    size = read_le(chunk + 4, 4);
+    if(memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && chunk + 24 <= end) {
+      tag = read_le(chunk + 8, 2);
+      input->channels = read_le(chunk + 10, 2);
+      input->sample_rate = read_le(chunk + 12, 4);
+      bits = read_le(chunk + 22, 2);
+      // WAVE_FORMAT_EXTENSIBLE has the real tag in its subformat
+      if(tag == 0xfffe && size >= 26 && chunk + 34 <= end)
+        tag = read_le(chunk + 32, 2);
+    }
+    else if(memcmp(chunk, "data", 4) == 0) {
+      input->samples = chunk + 8;
+      data_size = size < (unsigned long)(end - chunk - 8) ?
+        size : (unsigned long)(end - chunk - 8);
+      break;
+    }
+    chunk += 8 + size + (size & 1);
+  }
+
+  if(tag == 3 && bits == 32)
+    input->format = AUDIO_FLOAT;
+  else if(tag == 1 && bits == 16)
+    input->format = AUDIO_INT16;
+  else if(tag == 1 && bits == 24)
+    input->format = AUDIO_INT24;
+  else if(tag == 1 && bits == 32)
+    input->format = AUDIO_INT32;
+  else {
+    fprintf(stderr, "%s: not 16, 24 or 32 bit PCM or 32 bit float\n", path);
+    return 0;
+  }
+  if(!input->samples || input->channels == 0) {
+    fprintf(stderr, "%s: no samples\n", path);
+    return 0;
+  }
+
+  input->bytes = bits / 8;
+  input->frames = data_size / (input->channels * input->bytes);
+  return 1;
+}
+
+/**
+ * Map an input file and find its samples. A file that isn't WAV is
+ * taken to be raw floats with the given channels and sample rate.
+ * Returns 0 and says why if it can't.
+ */
+int audio_open(audio_input_type *input, const char *path,
+               unsigned long raw_sample_rate, int raw_channels)
+{
+  struct stat status;
+  int file;
+
+  memset(input, 0, sizeof(audio_input_type));
+  if((file = open(path, O_RDONLY)) < 0 || fstat(file, &status) < 0) {
+    perror(path);
+    if(file >= 0)
+      close(file);
+    return 0;
+  }
+  if(status.st_size == 0) {
+    fprintf(stderr, "%s: empty\n", path);
+    close(file);
+    return 0;
+  }
+
+  input->map_size = status.st_size;
+  input->map = mmap(NULL, input->map_size, PROT_READ, MAP_PRIVATE, file, 0);
+  posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+  close(file);
+  if(input->map == MAP_FAILED) {
+    perror(path);
+    return 0;
+  }
+  madvise(input->map, input->map_size, MADV_SEQUENTIAL);
+
+  input->wav = input->map_size >= 12 && memcmp(input->map, "RIFF", 4) == 0 &&
+    memcmp(input->map + 8, "WAVE", 4) == 0;
+  if(input->wav) {
+    if(parse_wav(input, path))
+      return 1;
+    munmap(input->map, input->map_size);
+    return 0;
+  }
+
+  input->samples = input->map;
+  input->format = AUDIO_FLOAT;
+  input->bytes = sizeof(float);
+  input->channels = raw_channels;
+  input->sample_rate = raw_sample_rate;
+  input->frames = input->map_size / (input->channels * input->bytes);
+  return 1;
+}
+
+/**
+ * Deinterleave count frames of channel_count of the input's channels,
+ * from first_channel and from frame first, into one buffer per channel.
+ */
+void audio_read_frames(const audio_input_type *input, unsigned long first,
+                       unsigned long count, int first_channel,
+                       int channel_count, LADSPA_Data **buffers)
+{
+  const unsigned char *sample;
+  unsigned long i;
+  int channel;
+  float value;
+
+  for(i = 0; i < count; i ++) {
+    sample = input->samples +
+      ((first + i) * input->channels + first_channel) * input->bytes;
+    for(channel = 0; channel < channel_count; channel ++) {
+      switch(input->format) {
+      case AUDIO_FLOAT:
+        memcpy(&value, sample, sizeof(float));
+        break;
+      case AUDIO_INT16:
+        value = (int16_t)read_le(sample, 2) / 32768.0f;
+        break;
+      case AUDIO_INT24:
+        value = (int32_t)(read_le(sample, 3) << 8) / 2147483648.0f;
+        break;
+      default:
+        value = (int32_t)read_le(sample, 4) / 2147483648.0f;
+        break;
+      }
+      buffers[channel][i] = value;
+      sample += input->bytes;
+    }
+  }
+}
+
+/**
+ * Write all of a buffer at an offset. Returns 0 if it can't.
+ */
+int audio_write_all(int file, const unsigned char *buffer, size_t size,
+                    off_t offset)
+{
+  ssize_t written;
+
+  while(size > 0) {
+    written = pwrite(file, buffer, size, offset);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written <= 0)
+      return 0;
+    buffer += written;
+    offset += written;
+    size -= written;
+  }
+
+  return 1;
+}
+
+/**
+ * The header of a 32 bit float WAV file.
+ */
+void audio_wav_header(unsigned char *header, int channels,
+                      unsigned long sample_rate, unsigned long frames)
+{
+  unsigned long data_size = frames * channels * sizeof(float);
+
+  memcpy(header, "RIFF", 4);
+  write_le(header + 4, AUDIO_WAV_HEADER - 8 + data_size, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  write_le(header + 16, 16, 4);
+  write_le(header + 20, 3, 2);
+  write_le(header + 22, channels, 2);
+  write_le(header + 24, sample_rate, 4);
+  write_le(header + 28, sample_rate * channels * sizeof(float), 4);
+  write_le(header + 32, channels * sizeof(float), 2);
+  write_le(header + 34, 32, 2);
+  memcpy(header + 36, "fact", 4);
+  write_le(header + 40, 4, 4);
+  write_le(header + 44, frames, 4);
+  memcpy(header + 48, "data", 4);
+  write_le(header + 52, data_size, 4);
+}
+
+/**
+ * Unmap an input file.
+ */
+void audio_close(audio_input_type *input)
+{
+  munmap(input->map, input->map_size);
+}
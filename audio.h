@@ -0,0 +1,73 @@
+/*
+ * audio.h - Reading and writing the audio files the tools render
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The files render and sweep read are WAV (16, 24 or 32 bit integer,
+ * or 32 bit float) or raw interleaved 32 bit floats, whose channels
+ * and sample rate have to be given. They are mapped rather than read.
+ * What they write is 32 bit float, as WAV with a header of
+ * AUDIO_WAV_HEADER bytes or raw.
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <sys/types.h>
+
+#include "ladspa.h"
+
+#define AUDIO_WAV_HEADER 56
+
+// sample formats of an input
+#define AUDIO_FLOAT 0
+#define AUDIO_INT16 1
+#define AUDIO_INT24 2
+#define AUDIO_INT32 3
+
+/**
+ * A mapped input file and where its samples are in it.
+ */
+typedef struct {
+  unsigned char *map;
+  size_t map_size;
+  const unsigned char *samples;
+  unsigned long frames;
+  unsigned long sample_rate;
+  int channels;
+  int format;
+  int bytes;
+  int wav;
+} audio_input_type;
+
+int audio_open(audio_input_type *input, const char *path,
+               unsigned long raw_sample_rate, int raw_channels);
+
+void audio_read_frames(const audio_input_type *input, unsigned long first,
+                       unsigned long count, int first_channel,
+                       int channel_count, LADSPA_Data **buffers);
+
+void audio_close(audio_input_type *input);
+
+int audio_write_all(int file, const unsigned char *buffer, size_t size,
+                    off_t offset);
+
+void audio_wav_header(unsigned char *header, int channels,
+                      unsigned long sample_rate, unsigned long frames);
+
+#endif
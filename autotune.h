@@ -0,0 +1,312 @@
+/*
+ * autotune.h - Pick the fastest kernel variant for this machine
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The channel plugins compile their run function several times over,
+ * as variants that only differ in how the compiler may vectorise the
+ * loops over channels (see CHANNEL_RUN_FUNCTIONS in channels.h):
+ *
+ *   scalar   the normal build
+ *   sse2     vectorised for any x86-64
+ *   avx2     vectorised with 256-bit AVX2
+ *   avx512   vectorised with 512-bit AVX-512
+ *
+ * Which one is fastest depends on the CPU, the plugin, the number of
+ * channels and the block size. The vectorised variants don't contract
+ * multiplies and adds into fused multiply-adds, so all of them give
+ * the same output and the choice only affects speed.
+ *
+ * Tuning is opt-in. Set MY_LADSPA_AUTOTUNE to the block size the host
+ * runs at, e.g. 256. The first time a plugin is instantiated, every
+ * variant the CPU supports is timed on a scratch instance, and the
+ * fastest one is written to a cache file under the CPU model and the
+ * library version (its build time), so later loads just look it up.
+ * The cache file is MY_LADSPA_AUTOTUNE_CACHE, or
+ * ~/.my_ladspa_plugins.tune by default. Without MY_LADSPA_AUTOTUNE
+ * the scalar variant is always used.
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ladspa.h"
+
+#define TUNE_VARIANTS  4
+#define TUNE_MAX_BLOCK 8192
+#define TUNE_SAMPLES   16384
+#define TUNE_REPEATS   5
+#define TUNE_VERSION   __DATE__ " " __TIME__
+
+// how the vectorised variants are compiled
+#if defined(__GNUC__) && !defined(__clang__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define TUNE_X86
+#define TUNE_VECTORISE                                                  \
+  optimize ("tree-vectorize", "vect-cost-model=dynamic", "fp-contract=off")
+#define TUNE_SSE2   __attribute__ ((target ("sse2"), TUNE_VECTORISE))
+#define TUNE_AVX2   __attribute__ ((target ("avx2"), TUNE_VECTORISE))
+#define TUNE_AVX512                                                     \
+  __attribute__ ((target ("avx512f,prefer-vector-width=512"),           \
+                  TUNE_VECTORISE))
+#else
+#define TUNE_SSE2
+#define TUNE_AVX2
+#define TUNE_AVX512
+#endif
+
+typedef void (*tune_run_type)(LADSPA_Handle instance,
+                              unsigned long sample_count);
+
+static const char *const tune_variant_names[TUNE_VARIANTS] =
+  { "scalar", "sse2", "avx2", "avx512" };
+
+// set while a scratch instance is being timed, so that it doesn't
+// try to tune itself
+static __thread int tune_running = 0;
+
+/**
+ * Whether the CPU can run a variant.
+ */
+static int tune_supported(int variant)
+{
+#ifdef TUNE_X86
+  switch(variant) {
+  case 0:
+    return 1;
+  case 1:
+    return __builtin_cpu_supports("sse2");
+  case 2:
+    return __builtin_cpu_supports("avx2");
+  case 3:
+    return __builtin_cpu_supports("avx512f");
+  }
+  return 0;
+#else
+  return variant == 0;
+#endif
+}
+
+/**
+ * The model name of the CPU, as /proc/cpuinfo has it.
+ */
+static void tune_cpu_model(char *model, size_t size)
+{
+  char line[256];
+  char *value;
+  FILE *file;
+
+  snprintf(model, size, "unknown");
+  if(!(file = fopen("/proc/cpuinfo", "r")))
+    return;
+
+  while(fgets(line, sizeof(line), file)) {
+    if(strncmp(line, "model name", 10) != 0 || !(value = strchr(line, ':')))
+      continue;
+    value += strspn(value + 1, " \t") + 1;
+    value[strcspn(value, "\n")] = 0;
+    snprintf(model, size, "%s", value);
+    break;
+  }
+  fclose(file);
+}
+
+static FILE *tune_open_cache(const char *mode)
+{
+  const char *path = getenv("MY_LADSPA_AUTOTUNE_CACHE");
+  const char *home = getenv("HOME");
+  char default_path[1024];
+
+  if(!path) {
+    if(!home)
+      return NULL;
+    snprintf(default_path, sizeof(default_path), "%s/.my_ladspa_plugins.tune",
+             home);
+    path = default_path;
+  }
+
+  return fopen(path, mode);
+}
+
+/**
+ * The variant the cache has for a key, or -1 if it has none. Each
+ * line of the cache is the key and the name of the variant, separated
+ * by a tab. Later lines win.
+ */
+static int tune_lookup(const char *key)
+{
+  char line[1024];
+  size_t key_length = strlen(key);
+  int variant = -1, i;
+  FILE *file;
+
+  if(!(file = tune_open_cache("r")))
+    return -1;
+
+  while(fgets(line, sizeof(line), file)) {
+    if(strncmp(line, key, key_length) != 0 || line[key_length] != '\t')
+      continue;
+    line[strcspn(line, "\n")] = 0;
+    for(i = 0; i < TUNE_VARIANTS; i ++)
+      if(strcmp(line + key_length + 1, tune_variant_names[i]) == 0 &&
+         tune_supported(i))
+        variant = i;
+  }
+  fclose(file);
+
+  return variant;
+}
+
+static void tune_store(const char *key, int variant)
+{
+  FILE *file;
+
+  if(!(file = tune_open_cache("a")))
+    return;
+  fprintf(file, "%s\t%s\n", key, tune_variant_names[variant]);
+  fclose(file);
+}
+
+/**
+ * The best time per sample of TUNE_REPEATS runs of a variant, each
+ * over TUNE_SAMPLES samples in blocks of block_size.
+ */
+static double tune_time(LADSPA_Handle instance, tune_run_type run,
+                        unsigned long block_size)
+{
+  struct timespec start, end;
+  double elapsed, best = -1;
+  unsigned long done;
+  int repeat;
+
+  // once to warm up the caches, then the timed runs
+  for(repeat = 0; repeat <= TUNE_REPEATS; repeat ++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(done = 0; done < TUNE_SAMPLES; done += block_size)
+      run(instance, block_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+      (end.tv_nsec - start.tv_nsec) / 1e9;
+    if(repeat > 0 && (best < 0 || elapsed < best))
+      best = elapsed;
+  }
+
+  return best / done;
+}
+
+/**
+ * Time every variant the CPU supports on a scratch instance of the
+ * plugin, with noise on the audio inputs and each control in the
+ * middle of its range, and return the fastest.
+ */
+static int tune_benchmark(const LADSPA_Descriptor *descriptor,
+                          unsigned long sample_rate,
+                          const tune_run_type *kernels,
+                          unsigned long block_size)
+{
+  const LADSPA_PortRangeHint *hint;
+  LADSPA_Handle instance;
+  LADSPA_Data *buffers;
+  unsigned long port, i;
+  unsigned int noise = 1;
+  double elapsed, best_time = -1;
+  int variant, best = 0;
+
+  buffers = calloc(descriptor->PortCount * block_size, sizeof(LADSPA_Data));
+  if(!buffers)
+    return 0;
+  if(!(instance = descriptor->instantiate(descriptor, sample_rate))) {
+    free(buffers);
+    return 0;
+  }
+
+  for(port = 0; port < descriptor->PortCount; port ++) {
+    hint = descriptor->PortRangeHints + port;
+    if(LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+      buffers[port * block_size] =
+        (hint->LowerBound + hint->UpperBound) / 2;
+    else if(LADSPA_IS_PORT_INPUT(descriptor->PortDescriptors[port]))
+      for(i = 0; i < block_size; i ++) {
+        noise = noise * 1103515245 + 12345;
+        buffers[port * block_size + i] = (float)(noise >> 8) / (1 << 24) - .5;
+      }
+    descriptor->connect_port(instance, port, buffers + port * block_size);
+  }
+  if(descriptor->activate)
+    descriptor->activate(instance);
+
+  for(variant = 0; variant < TUNE_VARIANTS; variant ++) {
+    if(!tune_supported(variant))
+      continue;
+    elapsed = tune_time(instance, kernels[variant], block_size);
+    if(best_time < 0 || elapsed < best_time) {
+      best_time = elapsed;
+      best = variant;
+    }
+  }
+
+  if(descriptor->deactivate)
+    descriptor->deactivate(instance);
+  descriptor->cleanup(instance);
+  free(buffers);
+
+  return best;
+}
+
+/**
+ * The run function an instance of the plugin should use. The
+ * descriptor's ImplementationData points to its TUNE_VARIANTS
+ * variants.
+ */
+static tune_run_type tune_kernel(const LADSPA_Descriptor *descriptor,
+                                 unsigned long sample_rate)
+{
+  const tune_run_type *kernels =
+    (const tune_run_type *)descriptor->ImplementationData;
+  const char *block = getenv("MY_LADSPA_AUTOTUNE");
+  unsigned long block_size;
+  char model[256], key[512];
+  int variant;
+
+  if(!block || tune_running)
+    return kernels[0];
+  block_size = strtoul(block, NULL, 10);
+  if(block_size == 0 || block_size > TUNE_MAX_BLOCK)
+    return kernels[0];
+
+  tune_cpu_model(model, sizeof(model));
+  snprintf(key, sizeof(key), "%s\t%s\t%s\t%lu", TUNE_VERSION, model,
+           descriptor->Label, block_size);
+
+  if((variant = tune_lookup(key)) < 0) {
+    tune_running = 1;
+    variant = tune_benchmark(descriptor, sample_rate, kernels, block_size);
+    tune_running = 0;
+    tune_store(key, variant);
+  }
+
+  return kernels[variant];
+}
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * bench.c - Time the plugins in a library
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A minimal LADSPA host that runs noise through every plugin in a
+ * library (or just the one with the given label) and reports how
+ * long it took. Controls are set to their default values unless
+ * they are overridden with -c. With -n, that many instances are run
+ * in series, each one's outputs feeding the next one's inputs.
+ *
+ * Given several labels, it runs one instance of each of them in
+ * series, the way a host runs a chain of separate plugins, and times
+ * them together.
+ *
+ * With -P, the chain runs in a pipeline of that depth (see pipeline.h),
+ * each stage on its own core, and is timed against the same chain on
+ * one core. Then it also reports the latency the pipeline adds and how
+ * busy each stage kept its core.
+ *
+ *   bench [-b block_size] [-s seconds] [-r sample_rate] [-n instances]
+ *         [-P depth] [-c port=value]... library.so [label]...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "pipeline.h"
+
+#define MAX_PORTS 256
+#define MAX_INSTANCES 64
+#define MAX_OVERRIDES 32
+#define MAX_LABELS 8
+
+typedef struct {
+  unsigned long port;
+  LADSPA_Data value;
+} override_type;
+
+unsigned long block_size = 256;
+unsigned long sample_rate = 48000;
+double seconds = 10;
+int instance_count = 1;
+int pipeline_depth = 0;
+override_type overrides[MAX_OVERRIDES];
+int override_count = 0;
+
+/**
+ * Run instance_count instances of a series of plugins in series and
+ * print the time it took.
+ */
+void bench_descriptors(const LADSPA_Descriptor **descriptors, int count)
+{
+  const LADSPA_Descriptor *descriptor;
+  LADSPA_Handle instances[MAX_INSTANCES];
+  LADSPA_Data controls[MAX_LABELS][MAX_PORTS];
+  LADSPA_Data *buffers[MAX_INSTANCES + 1][MAX_PORTS];
+  LADSPA_PortDescriptor port_descriptor;
+  unsigned long total, done, port, input, output, channels, channel, i;
+  struct timespec start, end;
+  double elapsed;
+  char label[256];
+  int instance, stage_count, stage, pass;
+
+  stage_count = instance_count * count;
+  if(stage_count > MAX_INSTANCES) {
+    fprintf(stderr, "too many instances\n");
+    return;
+  }
+
+  label[0] = 0;
+  channels = 0;
+  for(stage = 0; stage < count; stage ++) {
+    descriptor = descriptors[stage];
+    if(descriptor->PortCount > MAX_PORTS) {
+      fprintf(stderr, "%s: too many ports\n", descriptor->Label);
+      return;
+    }
+    snprintf(label + strlen(label), sizeof(label) - strlen(label), "%s%s",
+             stage ? "+" : "", descriptor->Label);
+
+    for(port = 0; port < descriptor->PortCount; port ++)
+      if(LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+        controls[stage][port] =
+          get_default(descriptor->PortRangeHints + port);
+    for(i = 0; i < override_count; i ++)
+      if(overrides[i].port < descriptor->PortCount)
+        controls[stage][overrides[i].port] = overrides[i].value;
+
+    // instance n reads the buffers of stage n and writes those of
+    // stage n + 1, so the instances run in series. the buffers of
+    // stage 0 hold noise. audio inputs and outputs are paired up in the
+    // order they appear, so each stage needs as many buffers as the
+    // largest count of any plugin.
+    for(port = 0, input = 0, output = 0; port < descriptor->PortCount;
+        port ++) {
+      port_descriptor = descriptor->PortDescriptors[port];
+      if(LADSPA_IS_PORT_AUDIO(port_descriptor)) {
+        if(LADSPA_IS_PORT_INPUT(port_descriptor))
+          input ++;
+        else
+          output ++;
+      }
+    }
+    if(input > channels)
+      channels = input;
+    if(output > channels)
+      channels = output;
+  }
+
+  for(instance = 0; instance <= stage_count; instance ++)
+    for(channel = 0; channel < channels; channel ++)
+      buffers[instance][channel] = malloc(block_size * sizeof(LADSPA_Data));
+  for(channel = 0; channel < channels; channel ++)
+    for(i = 0; i < block_size; i ++)
+      buffers[0][channel][i] = (float)rand() / RAND_MAX - .5;
+
+  for(instance = 0; instance < stage_count; instance ++) {
+    descriptor = descriptors[instance % count];
+    instances[instance] = descriptor->instantiate(descriptor, sample_rate);
+
+    for(port = 0, input = 0, output = 0; port < descriptor->PortCount;
+        port ++) {
+      port_descriptor = descriptor->PortDescriptors[port];
+      if(LADSPA_IS_PORT_CONTROL(port_descriptor))
+        descriptor->connect_port(instances[instance], port,
+                                 controls[instance % count] + port);
+      else if(LADSPA_IS_PORT_INPUT(port_descriptor))
+        descriptor->connect_port(instances[instance], port,
+                                 buffers[instance][input ++]);
+      else
+        descriptor->connect_port(instances[instance], port,
+                                 buffers[instance + 1][output ++]);
+    }
+
+    if(descriptor->activate)
+      descriptor->activate(instances[instance]);
+  }
+
+  // one short pass to warm up the caches, then the timed one
+  for(pass = 0; pass < 2; pass ++) {
+    total = pass ? seconds * sample_rate : sample_rate / 10;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(done = 0; done < total; done += block_size)
+      for(instance = 0; instance < stage_count; instance ++)
+        descriptors[instance % count]->run(instances[instance], block_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+  }
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%-24s block %5lu x%-3d %9.2f ns/sample %7.3f%% of a core\n",
+         label, block_size, instance_count,
+         elapsed * 1e9 / done, 100 * elapsed * sample_rate / done);
+
+  for(instance = 0; instance < stage_count; instance ++) {
+    descriptor = descriptors[instance % count];
+    if(descriptor->deactivate)
+      descriptor->deactivate(instances[instance]);
+    descriptor->cleanup(instances[instance]);
+  }
+  for(instance = 0; instance <= stage_count; instance ++)
+    for(channel = 0; channel < channels; channel ++)
+      free(buffers[instance][channel]);
+}
+
+/**
+ * Run instance_count instances of a series of plugins as a chain, in
+ * place, first on one core and then pipelined over several, and print
+ * the time each took, the latency and how busy each stage was.
+ */
+void bench_pipeline(const LADSPA_Descriptor **descriptors, int count)
+{
+  static pipeline_type pipeline;
+  host_stage_type stages[HOST_MAX_STAGES];
+  host_chain_type chain;
+  LADSPA_Data *noise[HOST_MAX_CHANNELS], *output[HOST_MAX_CHANNELS];
+  unsigned long total, done, pushed, pulled, i;
+  double start, serial, pipelined;
+  char label[256];
+  int stage_count, stage, channels, channel, pass;
+
+  stage_count = instance_count * count;
+  if(stage_count > HOST_MAX_STAGES) {
+    fprintf(stderr, "too many stages\n");
+    return;
+  }
+
+  label[0] = 0;
+  for(stage = 0; stage < stage_count; stage ++) {
+    if(!host_make_stage(&stages[stage], descriptors[stage % count]))
+      return;
+    for(i = 0; i < override_count; i ++)
+      if(overrides[i].port < descriptors[stage % count]->PortCount)
+        stages[stage].controls[overrides[i].port] = overrides[i].value;
+    if(stage < count)
+      snprintf(label + strlen(label), sizeof(label) - strlen(label), "%s%s",
+               stage ? "+" : "", descriptors[stage]->Label);
+  }
+  if(!(channels = host_chain_channels(stages, stage_count)))
+    return;
+
+  for(channel = 0; channel < channels; channel ++) {
+    noise[channel] = malloc(block_size * sizeof(LADSPA_Data));
+    output[channel] = malloc(block_size * sizeof(LADSPA_Data));
+    for(i = 0; i < block_size; i ++)
+      noise[channel][i] = (float)rand() / RAND_MAX - .5;
+  }
+
+  // the chain on this core, copying the noise in each time like the
+  // pipeline does
+  if(!host_chain_instantiate(&chain, stages, stage_count, sample_rate,
+                             block_size))
+    goto done;
+  for(pass = 0; pass < 2; pass ++) {
+    total = pass ? seconds * sample_rate : sample_rate / 10;
+    start = pipeline_seconds();
+    for(done = 0; done < total; done += block_size) {
+      for(channel = 0; channel < channels; channel ++)
+        memcpy(output[channel], noise[channel],
+               block_size * sizeof(LADSPA_Data));
+      host_chain_run(&chain, output, block_size);
+    }
+    serial = pipeline_seconds() - start;
+  }
+  host_chain_cleanup(&chain);
+
+  // stage n goes on core n + 1, leaving core 0 to this thread
+  if(!pipeline_start(&pipeline, stages, stage_count, sample_rate,
+                     block_size, pipeline_depth, 1))
+    goto done;
+  for(pass = 0; pass < 2; pass ++) {
+    total = pass ? seconds * sample_rate : sample_rate / 10;
+
+    // the threads are all waiting for a block, so this is safe
+    for(stage = 0; stage < stage_count; stage ++)
+      pipeline.stages[stage].busy = 0;
+    pipeline.latency = pipeline.max_latency = 0;
+    pipeline.pulled = 0;
+
+    start = pipeline_seconds();
+    for(done = 0, pushed = 0, pulled = 0; done < total; done += block_size) {
+      if(pushed - pulled == pipeline_depth) {
+        pipeline_pull(&pipeline, output);
+        pulled ++;
+      }
+      pipeline_push(&pipeline, noise, block_size);
+      pushed ++;
+    }
+    for(; pulled < pushed; pulled ++)
+      pipeline_pull(&pipeline, output);
+    pipelined = pipeline_seconds() - start;
+  }
+
+  printf("%-24s block %5lu x%-3d %9.2f ns/sample, %.2f on one core, "
+         "%.2fx\n", label, block_size, instance_count,
+         pipelined * 1e9 / done, serial * 1e9 / done, serial / pipelined);
+  printf("  depth %d: %d blocks (%.1f ms) behind, %.2f ms from push to "
+         "pull on average, %.2f at most\n", pipeline_depth, pipeline_depth - 1,
+         1e3 * (pipeline_depth - 1) * block_size / sample_rate,
+         1e3 * pipeline.latency / pipeline.pulled,
+         1e3 * pipeline.max_latency);
+  for(stage = 0; stage < stage_count; stage ++)
+    printf("  %-22s core %-3d %5.1f%% busy\n",
+           stages[stage].descriptor->Label, pipeline.stages[stage].cpu,
+           100 * pipeline.stages[stage].busy / pipelined);
+
+  pipeline_stop(&pipeline);
+
+done:
+  for(channel = 0; channel < channels; channel ++) {
+    free(noise[channel]);
+    free(output[channel]);
+  }
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-b block_size] [-s seconds] [-r sample_rate] "
+          "[-n instances] [-P depth] [-c port=value]... library.so "
+          "[label]...\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  LADSPA_Descriptor_Function get_descriptor;
+  const LADSPA_Descriptor *descriptor;
+  const LADSPA_Descriptor *descriptors[MAX_LABELS];
+  void *library;
+  unsigned long index;
+  int option, label_count, label;
+
+  while((option = getopt(argc, argv, "b:s:r:n:P:c:")) != -1) {
+    switch(option) {
+    case 'b':
+      block_size = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      seconds = atof(optarg);
+      break;
+    case 'r':
+      sample_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      instance_count = atoi(optarg);
+      break;
+    case 'P':
+      pipeline_depth = atoi(optarg);
+      break;
+    case 'c':
+      if(override_count == MAX_OVERRIDES ||
+         sscanf(optarg, "%lu=%f", &overrides[override_count].port,
+                &overrides[override_count].value) != 2)
+        usage(argv[0]);
+      override_count ++;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  label_count = argc - optind - 1;
+  if(optind >= argc || block_size == 0 || instance_count < 1 ||
+     instance_count > MAX_INSTANCES || label_count > MAX_LABELS)
+    usage(argv[0]);
+
+  library = dlopen(argv[optind], RTLD_NOW | RTLD_LOCAL);
+  if(!library) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+
+  get_descriptor = (LADSPA_Descriptor_Function)
+    dlsym(library, "ladspa_descriptor");
+  if(!get_descriptor) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+
+  if(label_count == 0)
+    for(index = 0; (descriptor = get_descriptor(index)); index ++) {
+      if(pipeline_depth)
+        bench_pipeline(&descriptor, 1);
+      else
+        bench_descriptors(&descriptor, 1);
+    }
+
+  for(label = 0; label < label_count; label ++) {
+    for(index = 0; (descriptor = get_descriptor(index)); index ++)
+      if(strcmp(argv[optind + 1 + label], descriptor->Label) == 0)
+        break;
+    if(!descriptor) {
+      fprintf(stderr, "%s: no such plugin\n", argv[optind + 1 + label]);
+      return 1;
+    }
+    descriptors[label] = descriptor;
+  }
+  if(label_count > 0 && pipeline_depth)
+    bench_pipeline(descriptors, label_count);
+  else if(label_count > 0)
+    bench_descriptors(descriptors, label_count);
+
+  dlclose(library);
+
+  return 0;
+}
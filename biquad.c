@@ -0,0 +1,646 @@
+/*
+ * biquad.c - A cascade of second-order sections
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Where reson.c is a single two-pole filter, this plugin runs a
+ * cascade of up to MAX_SECTIONS second-order sections, which is how
+ * filters of higher order are usually built. The sections are
+ * designed from the analog prototype of the chosen design and mapped
+ * with the bilinear transform:
+ *
+ *  Butterworth     maximally flat, -3 dB at the cutoff
+ *  Chebyshev       type I, Ripple dB of ripple in the pass band
+ *  Linkwitz-Riley  two Butterworth filters of half the order, -6 dB
+ *                  at the cutoff, so that lowpass and highpass sum flat
+ *                  (for crossovers). Odd orders are rounded up.
+ *
+ * Each section is in transposed direct form II:
+ *  y_t = b0 * x_t + s1
+ *  s1  = b1 * x_t - a1 * y_t + s2
+ *  s2  = b2 * x_t - a2 * y_t
+ *
+ * The cascade is processed a sample at a time through all of its
+ * sections, with a copy of the loop for each number of sections, so
+ * that the state of every section stays in registers and each sample
+ * is loaded and stored once. In the stereo version the two channels
+ * share their controls, and are processed together as the two lanes
+ * of a vector.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define MAX_ORDER 16
+#define MAX_SECTIONS (MAX_ORDER / 2)
+
+#define TYPE_LOWPASS  0
+#define TYPE_HIGHPASS 1
+
+#define DESIGN_BUTTERWORTH    0
+#define DESIGN_CHEBYSHEV      1
+#define DESIGN_LINKWITZ_RILEY 2
+
+// The port numbers for the plugin
+#define TYPE_CONTROL   0
+#define DESIGN_CONTROL 1
+#define FREQ_CONTROL   2
+#define ORDER_CONTROL  3
+#define RIPPLE_CONTROL 4
+#define INPUT_L        5
+#define OUTPUT_L       6
+
+#define INPUT_R        7
+#define OUTPUT_R       8
+
+// The range of the continuous controls, which the host may not keep
+// to. The ripple has to stay above 0 for a Chebyshev design.
+#define FREQ_LOWER     20
+#define FREQ_UPPER     20000
+#define RIPPLE_LOWER   .1
+#define RIPPLE_UPPER   3
+
+// use fused multiply-add where the hardware has it, in both lanes of
+// a vector too, so mono and stereo round the same whatever
+// -ffp-contract says
+#ifdef FP_FAST_FMAF
+#define MULADD(a, b, c) fmaf(a, b, c)
+#define LANES_MULADD(a, b, c)                                   \
+  ((lanes_type){ fmaf((a)[0], (b)[0], (c)[0]),                  \
+                 fmaf((a)[1], (b)[1], (c)[1]) })
+#else
+#define MULADD(a, b, c) ((a) * (b) + (c))
+#define LANES_MULADD(a, b, c) ((a) * (b) + (c))
+#endif
+
+/**
+ * Left and right samples side by side in one vector register.
+ */
+typedef LADSPA_Data lanes_type
+  __attribute__ ((vector_size (2 * sizeof(LADSPA_Data))));
+
+
+/**
+ * The coefficients of one section, normalised so that a0 = 1.
+ */
+typedef struct {
+  LADSPA_Data b0, b1, b2, a1, a2;
+} section_type;
+
+/**
+ * Structure to hold connections and state.
+ */
+typedef struct {
+  LADSPA_Data *type_control_value;
+  LADSPA_Data *design_control_value;
+  LADSPA_Data *freq_control_value;
+  LADSPA_Data *order_control_value;
+  LADSPA_Data *ripple_control_value;
+
+  // l = mono
+  LADSPA_Data *input_buffer_l;
+  LADSPA_Data *output_buffer_l;
+
+  // stereo
+  LADSPA_Data *input_buffer_r;
+  LADSPA_Data *output_buffer_r;
+
+  // state
+  unsigned long sample_rate;
+
+  // the current design, and the controls it was made from
+  int type;
+  int design;
+  int order;
+  LADSPA_Data ripple;
+  smooth_type freq;
+
+  section_type sections[MAX_SECTIONS];
+  int section_count;
+
+  // s1 and s2 of each section, left channel in lane 0
+  lanes_type state[MAX_SECTIONS][2];
+} filter_type;
+
+
+/**
+ * Add a second-order section with the analog lowpass prototype
+ * w^2 / (s^2 + w/q s + w^2), or its highpass counterpart.
+ */
+static void add_section(filter_type *filter, double w, double q, double k)
+{
+  section_type *section = filter->sections + filter->section_count ++;
+  double a0 = k * k + w / q * k + w * w;
+
+  if(filter->type == TYPE_HIGHPASS) {
+    section->b0 = k * k / a0;
+    section->b1 = -2 * k * k / a0;
+  }
+  else {
+    section->b0 = w * w / a0;
+    section->b1 = 2 * w * w / a0;
+  }
+  section->b2 = section->b0;
+  section->a1 = (2 * w * w - 2 * k * k) / a0;
+  section->a2 = (k * k - w / q * k + w * w) / a0;
+}
+
+/**
+ * Add a first-order section w / (s + w), or its highpass counterpart,
+ * for the real pole of odd orders.
+ */
+static void add_first_order_section(filter_type *filter, double w, double k)
+{
+  section_type *section = filter->sections + filter->section_count ++;
+  double a0 = k + w;
+
+  if(filter->type == TYPE_HIGHPASS) {
+    section->b0 = k / a0;
+    section->b1 = -k / a0;
+  }
+  else {
+    section->b0 = w / a0;
+    section->b1 = w / a0;
+  }
+  section->b2 = 0;
+  section->a1 = (w - k) / a0;
+  section->a2 = 0;
+}
+
+/**
+ * Design the cascade for the given cutoff frequency from the poles of
+ * the normalised analog prototype. The cutoff is prewarped so that it
+ * ends up in the right place after the bilinear transform.
+ */
+static void design_sections(filter_type *filter, float freq)
+{
+  double k = 2. * filter->sample_rate;
+  double cutoff, theta, re, im, w, epsilon = 0, v = 0;
+  int prototype_order = filter->order;
+  int passes = 1;
+  int pass, i;
+
+  if(freq > .45 * filter->sample_rate)
+    freq = .45 * filter->sample_rate;
+  cutoff = k * tan(M_PI * freq / filter->sample_rate);
+
+  if(filter->design == DESIGN_LINKWITZ_RILEY) {
+    prototype_order = (filter->order + 1) / 2;
+    passes = 2;
+  }
+  else if(filter->design == DESIGN_CHEBYSHEV) {
+    epsilon = sqrt(pow(10, filter->ripple / 10) - 1);
+    v = asinh(1 / epsilon) / prototype_order;
+  }
+
+  filter->section_count = 0;
+  for(pass = 0; pass < passes; pass ++) {
+    for(i = 1; i <= prototype_order / 2; i ++) {
+      theta = (2 * i - 1) * M_PI / (2 * prototype_order);
+      re = -sin(theta);
+      im = cos(theta);
+      if(filter->design == DESIGN_CHEBYSHEV) {
+        re *= sinh(v);
+        im *= cosh(v);
+      }
+
+      // a highpass is the lowpass prototype with s replaced by
+      // cutoff / s, which inverts the pole radius.
+      w = sqrt(re * re + im * im);
+      add_section(filter, filter->type == TYPE_HIGHPASS ?
+                  cutoff / w : cutoff * w, w / (-2 * re), k);
+    }
+
+    if(prototype_order % 2) {
+      w = filter->design == DESIGN_CHEBYSHEV ? sinh(v) : 1;
+      add_first_order_section(filter, filter->type == TYPE_HIGHPASS ?
+                              cutoff / w : cutoff * w, k);
+    }
+  }
+
+  // even order chebyshev filters start at the bottom of the ripple
+  if(filter->design == DESIGN_CHEBYSHEV && prototype_order % 2 == 0) {
+    w = 1 / sqrt(1 + epsilon * epsilon);
+    filter->sections[0].b0 *= w;
+    filter->sections[0].b1 *= w;
+    filter->sections[0].b2 *= w;
+  }
+}
+
+/**
+ * Construct a new plugin instance.
+ */
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
+{
+  filter_type *filter = malloc(sizeof(filter_type));
+  filter->sample_rate = sample_rate;
+
+  return filter;
+}
+
+static void activate_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  memset(filter->state, 0, sizeof(filter->state));
+  filter->order = 0;
+  smooth_reset(&filter->freq);
+}
+
+/**
+ * Connect a port to a data location.
+*/
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
+{
+  filter_type *filter;
+
+  filter = (filter_type *)instance;
+  switch(port) {
+  case TYPE_CONTROL:
+    filter->type_control_value = data_location;
+    break;
+  case DESIGN_CONTROL:
+    filter->design_control_value = data_location;
+    break;
+  case FREQ_CONTROL:
+    filter->freq_control_value = data_location;
+    break;
+  case ORDER_CONTROL:
+    filter->order_control_value = data_location;
+    break;
+  case RIPPLE_CONTROL:
+    filter->ripple_control_value = data_location;
+    break;
+  case INPUT_L:
+    filter->input_buffer_l = data_location;
+    break;
+  case OUTPUT_L:
+    filter->output_buffer_l = data_location;
+    break;
+  case INPUT_R:
+    filter->input_buffer_r = data_location;
+    break;
+  case OUTPUT_R:
+    filter->output_buffer_r = data_location;
+    break;
+  }
+}
+
+/**
+ * Run the cascade over a mono block, a sample at a time through all
+ * of its sections.
+ */
+static inline __attribute__ ((always_inline))
+void run_cascade_mono(filter_type *filter, const LADSPA_Data *input,
+                      LADSPA_Data *output, unsigned long sample_count,
+                      const int section_count)
+{
+  LADSPA_Data b0[MAX_SECTIONS], b1[MAX_SECTIONS], b2[MAX_SECTIONS];
+  LADSPA_Data a1[MAX_SECTIONS], a2[MAX_SECTIONS];
+  LADSPA_Data s1[MAX_SECTIONS], s2[MAX_SECTIONS];
+  LADSPA_Data x, y;
+  unsigned long i;
+  int k;
+
+  for(k = 0; k < section_count; k ++) {
+    b0[k] = filter->sections[k].b0;
+    b1[k] = filter->sections[k].b1;
+    b2[k] = filter->sections[k].b2;
+    a1[k] = filter->sections[k].a1;
+    a2[k] = filter->sections[k].a2;
+    s1[k] = filter->state[k][0][0];
+    s2[k] = filter->state[k][1][0];
+  }
+
+  for(i = 0; i < sample_count; i ++) {
+    y = input[i];
+    for(k = 0; k < section_count; k ++) {
+      x = y;
+      y = MULADD(b0[k], x, s1[k]);
+      s1[k] = MULADD(b1[k], x, MULADD(-a1[k], y, s2[k]));
+      s2[k] = MULADD(b2[k], x, -a2[k] * y);
+    }
+    output[i] = y;
+  }
+
+  for(k = 0; k < section_count; k ++) {
+    filter->state[k][0][0] = s1[k];
+    filter->state[k][1][0] = s2[k];
+  }
+}
+
+/**
+ * Run the cascade over a stereo block, left and right in the two
+ * lanes of a vector.
+ */
+static inline __attribute__ ((always_inline))
+void run_cascade_stereo(filter_type *filter, const LADSPA_Data *input_l,
+                        const LADSPA_Data *input_r, LADSPA_Data *output_l,
+                        LADSPA_Data *output_r, unsigned long sample_count,
+                        const int section_count)
+{
+  lanes_type b0[MAX_SECTIONS], b1[MAX_SECTIONS], b2[MAX_SECTIONS];
+  lanes_type a1[MAX_SECTIONS], a2[MAX_SECTIONS];
+  lanes_type s1[MAX_SECTIONS], s2[MAX_SECTIONS];
+  lanes_type x, y;
+  unsigned long i;
+  int k;
+
+  for(k = 0; k < section_count; k ++) {
+    b0[k] = (lanes_type){ filter->sections[k].b0, filter->sections[k].b0 };
+    b1[k] = (lanes_type){ filter->sections[k].b1, filter->sections[k].b1 };
+    b2[k] = (lanes_type){ filter->sections[k].b2, filter->sections[k].b2 };
+    a1[k] = (lanes_type){ filter->sections[k].a1, filter->sections[k].a1 };
+    a2[k] = (lanes_type){ filter->sections[k].a2, filter->sections[k].a2 };
+    s1[k] = filter->state[k][0];
+    s2[k] = filter->state[k][1];
+  }
+
+  for(i = 0; i < sample_count; i ++) {
+    y = (lanes_type){ input_l[i], input_r[i] };
+    for(k = 0; k < section_count; k ++) {
+      x = y;
+      y = LANES_MULADD(b0[k], x, s1[k]);
+      s1[k] = LANES_MULADD(b1[k], x, LANES_MULADD(-a1[k], y, s2[k]));
+      s2[k] = LANES_MULADD(b2[k], x, -a2[k] * y);
+    }
+    output_l[i] = y[0];
+    output_r[i] = y[1];
+  }
+
+  for(k = 0; k < section_count; k ++) {
+    filter->state[k][0] = s1[k];
+    filter->state[k][1] = s2[k];
+  }
+}
+
+// each number of sections gets its own copy of the cascade, with the
+// loop over the sections unrolled and their state in registers
+#define CASCADE_CASE(count)                                             \
+  case count:                                                           \
+    if(stereo)                                                          \
+      run_cascade_stereo(filter, input_l, input_r, output_l, output_r,  \
+                         sample_count, count);                          \
+    else                                                                \
+      run_cascade_mono(filter, input_l, output_l, sample_count, count); \
+    break;
+
+/**
+ * Run the cascade over a block, with the number of sections it has.
+ * The input and output buffers may be the same.
+ */
+static void run_cascade(filter_type *filter, const LADSPA_Data *input_l,
+                        const LADSPA_Data *input_r, LADSPA_Data *output_l,
+                        LADSPA_Data *output_r, unsigned long sample_count,
+                        int stereo)
+{
+  switch(filter->section_count) {
+  CASCADE_CASE(1)
+  CASCADE_CASE(2)
+  CASCADE_CASE(3)
+  CASCADE_CASE(4)
+  CASCADE_CASE(5)
+  CASCADE_CASE(6)
+  CASCADE_CASE(7)
+  CASCADE_CASE(8)
+  }
+}
+
+/**
+ * This is where the action happens.
+ */
+static inline void run_filter(LADSPA_Handle instance,
+                              unsigned long sample_count, int stereo)
+{
+  filter_type *filter = (filter_type *)instance;
+  unsigned long segment_length, offset;
+  int type, design, order;
+  LADSPA_Data ripple;
+
+  // the controls are clamped before they're converted, since a value
+  // out of the range of an int doesn't convert to anything
+  type = (int)kernel_clamp(*filter->type_control_value, TYPE_LOWPASS,
+                           TYPE_HIGHPASS);
+  design = (int)kernel_clamp(*filter->design_control_value,
+                             DESIGN_BUTTERWORTH, DESIGN_LINKWITZ_RILEY);
+  order = (int)kernel_clamp(*filter->order_control_value, 1, MAX_ORDER);
+  ripple = kernel_clamp(*filter->ripple_control_value, RIPPLE_LOWER,
+                        RIPPLE_UPPER);
+
+  // a new shape or order starts from silence, since the old state
+  // doesn't mean anything to the new sections.
+  if(type != filter->type || design != filter->design ||
+     order != filter->order) {
+    memset(filter->state, 0, sizeof(filter->state));
+    smooth_reset(&filter->freq);
+  }
+
+  filter->type = type;
+  filter->design = design;
+  filter->order = order;
+
+  if(smooth_start(&filter->freq,
+                  kernel_clamp(*filter->freq_control_value, FREQ_LOWER,
+                               FREQ_UPPER), sample_count) ||
+     ripple != filter->ripple) {
+    filter->ripple = ripple;
+    design_sections(filter, filter->freq.value);
+  }
+
+  for(offset = 0; offset < sample_count; offset += segment_length) {
+    // the sections are only redesigned at control rate, while the
+    // frequency ramps. without a ramp there is nothing to redesign,
+    // so the rest of the block is one segment.
+    if(filter->freq.value != filter->freq.target) {
+      segment_length = smooth_segment(sample_count - offset);
+      design_sections(filter, smooth_advance(&filter->freq, segment_length));
+    }
+    else
+      segment_length = sample_count - offset;
+
+    run_cascade(filter, filter->input_buffer_l + offset,
+                stereo ? filter->input_buffer_r + offset : NULL,
+                filter->output_buffer_l + offset,
+                stereo ? filter->output_buffer_r + offset : NULL,
+                segment_length, stereo);
+  }
+
+  smooth_end(&filter->freq);
+}
+
+static void run_mono_filter(LADSPA_Handle instance,
+                            unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 0);
+}
+
+static void run_stereo_filter(LADSPA_Handle instance,
+                              unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 1);
+}
+
+static void cleanup_filter(LADSPA_Handle instance)
+{
+  free(instance);
+}
+
+/**
+ * The ports of the stereo plugin. The mono plugin has the same ports
+ * without the right channel, so it uses the first PortCount entries
+ * of the same tables, apart from the names of the audio ports.
+ */
+static const LADSPA_PortDescriptor port_descriptors[] = {
+  [TYPE_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [DESIGN_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [FREQ_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [ORDER_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [RIPPLE_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+  [INPUT_R] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_R] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+
+static const char *const mono_port_names[] = {
+  [TYPE_CONTROL] = "Type (0 = lowpass, 1 = highpass)",
+  [DESIGN_CONTROL] =
+    "Design (0 = Butterworth, 1 = Chebyshev, 2 = Linkwitz-Riley)",
+  [FREQ_CONTROL] = "Frequency",
+  [ORDER_CONTROL] = "Order",
+  [RIPPLE_CONTROL] = "Ripple (dB)",
+  [INPUT_L] = "Input",
+  [OUTPUT_L] = "Output"
+};
+
+static const char *const stereo_port_names[] = {
+  [TYPE_CONTROL] = "Type (0 = lowpass, 1 = highpass)",
+  [DESIGN_CONTROL] =
+    "Design (0 = Butterworth, 1 = Chebyshev, 2 = Linkwitz-Riley)",
+  [FREQ_CONTROL] = "Frequency",
+  [ORDER_CONTROL] = "Order",
+  [RIPPLE_CONTROL] = "Ripple (dB)",
+  [INPUT_L] = "Input Left",
+  [OUTPUT_L] = "Output Left",
+  [INPUT_R] = "Input Right",
+  [OUTPUT_R] = "Output Right"
+};
+
+static const LADSPA_PortRangeHint port_range_hints[] = {
+  [TYPE_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_INTEGER
+                     | LADSPA_HINT_DEFAULT_MINIMUM,
+                     TYPE_LOWPASS, TYPE_HIGHPASS },
+  [DESIGN_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                       | LADSPA_HINT_BOUNDED_ABOVE
+                       | LADSPA_HINT_INTEGER
+                       | LADSPA_HINT_DEFAULT_MINIMUM,
+                       DESIGN_BUTTERWORTH, DESIGN_LINKWITZ_RILEY },
+  [FREQ_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_LOGARITHMIC
+                     | LADSPA_HINT_DEFAULT_440,
+                     FREQ_LOWER, FREQ_UPPER },
+  [ORDER_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                      | LADSPA_HINT_BOUNDED_ABOVE
+                      | LADSPA_HINT_INTEGER
+                      | LADSPA_HINT_DEFAULT_LOW,
+                      1, MAX_ORDER },
+  [RIPPLE_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                       | LADSPA_HINT_BOUNDED_ABOVE
+                       | LADSPA_HINT_DEFAULT_1,
+                       RIPPLE_LOWER, RIPPLE_UPPER },
+  [INPUT_L] = { 0, 0, 0 },
+  [OUTPUT_L] = { 0, 0, 0 },
+  [INPUT_R] = { 0, 0, 0 },
+  [OUTPUT_R] = { 0, 0, 0 }
+};
+
+/**
+ * The descriptors the host will be using. They are constant data, so
+ * there is nothing to build when the library is loaded and nothing
+ * to free when it is unloaded.
+ */
+static const LADSPA_Descriptor mono_descriptor = {
+  .UniqueID = 0x00654331,
+  .Label = "biquad_mono",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "Cascaded biquad filter (mono)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 7,
+  .PortDescriptors = port_descriptors,
+  .PortNames = mono_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_mono_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+static const LADSPA_Descriptor stereo_descriptor = {
+  .UniqueID = 0x00654332,
+  .Label = "biquad_stereo",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "Cascaded biquad filter (stereo)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 9,
+  .PortDescriptors = port_descriptors,
+  .PortNames = stereo_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_stereo_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+/* Return a descriptor of the requested plugin type. There are two
+   plugin types available in this library (mono and stereo). */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  switch (index) {
+  case 0:
+    return &mono_descriptor;
+  case 1:
+    return &stereo_descriptor;
+  default:
+    return NULL;
+  }
+}
@@ -0,0 +1,409 @@
+/*
+ * capture.c - Record what a host does with the plugins of a library
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A library that stands in for another one and records a trace (see
+ * trace.h) of everything the host does with its plugins, so that
+ * replay can run exactly the same thing again later. CAPTURE_LIBRARY
+ * names the library to stand in for, and CAPTURE_TRACE the trace to
+ * write, capture.trace by default. Its plugins have the same labels
+ * and IDs as the real ones, so the host should load it instead of
+ * that library, not next to it (from a directory of its own on
+ * LADSPA_PATH, say).
+ *
+ * Every call to run() is recorded with its input and output, so the
+ * trace grows by twice the audio that goes through the plugins, and
+ * the host runs slower while it's captured. run_adding() isn't
+ * offered, so hosts use run() instead.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "ladspa.h"
+#include "trace.h"
+
+#define MAX_DESCRIPTORS 256
+
+/**
+ * An instance of a real plugin, with where its ports are connected and
+ * what its last run was, so only what changes has to be recorded.
+ */
+typedef struct {
+  const LADSPA_Descriptor *real;
+  LADSPA_Handle handle;
+  uint32_t id;
+  unsigned long port_count;
+  int ran;
+
+  LADSPA_Data **ports;
+  LADSPA_Data *controls;
+  uint16_t *layout;
+  uint16_t *new_layout;
+
+  // the buffers connected for this run, in the order of their first
+  // port, and whether an input or an output is connected to them
+  LADSPA_Data **buffers;
+  char *inputs;
+  char *outputs;
+
+  // the record being built
+  unsigned char *record;
+  size_t record_room;
+} capture_instance_type;
+
+static LADSPA_Descriptor descriptors[MAX_DESCRIPTORS];
+static const LADSPA_Descriptor *reals[MAX_DESCRIPTORS];
+static unsigned long descriptor_count;
+
+static pthread_once_t capture_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace;
+static uint32_t next_instance;
+
+/**
+ * The floating point control register of this thread.
+ */
+static uint32_t fp_control(void)
+{
+#if defined(__SSE__)
+  return _mm_getcsr();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Add a record to the trace, all at once so that the records of
+ * instances in different threads don't get mixed up.
+ */
+static void write_record(uint32_t type, uint32_t instance,
+                         const void *payload, size_t size)
+{
+  trace_record_type record = { type, instance, size };
+
+  pthread_mutex_lock(&trace_lock);
+  if(trace &&
+     (fwrite(&record, sizeof(record), 1, trace) != 1 ||
+      (size > 0 && fwrite(payload, size, 1, trace) != 1))) {
+    perror("capture");
+    fclose(trace);
+    trace = NULL;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Make sure the instance's record has room for size bytes. Returns 0
+ * if it can't.
+ */
+static int make_room(capture_instance_type *instance, size_t size)
+{
+  unsigned char *record;
+
+  if(size <= instance->record_room)
+    return 1;
+  if(!(record = realloc(instance->record, size)))
+    return 0;
+  instance->record = record;
+  instance->record_room = size;
+  return 1;
+}
+
+static void free_instance(capture_instance_type *instance)
+{
+  free(instance->ports);
+  free(instance->controls);
+  free(instance->layout);
+  free(instance->new_layout);
+  free(instance->buffers);
+  free(instance->inputs);
+  free(instance->outputs);
+  free(instance->record);
+  free(instance);
+}
+
+static LADSPA_Handle capture_instantiate(const LADSPA_Descriptor *descriptor,
+                                         unsigned long sample_rate)
+{
+  const LADSPA_Descriptor *real = reals[descriptor - descriptors];
+  capture_instance_type *instance = calloc(1, sizeof(*instance));
+  unsigned long count = real->PortCount;
+  trace_instance_type header = { real->UniqueID, count, sample_rate };
+  size_t length = strlen(real->Label);
+
+  if(!instance)
+    return NULL;
+  instance->real = real;
+  instance->port_count = count;
+  instance->ports = calloc(count, sizeof(LADSPA_Data *));
+  instance->controls = calloc(count, sizeof(LADSPA_Data));
+  instance->layout = calloc(count, sizeof(uint16_t));
+  instance->new_layout = calloc(count, sizeof(uint16_t));
+  instance->buffers = calloc(count, sizeof(LADSPA_Data *));
+  instance->inputs = calloc(count, 1);
+  instance->outputs = calloc(count, 1);
+  if(!instance->ports || !instance->controls || !instance->layout ||
+     !instance->new_layout || !instance->buffers || !instance->inputs ||
+     !instance->outputs || !make_room(instance, sizeof(header) + length) ||
+     !(instance->handle = real->instantiate(real, sample_rate))) {
+    free_instance(instance);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&trace_lock);
+  instance->id = next_instance ++;
+  pthread_mutex_unlock(&trace_lock);
+
+  memcpy(instance->record, &header, sizeof(header));
+  memcpy(instance->record + sizeof(header), real->Label, length);
+  if(trace)
+    write_record(TRACE_INSTANTIATE, instance->id, instance->record,
+                 sizeof(header) + length);
+
+  return instance;
+}
+
+static void capture_connect_port(LADSPA_Handle handle, unsigned long port,
+                                 LADSPA_Data *data_location)
+{
+  capture_instance_type *instance = (capture_instance_type *)handle;
+
+  instance->ports[port] = data_location;
+  instance->real->connect_port(instance->handle, port, data_location);
+}
+
+static void capture_activate(LADSPA_Handle handle)
+{
+  capture_instance_type *instance = (capture_instance_type *)handle;
+
+  if(instance->real->activate)
+    instance->real->activate(instance->handle);
+  if(trace)
+    write_record(TRACE_ACTIVATE, instance->id, NULL, 0);
+}
+
+/**
+ * Run the real plugin, and record what it was given and what it gave.
+ */
+static void capture_run(LADSPA_Handle handle, unsigned long sample_count)
+{
+  capture_instance_type *instance = (capture_instance_type *)handle;
+  const LADSPA_Descriptor *real = instance->real;
+  trace_run_type run = { sample_count, 0, 0, fp_control(), 0 };
+  trace_control_type control;
+  LADSPA_PortDescriptor port_descriptor;
+  unsigned long port, buffer, buffer_count = 0, ins = 0, outs = 0;
+  size_t size, block = sample_count * sizeof(LADSPA_Data), at;
+
+  if(!trace) {
+    real->run(instance->handle, sample_count);
+    return;
+  }
+
+  // number the buffers, and count the controls that changed
+  for(port = 0; port < instance->port_count; port ++) {
+    port_descriptor = real->PortDescriptors[port];
+    instance->new_layout[port] = TRACE_NO_BUFFER;
+    if(!instance->ports[port])
+      continue;
+
+    if(LADSPA_IS_PORT_CONTROL(port_descriptor)) {
+      if(LADSPA_IS_PORT_INPUT(port_descriptor) &&
+         (!instance->ran || memcmp(&instance->controls[port],
+                                   instance->ports[port],
+                                   sizeof(LADSPA_Data)) != 0))
+        run.control_count ++;
+      continue;
+    }
+
+    for(buffer = 0; buffer < buffer_count; buffer ++)
+      if(instance->buffers[buffer] == instance->ports[port])
+        break;
+    if(buffer == buffer_count) {
+      instance->buffers[buffer_count ++] = instance->ports[port];
+      instance->inputs[buffer] = instance->outputs[buffer] = 0;
+    }
+    if(LADSPA_IS_PORT_INPUT(port_descriptor))
+      instance->inputs[buffer] = 1;
+    else
+      instance->outputs[buffer] = 1;
+    instance->new_layout[port] = buffer;
+  }
+  for(buffer = 0; buffer < buffer_count; buffer ++) {
+    ins += instance->inputs[buffer];
+    outs += instance->outputs[buffer];
+  }
+  run.layout_changed = !instance->ran ||
+    memcmp(instance->layout, instance->new_layout,
+           instance->port_count * sizeof(uint16_t)) != 0;
+
+  size = sizeof(run) + run.control_count * sizeof(control) +
+    (run.layout_changed ? instance->port_count * sizeof(uint16_t) : 0) +
+    (ins + outs) * block;
+  if(!make_room(instance, size)) {
+    real->run(instance->handle, sample_count);
+    return;
+  }
+
+  memcpy(instance->record, &run, sizeof(run));
+  at = sizeof(run);
+  for(port = 0; port < instance->port_count; port ++) {
+    port_descriptor = real->PortDescriptors[port];
+    if(!instance->ports[port] || !LADSPA_IS_PORT_CONTROL(port_descriptor) ||
+       !LADSPA_IS_PORT_INPUT(port_descriptor) ||
+       (instance->ran && memcmp(&instance->controls[port],
+                                instance->ports[port],
+                                sizeof(LADSPA_Data)) == 0))
+      continue;
+    instance->controls[port] = *instance->ports[port];
+    control.port = port;
+    control.value = instance->controls[port];
+    memcpy(instance->record + at, &control, sizeof(control));
+    at += sizeof(control);
+  }
+  if(run.layout_changed) {
+    memcpy(instance->layout, instance->new_layout,
+           instance->port_count * sizeof(uint16_t));
+    memcpy(instance->record + at, instance->layout,
+           instance->port_count * sizeof(uint16_t));
+    at += instance->port_count * sizeof(uint16_t);
+  }
+  for(buffer = 0; buffer < buffer_count; buffer ++)
+    if(instance->inputs[buffer]) {
+      memcpy(instance->record + at, instance->buffers[buffer], block);
+      at += block;
+    }
+
+  real->run(instance->handle, sample_count);
+  instance->ran = 1;
+
+  for(buffer = 0; buffer < buffer_count; buffer ++)
+    if(instance->outputs[buffer]) {
+      memcpy(instance->record + at, instance->buffers[buffer], block);
+      at += block;
+    }
+
+  write_record(TRACE_RUN, instance->id, instance->record, size);
+}
+
+static void capture_deactivate(LADSPA_Handle handle)
+{
+  capture_instance_type *instance = (capture_instance_type *)handle;
+
+  if(instance->real->deactivate)
+    instance->real->deactivate(instance->handle);
+  if(trace)
+    write_record(TRACE_DEACTIVATE, instance->id, NULL, 0);
+}
+
+static void capture_cleanup(LADSPA_Handle handle)
+{
+  capture_instance_type *instance = (capture_instance_type *)handle;
+
+  instance->real->cleanup(instance->handle);
+  if(trace) {
+    write_record(TRACE_CLEANUP, instance->id, NULL, 0);
+    pthread_mutex_lock(&trace_lock);
+    if(trace)
+      fflush(trace);
+    pthread_mutex_unlock(&trace_lock);
+  }
+  free_instance(instance);
+}
+
+/**
+ * Load the real library, start the trace and make a copy of each real
+ * descriptor that calls the functions above instead. If anything goes
+ * wrong, there are no descriptors, and the host is told why.
+ */
+static void start_capture(void)
+{
+  const char *library = getenv("CAPTURE_LIBRARY");
+  const char *path = getenv("CAPTURE_TRACE");
+  LADSPA_Descriptor_Function get_descriptor;
+  const LADSPA_Descriptor *real;
+  LADSPA_Descriptor *descriptor;
+  trace_header_type header;
+  void *handle;
+
+  if(!library) {
+    fprintf(stderr, "capture: set CAPTURE_LIBRARY to the library to "
+            "capture\n");
+    return;
+  }
+  if(!(handle = dlopen(library, RTLD_NOW | RTLD_LOCAL)) ||
+     !(get_descriptor = (LADSPA_Descriptor_Function)
+       dlsym(handle, "ladspa_descriptor"))) {
+    fprintf(stderr, "capture: %s\n", dlerror());
+    return;
+  }
+
+  path = path ? path : "capture.trace";
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.library_length = strlen(library);
+  if(!(trace = fopen(path, "wb")) ||
+     fwrite(&header, sizeof(header), 1, trace) != 1 ||
+     fwrite(library, header.library_length, 1, trace) != 1) {
+    perror(path);
+    if(trace)
+      fclose(trace);
+    trace = NULL;
+    return;
+  }
+
+  while(descriptor_count < MAX_DESCRIPTORS &&
+        (real = get_descriptor(descriptor_count))) {
+    descriptor = &descriptors[descriptor_count];
+    reals[descriptor_count ++] = real;
+    *descriptor = *real;
+    descriptor->instantiate = capture_instantiate;
+    descriptor->connect_port = capture_connect_port;
+    descriptor->activate = capture_activate;
+    descriptor->run = capture_run;
+    descriptor->run_adding = NULL;
+    descriptor->set_run_adding_gain = NULL;
+    descriptor->deactivate = capture_deactivate;
+    descriptor->cleanup = capture_cleanup;
+  }
+}
+
+/* Return the copy of the real library's descriptor at index, or null
+   if there are no more. */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  pthread_once(&capture_once, start_capture);
+
+  if(index < descriptor_count)
+    return &descriptors[index];
+
+  return NULL;
+}
@@ -0,0 +1,463 @@
+/*
+ * chain.c - Fixed chains of the other plugins, run tile by tile
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A chain runs some of the other plugins in series as one plugin.
+ * When a host runs them separately, each one streams the whole block
+ * through memory before the next one starts. Here every stage runs
+ * over a tile of CHAIN_TILE samples before the next one does, in
+ * place in the output buffer, so a tile stays in L1 cache all the way
+ * through the chain.
+ *
+ * The ports of a chain are the control ports of each stage in turn,
+ * named after the stage, followed by the audio inputs of the first
+ * stage and the audio outputs of the last. The audio outputs of each
+ * stage feed the audio inputs of the next in order, so all stages
+ * need the same number of channels.
+ *
+ * The stages only see one tile per call, so the chain ramps their
+ * controls itself: each tile is run with the value the control would
+ * have reached at the end of it. The stages' own smoothing then
+ * follows the same ramp across the block as it would have if they had
+ * been run on the whole of it.
+ *
+ * The stages are linked in from the objects of the combined library
+ * (see the Makefile), so chain.so doesn't depend on the other
+ * libraries being installed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+
+// a multiple of SMOOTH_INTERVAL, so that the stages recompute their
+// coefficients at the same points as they would over the whole block
+#define CHAIN_TILE 256
+
+#if CHAIN_TILE % SMOOTH_INTERVAL != 0
+#error CHAIN_TILE must be a multiple of SMOOTH_INTERVAL
+#endif
+
+#define MAX_STAGES         4
+#define MAX_CHAIN_PORTS    32
+#define MAX_CHAIN_CHANNELS 16
+#define PORT_NAME_LENGTH   64
+
+const LADSPA_Descriptor *iir_descriptor(unsigned long index);
+const LADSPA_Descriptor *reson_descriptor(unsigned long index);
+const LADSPA_Descriptor *comb_lopass_descriptor(unsigned long index);
+
+/**
+ * One stage of a chain: the plugin, and the word that goes before the
+ * names of its control ports.
+ */
+typedef struct {
+  LADSPA_Descriptor_Function plugin;
+  const char *prefix;
+} stage_type;
+
+/**
+ * A chain as it is defined below. layout is the index of the
+ * descriptor used from each stage's plugin, 0 for mono and 1 for
+ * stereo.
+ */
+typedef struct {
+  unsigned long unique_id;
+  const char *label;
+  const char *name;
+  unsigned long layout;
+  int stage_count;
+  stage_type stages[MAX_STAGES];
+} definition_type;
+
+static const definition_type definitions[] = {
+  { 0x00654349, "chain_iir_reson_comb_lopass_mono",
+    "IIR, reson and low-passed comb chain (mono)", 0, 3,
+    { { iir_descriptor, "IIR" }, { reson_descriptor, "Reson" },
+      { comb_lopass_descriptor, "Comb" } } },
+  { 0x0065434A, "chain_iir_reson_comb_lopass_stereo",
+    "IIR, reson and low-passed comb chain (stereo)", 1, 3,
+    { { iir_descriptor, "IIR" }, { reson_descriptor, "Reson" },
+      { comb_lopass_descriptor, "Comb" } } }
+};
+
+#define CHAIN_COUNT (sizeof(definitions) / sizeof(definitions[0]))
+
+/**
+ * A chain's descriptor, its port tables, and where each of its ports
+ * goes. These are built from the stages' descriptors the first time
+ * ladspa_descriptor() is called.
+ */
+typedef struct {
+  LADSPA_Descriptor descriptor;
+  LADSPA_PortDescriptor port_descriptors[MAX_CHAIN_PORTS];
+  const char *port_names[MAX_CHAIN_PORTS];
+  char names[MAX_CHAIN_PORTS][PORT_NAME_LENGTH];
+  LADSPA_PortRangeHint port_range_hints[MAX_CHAIN_PORTS];
+
+  int stage_count;
+  const LADSPA_Descriptor *stages[MAX_STAGES];
+
+  // the stage and the port of the stage that each control port of
+  // the chain belongs to
+  int control_stage[MAX_CHAIN_PORTS];
+  unsigned long control_port[MAX_CHAIN_PORTS];
+
+  // the chain's audio ports, and the audio ports of each stage, by
+  // channel
+  int channels;
+  unsigned long inputs[MAX_CHAIN_CHANNELS];
+  unsigned long outputs[MAX_CHAIN_CHANNELS];
+  unsigned long stage_inputs[MAX_STAGES][MAX_CHAIN_CHANNELS];
+  unsigned long stage_outputs[MAX_STAGES][MAX_CHAIN_CHANNELS];
+} chain_type;
+
+/**
+ * Structure to hold connections and state.
+ */
+typedef struct {
+  const chain_type *chain;
+  LADSPA_Handle stages[MAX_STAGES];
+  LADSPA_Data *ports[MAX_CHAIN_PORTS];
+
+  // the control values the stages get for the current tile, and the
+  // values the controls had at the end of the previous block
+  LADSPA_Data controls[MAX_CHAIN_PORTS];
+  LADSPA_Data previous[MAX_CHAIN_PORTS];
+  int primed;
+} filter_type;
+
+static chain_type chains[CHAIN_COUNT];
+static int chains_built[CHAIN_COUNT];
+static pthread_once_t chains_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Construct a new plugin instance, with an instance of every stage.
+ */
+static LADSPA_Handle instantiate_chain(const LADSPA_Descriptor *descriptor,
+                                       unsigned long sample_rate)
+{
+  const chain_type *chain =
+    (const chain_type *)descriptor->ImplementationData;
+  filter_type *filter = calloc(1, sizeof(filter_type));
+  unsigned long port;
+  int stage;
+
+  if(!filter)
+    return NULL;
+  filter->chain = chain;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    filter->stages[stage] =
+      chain->stages[stage]->instantiate(chain->stages[stage], sample_rate);
+    if(!filter->stages[stage]) {
+      while(stage -- > 0)
+        chain->stages[stage]->cleanup(filter->stages[stage]);
+      free(filter);
+      return NULL;
+    }
+  }
+
+  // the stages' input controls read the chain's own copies, which
+  // run_chain() ramps across the block
+  for(port = 0; port < chain->descriptor.PortCount; port ++)
+    if(LADSPA_IS_PORT_CONTROL(chain->port_descriptors[port]) &&
+       LADSPA_IS_PORT_INPUT(chain->port_descriptors[port])) {
+      stage = chain->control_stage[port];
+      chain->stages[stage]->connect_port(filter->stages[stage],
+                                         chain->control_port[port],
+                                         &filter->controls[port]);
+    }
+
+  return filter;
+}
+
+static void activate_chain(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  const chain_type *chain = filter->chain;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++)
+    if(chain->stages[stage]->activate)
+      chain->stages[stage]->activate(filter->stages[stage]);
+
+  filter->primed = 0;
+}
+
+/**
+ * Connect a port to a data location. Output controls go straight to
+ * their stage; everything else is connected by run_chain().
+ */
+static void connect_port_to_chain(LADSPA_Handle instance,
+                                  unsigned long port,
+                                  LADSPA_Data *data_location)
+{
+  filter_type *filter = (filter_type *)instance;
+  const chain_type *chain = filter->chain;
+  int stage;
+
+  filter->ports[port] = data_location;
+
+  if(LADSPA_IS_PORT_CONTROL(chain->port_descriptors[port]) &&
+     LADSPA_IS_PORT_OUTPUT(chain->port_descriptors[port])) {
+    stage = chain->control_stage[port];
+    chain->stages[stage]->connect_port(filter->stages[stage],
+                                       chain->control_port[port],
+                                       data_location);
+  }
+}
+
+/**
+ * This is where the action happens. Every stage runs over a tile of
+ * the output buffer, reading the input buffer in the first stage and
+ * the output buffer in the others, before the chain moves on to the
+ * next tile.
+ */
+static void run_chain(LADSPA_Handle instance, unsigned long sample_count)
+{
+  filter_type *filter = (filter_type *)instance;
+  const chain_type *chain = filter->chain;
+  const LADSPA_Descriptor *stage_descriptor;
+  LADSPA_Data start[MAX_CHAIN_PORTS];
+  LADSPA_Data target[MAX_CHAIN_PORTS];
+  LADSPA_Data *input;
+  unsigned long port_count = chain->descriptor.PortCount;
+  unsigned long tile_length, offset, port;
+  int stage, channel;
+
+  for(port = 0; port < port_count; port ++)
+    if(LADSPA_IS_PORT_CONTROL(chain->port_descriptors[port]) &&
+       LADSPA_IS_PORT_INPUT(chain->port_descriptors[port])) {
+      target[port] = *filter->ports[port];
+      start[port] = filter->primed ? filter->previous[port] : target[port];
+      filter->previous[port] = target[port];
+    }
+  filter->primed = 1;
+
+  for(offset = 0; offset < sample_count; offset += tile_length) {
+    tile_length = sample_count - offset < CHAIN_TILE ?
+      sample_count - offset : CHAIN_TILE;
+
+    // the last tile ends exactly on the target
+    for(port = 0; port < port_count; port ++)
+      if(LADSPA_IS_PORT_CONTROL(chain->port_descriptors[port]) &&
+         LADSPA_IS_PORT_INPUT(chain->port_descriptors[port]))
+        filter->controls[port] = offset + tile_length == sample_count ?
+          target[port] : start[port] + (target[port] - start[port]) *
+          (offset + tile_length) / sample_count;
+
+    for(stage = 0; stage < chain->stage_count; stage ++) {
+      stage_descriptor = chain->stages[stage];
+
+      for(channel = 0; channel < chain->channels; channel ++) {
+        input = stage == 0 ? filter->ports[chain->inputs[channel]] :
+          filter->ports[chain->outputs[channel]];
+        stage_descriptor->connect_port(filter->stages[stage],
+                                       chain->stage_inputs[stage][channel],
+                                       input + offset);
+        stage_descriptor->connect_port(filter->stages[stage],
+                                       chain->stage_outputs[stage][channel],
+                                       filter->ports[chain->outputs[channel]]
+                                       + offset);
+      }
+
+      stage_descriptor->run(filter->stages[stage], tile_length);
+    }
+  }
+}
+
+static void deactivate_chain(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  const chain_type *chain = filter->chain;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++)
+    if(chain->stages[stage]->deactivate)
+      chain->stages[stage]->deactivate(filter->stages[stage]);
+}
+
+static void cleanup_chain(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  const chain_type *chain = filter->chain;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++)
+    chain->stages[stage]->cleanup(filter->stages[stage]);
+  free(filter);
+}
+
+/**
+ * Add the ports of one stage to a chain. Returns 0 if the chain has
+ * too many ports or channels, or if the stage's audio inputs don't
+ * match the previous stage's outputs.
+ */
+static int add_stage(chain_type *chain, const definition_type *definition,
+                     int stage)
+{
+  const LADSPA_Descriptor *descriptor = chain->stages[stage];
+  LADSPA_PortDescriptor port_descriptor;
+  unsigned long port, chain_port;
+  int inputs = 0, outputs = 0;
+
+  for(port = 0; port < descriptor->PortCount; port ++) {
+    port_descriptor = descriptor->PortDescriptors[port];
+
+    if(LADSPA_IS_PORT_AUDIO(port_descriptor)) {
+      if(LADSPA_IS_PORT_INPUT(port_descriptor)) {
+        if(inputs == MAX_CHAIN_CHANNELS)
+          return 0;
+        chain->stage_inputs[stage][inputs ++] = port;
+      }
+      else {
+        if(outputs == MAX_CHAIN_CHANNELS)
+          return 0;
+        chain->stage_outputs[stage][outputs ++] = port;
+      }
+      continue;
+    }
+
+    chain_port = chain->descriptor.PortCount ++;
+    if(chain_port == MAX_CHAIN_PORTS)
+      return 0;
+    chain->port_descriptors[chain_port] = port_descriptor;
+    chain->port_range_hints[chain_port] = descriptor->PortRangeHints[port];
+    snprintf(chain->names[chain_port], PORT_NAME_LENGTH, "%s %s",
+             definition->stages[stage].prefix, descriptor->PortNames[port]);
+    chain->port_names[chain_port] = chain->names[chain_port];
+    chain->control_stage[chain_port] = stage;
+    chain->control_port[chain_port] = port;
+  }
+
+  if(inputs != outputs || (stage > 0 && inputs != chain->channels))
+    return 0;
+  chain->channels = inputs;
+
+  return 1;
+}
+
+/**
+ * Add the audio ports of the chain, named after those of the first
+ * and the last stage.
+ */
+static int add_audio_ports(chain_type *chain)
+{
+  const LADSPA_Descriptor *first = chain->stages[0];
+  const LADSPA_Descriptor *last = chain->stages[chain->stage_count - 1];
+  unsigned long chain_port;
+  int channel;
+
+  if(chain->descriptor.PortCount + 2 * chain->channels > MAX_CHAIN_PORTS)
+    return 0;
+
+  for(channel = 0; channel < chain->channels; channel ++) {
+    chain_port = chain->descriptor.PortCount ++;
+    chain->port_descriptors[chain_port] =
+      LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
+    chain->port_names[chain_port] =
+      first->PortNames[chain->stage_inputs[0][channel]];
+    chain->port_range_hints[chain_port].HintDescriptor = 0;
+    chain->inputs[channel] = chain_port;
+  }
+
+  for(channel = 0; channel < chain->channels; channel ++) {
+    chain_port = chain->descriptor.PortCount ++;
+    chain->port_descriptors[chain_port] =
+      LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
+    chain->port_names[chain_port] =
+      last->PortNames[chain->stage_outputs[chain->stage_count - 1][channel]];
+    chain->port_range_hints[chain_port].HintDescriptor = 0;
+    chain->outputs[channel] = chain_port;
+  }
+
+  return 1;
+}
+
+/**
+ * Build a chain's descriptor from its definition. Returns 0 if one of
+ * its stages doesn't exist or doesn't fit.
+ */
+static int build_chain(chain_type *chain, const definition_type *definition)
+{
+  LADSPA_Properties properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
+  int stage;
+
+  chain->stage_count = definition->stage_count;
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    chain->stages[stage] =
+      definition->stages[stage].plugin(definition->layout);
+    if(!chain->stages[stage] || !add_stage(chain, definition, stage))
+      return 0;
+    properties &= chain->stages[stage]->Properties;
+  }
+
+  if(!add_audio_ports(chain))
+    return 0;
+
+  chain->descriptor.UniqueID = definition->unique_id;
+  chain->descriptor.Label = definition->label;
+  chain->descriptor.Properties = properties;
+  chain->descriptor.Name = definition->name;
+  chain->descriptor.Maker = "Andreas Jansson";
+  chain->descriptor.Copyright = "GPL-3.0";
+  chain->descriptor.PortDescriptors = chain->port_descriptors;
+  chain->descriptor.PortNames = chain->port_names;
+  chain->descriptor.PortRangeHints = chain->port_range_hints;
+  chain->descriptor.ImplementationData = chain;
+  chain->descriptor.instantiate = instantiate_chain;
+  chain->descriptor.connect_port = connect_port_to_chain;
+  chain->descriptor.activate = activate_chain;
+  chain->descriptor.run = run_chain;
+  chain->descriptor.run_adding = NULL;
+  chain->descriptor.set_run_adding_gain = NULL;
+  chain->descriptor.deactivate = deactivate_chain;
+  chain->descriptor.cleanup = cleanup_chain;
+
+  return 1;
+}
+
+static void build_chains(void)
+{
+  unsigned long i;
+
+  for(i = 0; i < CHAIN_COUNT; i ++)
+    chains_built[i] = build_chain(&chains[i], &definitions[i]);
+}
+
+/* Return a descriptor of the requested plugin type. There is one
+   plugin type per chain in this library. The descriptors are built the
+   first time this is called, into static storage. */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  pthread_once(&chains_once, build_chains);
+
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  if(index < CHAIN_COUNT && chains_built[index])
+    return &chains[index].descriptor;
+
+  return NULL;
+}
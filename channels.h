@@ -0,0 +1,251 @@
+/*
+ * channels.h - Multichannel layouts shared by the plugins
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The plugins that use this come in CHANNEL_LAYOUTS versions, for 1,
+ * 2, 4, 8 and 16 channels. Every channel has the same ports as the mono
+ * version, in the same order, so port p belongs to channel
+ * p / PORTS_PER_CHANNEL. That keeps the mono and stereo port numbers
+ * the same as they always were.
+ *
+ * The filtering itself is done by the kernels of fir.h, iir.h and so
+ * on (see kernel.h), which keep the state of all channels in arrays
+ * indexed by channel, and which each plugin wraps. The run function
+ * is specialised for each channel count so that the loops over
+ * channels have a constant trip count and can be vectorised, and each
+ * specialisation is also compiled in the kernel variants of
+ * autotune.h.
+ */
+
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdlib.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+#include "autotune.h"
+
+#define MAX_CHANNELS    KERNEL_MAX_CHANNELS
+#define CHANNEL_LAYOUTS 5
+
+/**
+ * Expand F(PORT, suffix) once per channel of each layout, with the
+ * suffix that goes after the port names of that channel. Mono ports
+ * are just called "Input", stereo ports "Input Left" and "Input
+ * Right", and the rest "Input 1", "Input 2", ...
+ */
+#define CHANNELS_1(F, PORT) F(PORT, "")
+#define CHANNELS_2(F, PORT) F(PORT, " Left") F(PORT, " Right")
+#define CHANNELS_4(F, PORT)                                             \
+  F(PORT, " 1") F(PORT, " 2") F(PORT, " 3") F(PORT, " 4")
+#define CHANNELS_8(F, PORT)                                             \
+  CHANNELS_4(F, PORT)                                                   \
+  F(PORT, " 5") F(PORT, " 6") F(PORT, " 7") F(PORT, " 8")
+#define CHANNELS_16(F, PORT)                                            \
+  CHANNELS_8(F, PORT)                                                   \
+  F(PORT, " 9") F(PORT, " 10") F(PORT, " 11") F(PORT, " 12")            \
+  F(PORT, " 13") F(PORT, " 14") F(PORT, " 15") F(PORT, " 16")
+
+/**
+ * A plugin describes the ports of one channel by defining
+ * CHANNEL_PORTS(PORT, suffix) as a list of
+ * PORT(name suffix, port_descriptor, hint_descriptor, lower, upper)
+ * entries. These pick out one column of that table.
+ */
+#define CHANNEL_PORT_NAME(name, descriptor, hint, lower, upper) name,
+#define CHANNEL_PORT_DESCRIPTOR(name, descriptor, hint, lower, upper)  \
+  descriptor,
+#define CHANNEL_PORT_HINT(name, descriptor, hint, lower, upper)        \
+  { hint, lower, upper },
+
+/**
+ * The port tables and the descriptor for the layout with n channels,
+ * all static const so that loading the library allocates nothing.
+ */
+#define CHANNEL_DESCRIPTOR(n, unique_id, label, name, deactivation)     \
+  static const LADSPA_PortDescriptor port_descriptors_##n[] =           \
+    { CHANNELS_##n(CHANNEL_PORTS, CHANNEL_PORT_DESCRIPTOR) };           \
+  static const char *const port_names_##n[] =                           \
+    { CHANNELS_##n(CHANNEL_PORTS, CHANNEL_PORT_NAME) };                 \
+  static const LADSPA_PortRangeHint port_range_hints_##n[] =            \
+    { CHANNELS_##n(CHANNEL_PORTS, CHANNEL_PORT_HINT) };                 \
+  static const LADSPA_Descriptor descriptor_##n = {                     \
+    .UniqueID = unique_id,                                              \
+    .Label = label,                                                     \
+    .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,                      \
+    .Name = name,                                                       \
+    .Maker = "Andreas Jansson",                                         \
+    .Copyright = "GPL-3.0",                                             \
+    .PortCount = n * PORTS_PER_CHANNEL,                                 \
+    .PortDescriptors = port_descriptors_##n,                            \
+    .PortNames = port_names_##n,                                        \
+    .PortRangeHints = port_range_hints_##n,                             \
+    .ImplementationData = (void *)run_filter_kernels_##n,               \
+    .instantiate = instantiate_filter,                                  \
+    .connect_port = connect_port_to_filter,                             \
+    .activate = activate_filter,                                        \
+    .run = run_filter_tuned,                                            \
+    .run_adding = NULL,                                                 \
+    .set_run_adding_gain = NULL,                                        \
+    .deactivate = deactivation,                                         \
+    .cleanup = cleanup_filter                                           \
+  }
+
+/**
+ * The descriptors of all layouts of a plugin, and the table of them
+ * that ladspa_descriptor() returns from.
+ */
+#define CHANNEL_DESCRIPTORS(label, name, deactivation,                  \
+                            id_1, id_2, id_4, id_8, id_16)              \
+  CHANNEL_DESCRIPTOR(1, id_1, label "_mono", name " (mono)",            \
+                     deactivation);                                     \
+  CHANNEL_DESCRIPTOR(2, id_2, label "_stereo", name " (stereo)",        \
+                     deactivation);                                     \
+  CHANNEL_DESCRIPTOR(4, id_4, label "_4ch", name " (4 channels)",       \
+                     deactivation);                                     \
+  CHANNEL_DESCRIPTOR(8, id_8, label "_8ch", name " (8 channels)",       \
+                     deactivation);                                     \
+  CHANNEL_DESCRIPTOR(16, id_16, label "_16ch", name " (16 channels)",   \
+                     deactivation);                                     \
+  static const LADSPA_Descriptor *const descriptors[CHANNEL_LAYOUTS] =  \
+    { &descriptor_1, &descriptor_2, &descriptor_4, &descriptor_8,       \
+      &descriptor_16 }
+
+/**
+ * Number of channels of the layout a descriptor was built for.
+ */
+static inline int channels_of(const LADSPA_Descriptor *descriptor,
+                              int ports_per_channel)
+{
+  return descriptor->PortCount / ports_per_channel;
+}
+
+/**
+ * Call run(instance, sample_count, channels) for any block size.
+ */
+#define CHANNEL_ANY_BLOCK(run, instance, sample_count, channels)        \
+  run(instance, sample_count, channels)
+
+/**
+ * Call run(instance, sample_count, channels) with the block size as a
+ * constant when it is one of the power-of-two sizes hosts commonly
+ * use. Every segment is then SMOOTH_INTERVAL long, so the compiler
+ * knows all trip counts and the ramp steps divide by constants. Any
+ * other block size takes the generic path.
+ */
+#define CHANNEL_FIXED_BLOCK(run, instance, sample_count, channels)      \
+  switch(sample_count) {                                                \
+  case 64:                                                              \
+    run(instance, 64, channels);                                        \
+    break;                                                              \
+  case 128:                                                             \
+    run(instance, 128, channels);                                       \
+    break;                                                              \
+  case 256:                                                             \
+    run(instance, 256, channels);                                       \
+    break;                                                              \
+  default:                                                              \
+    run(instance, sample_count, channels);                              \
+  }
+
+/**
+ * Define the run functions of one kernel variant, run##variant##_1 to
+ * run##variant##_16, each calling run through block (one of the two
+ * above) with a constant channel count. attributes say how the
+ * variant is compiled (see autotune.h). run itself must be always
+ * inlined, or the compiler will call the same generic run function
+ * from all of them.
+ */
+#define CHANNEL_RUN_VARIANT(run, variant, attributes, block)            \
+  static void attributes run##variant##_1(LADSPA_Handle instance,       \
+                                          unsigned long sample_count)   \
+  {                                                                     \
+    block(run, instance, sample_count, 1);                              \
+  }                                                                     \
+  static void attributes run##variant##_2(LADSPA_Handle instance,       \
+                                          unsigned long sample_count)   \
+  {                                                                     \
+    block(run, instance, sample_count, 2);                              \
+  }                                                                     \
+  static void attributes run##variant##_4(LADSPA_Handle instance,       \
+                                          unsigned long sample_count)   \
+  {                                                                     \
+    block(run, instance, sample_count, 4);                              \
+  }                                                                     \
+  static void attributes run##variant##_8(LADSPA_Handle instance,       \
+                                          unsigned long sample_count)   \
+  {                                                                     \
+    block(run, instance, sample_count, 8);                              \
+  }                                                                     \
+  static void attributes run##variant##_16(LADSPA_Handle instance,      \
+                                           unsigned long sample_count)  \
+  {                                                                     \
+    block(run, instance, sample_count, 16);                             \
+  }
+
+/**
+ * The variants of the run function for the layout with n channels,
+ * in the order of tune_variant_names.
+ */
+#define CHANNEL_RUN_KERNELS(run, n)                                     \
+  static const tune_run_type run##_kernels_##n[TUNE_VARIANTS] =         \
+    { run##_scalar_##n, run##_sse2_##n, run##_avx2_##n, run##_avx512_##n }
+
+/**
+ * Define every variant of the run function for every channel layout,
+ * and run##_tuned, the run function of the descriptors. That one runs
+ * the variant that instantiate_filter() picked with tune_kernel() and
+ * stored in the instance's kernel.
+ */
+#define CHANNEL_RUN_BLOCK_FUNCTIONS(run, block)                         \
+  CHANNEL_RUN_VARIANT(run, _scalar, , block)                            \
+  CHANNEL_RUN_VARIANT(run, _sse2, TUNE_SSE2, block)                     \
+  CHANNEL_RUN_VARIANT(run, _avx2, TUNE_AVX2, block)                     \
+  CHANNEL_RUN_VARIANT(run, _avx512, TUNE_AVX512, block)                 \
+  CHANNEL_RUN_KERNELS(run, 1);                                          \
+  CHANNEL_RUN_KERNELS(run, 2);                                          \
+  CHANNEL_RUN_KERNELS(run, 4);                                          \
+  CHANNEL_RUN_KERNELS(run, 8);                                          \
+  CHANNEL_RUN_KERNELS(run, 16);                                         \
+  static void run##_tuned(LADSPA_Handle instance,                       \
+                          unsigned long sample_count)                   \
+  {                                                                     \
+    ((filter_type *)instance)->kernel(instance, sample_count);          \
+  }
+
+#define CHANNEL_RUN_FUNCTIONS(run)                                      \
+  CHANNEL_RUN_BLOCK_FUNCTIONS(run, CHANNEL_ANY_BLOCK)
+
+/**
+ * The same, with kernels for the fixed block sizes of
+ * CHANNEL_FIXED_BLOCK as well if CHANNEL_FIXED_BLOCKS is defined.
+ * That is four times the code, and with gcc 12 on x86-64 it is no
+ * faster, so it's off by default (see FIXED_BLOCKS in the Makefile).
+ */
+#ifdef CHANNEL_FIXED_BLOCKS
+#define CHANNEL_RUN_FIXED_BLOCK_FUNCTIONS(run)                          \
+  CHANNEL_RUN_BLOCK_FUNCTIONS(run, CHANNEL_FIXED_BLOCK)
+#else
+#define CHANNEL_RUN_FIXED_BLOCK_FUNCTIONS(run)                          \
+  CHANNEL_RUN_BLOCK_FUNCTIONS(run, CHANNEL_ANY_BLOCK)
+#endif
+
+#endif
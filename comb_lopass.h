@@ -0,0 +1,207 @@
+/*
+ * comb_lopass.h - The kernel of the low-passed comb filter
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filter of comb_lopass.c, without LADSPA (see kernel.h). It is
+ * the comb filter of comb.h with a low pass in the loop, which makes it
+ * sound like a plucked string. Each channel has the delay, a whole
+ * number of samples from 1 to COMB_LOPASS_MAX_DELAY, and the sharpness
+ * of the peaks, from .5 to 1.
+ *
+ * The delay line is allocated with the filter:
+ *
+ *   comb_lopass_type *comb = malloc(comb_lopass_size(channels));
+ *   comb_lopass_init(comb, channels);
+ */
+
+#ifndef COMB_LOPASS_H
+#define COMB_LOPASS_H
+
+#include <string.h>
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define COMB_LOPASS_MAX_DELAY 100
+
+typedef struct {
+  int channels;
+
+  unsigned long history_position;
+
+  // the control values, ramped across each block, and the feedback
+  // gain interpolated between them
+  smooth_type delay[KERNEL_MAX_CHANNELS];
+  smooth_type sharp[KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain[KERNEL_MAX_CHANNELS];
+
+  // one previous sample is kept for the low-pass filter
+  LADSPA_Data previous_sample[KERNEL_MAX_CHANNELS];
+
+  // The history array is a circular buffer used to
+  // keep track of old samples. It holds one row of
+  // samples per position, one sample per channel.
+  LADSPA_Data history[];
+} comb_lopass_type;
+
+/**
+ * How many bytes a filter takes, with its history.
+ */
+static inline unsigned long comb_lopass_size(int channels)
+{
+  return sizeof(comb_lopass_type) +
+    COMB_LOPASS_MAX_DELAY * channels * sizeof(LADSPA_Data);
+}
+
+static inline void comb_lopass_reset(comb_lopass_type *comb)
+{
+  int channel;
+
+  comb->history_position = 0;
+  memset(comb->history, 0, COMB_LOPASS_MAX_DELAY * comb->channels *
+         sizeof(LADSPA_Data));
+
+  for(channel = 0; channel < comb->channels; channel ++) {
+    comb->previous_sample[channel] = 0;
+    smooth_reset(&comb->delay[channel]);
+    smooth_reset(&comb->sharp[channel]);
+  }
+}
+
+/**
+ * Clear the state of one channel, its column of the history and all,
+ * leaving the others be.
+ */
+static inline void comb_lopass_reset_channel(comb_lopass_type *comb,
+                                             int channel)
+{
+  unsigned long position;
+
+  for(position = 0; position < COMB_LOPASS_MAX_DELAY; position ++)
+    comb->history[position * comb->channels + channel] = 0;
+
+  comb->previous_sample[channel] = 0;
+  smooth_reset(&comb->delay[channel]);
+  smooth_reset(&comb->sharp[channel]);
+}
+
+/**
+ * Set up a filter in comb_lopass_size(channels) bytes.
+ */
+static inline void comb_lopass_init(comb_lopass_type *comb, int channels)
+{
+  comb->channels = channels;
+  comb_lopass_reset(comb);
+}
+
+/**
+ * Filter sample_count frames of input into output, with each channel's
+ * controls ramped to delay_length[channel] and sharpness[channel].
+ * channels must be the number the filter was set up for.
+ */
+static inline __attribute__ ((always_inline))
+void comb_lopass_process(comb_lopass_type *comb,
+                         const LADSPA_Data *delay_length,
+                         const LADSPA_Data *sharpness,
+                         const kernel_io_type *input,
+                         const kernel_io_type *output,
+                         unsigned long sample_count, const int channels)
+{
+  LADSPA_Data tile[KERNEL_TILE * KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain[KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain_step[KERNEL_MAX_CHANNELS];
+  LADSPA_Data previous_sample[KERNEL_MAX_CHANNELS];
+  LADSPA_Data feedback_output;
+  unsigned int delay[KERNEL_MAX_CHANNELS];
+  LADSPA_Data *history = comb->history;
+  LADSPA_Data *delayed;
+  unsigned long history_position = comb->history_position;
+  unsigned long history_length = COMB_LOPASS_MAX_DELAY;
+  unsigned long segment_length, offset, position, i;
+  LADSPA_Data *row;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_start(&comb->sharp[channel], sharpness[channel], sample_count);
+    if(smooth_start(&comb->delay[channel], delay_length[channel],
+                    sample_count))
+      comb->gain[channel] = pow(comb->sharp[channel].value,
+                                (unsigned int)comb->delay[channel].value);
+    gain[channel] = comb->gain[channel];
+    previous_sample[channel] = comb->previous_sample[channel];
+  }
+
+  for(offset = 0; offset < sample_count; offset += segment_length) {
+
+    segment_length = smooth_segment(sample_count - offset);
+
+    // the delay is a whole number of samples, so it follows the ramp
+    // in steps once per segment. the feedback gain R^L is recomputed
+    // at the end of the segment and interpolated up to it.
+    for(channel = 0; channel < channels; channel ++) {
+      delay[channel] = (unsigned int)smooth_advance(&comb->delay[channel],
+                                                    segment_length);
+      gain_step[channel] =
+        (pow(smooth_advance(&comb->sharp[channel], segment_length),
+             delay[channel]) - gain[channel]) / segment_length;
+    }
+
+    kernel_load(tile, input, offset, segment_length, channels);
+
+    for(i = 0; i < segment_length; i ++) {
+      row = tile + i * channels;
+      delayed = history + history_position * channels;
+
+      for(channel = 0; channel < channels; channel ++) {
+        gain[channel] += gain_step[channel];
+        feedback_output = row[channel] * (1 - gain[channel]) +
+          gain[channel] * delayed[channel];
+        row[channel] = (feedback_output + previous_sample[channel]) / 2;
+        previous_sample[channel] = feedback_output;
+      }
+
+      // add the current output sample <delay> steps ahead in the history
+      // buffer. this is the way we maintain the delay.
+      for(channel = 0; channel < channels; channel ++) {
+        position = history_position + delay[channel];
+        if(position >= history_length)
+          position -= history_length;
+        history[position * channels + channel] = row[channel];
+      }
+
+      if(++ history_position == history_length)
+        history_position = 0;
+    }
+
+    kernel_store(output, tile, offset, segment_length, channels);
+  }
+
+  comb->history_position = history_position;
+
+  for(channel = 0; channel < channels; channel ++) {
+    comb->gain[channel] = gain[channel];
+    comb->previous_sample[channel] = previous_sample[channel];
+    smooth_end(&comb->delay[channel]);
+    smooth_end(&comb->sharp[channel]);
+  }
+}
+
+#endif
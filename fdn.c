@@ -0,0 +1,558 @@
+/*
+ * fdn.c - A feedback delay network reverb
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A reverb made of FDN_LINES delay lines whose outputs are mixed back
+ * into all of their inputs through a Hadamard matrix. Each line has a
+ * one-pole low-pass in its loop, like the averaging filter in
+ * comb_lopass.c, and a gain that makes it decay by 60 dB in the
+ * given decay time whatever its length.
+ *
+ * Filter equations, for each line i:
+ *  y_it = h_i[t - L_i]                          # line output
+ *  f_it = (1 - d) * y_it + d * f_i[t - 1]       # damping
+ *  h_it = x_t + H (g_0 f_0t, ..., g_N f_Nt)_i   # feedback
+ * where g_i = 10^(-3 L_i / (T60 * sample_rate)) and H is the
+ * Hadamard matrix scaled by 1 / sqrt(FDN_LINES), so it is
+ * orthogonal and the loop is lossless apart from the g_i.
+ *
+ * Like in freeverb.c, the shortest line is longer than a tile, so a
+ * whole tile of line outputs is copied out before it is processed and
+ * the network runs on rows of FDN_LINES samples, one line per lane.
+ * H is applied with log2(FDN_LINES) stages of in-place butterflies
+ * instead of a matrix multiply. Stereo inputs feed the even and odd
+ * lines, and the outputs are tapped from them the same way. All delay
+ * lines are stored in a single allocation.
+ *
+ * FDN_LINES can be set to 8 at compile time for a sparser, cheaper
+ * reverb.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#ifndef FDN_LINES
+#define FDN_LINES 16
+#endif
+#define FDN_TILE  SMOOTH_INTERVAL
+
+// the line lengths are in samples at 48 kHz, all prime
+#define TUNING_RATE 48000
+
+#define INPUT_GAIN .25
+#define SCALE_WET  .5
+#define SCALE_DAMP .7
+
+// added to the line inputs so that the feedback loops never decay
+// into denormals, which are very slow on most processors.
+#define ANTI_DENORMAL 1e-18
+
+// The port numbers for the plugin
+#define DECAY_CONTROL 0
+#define DAMP_CONTROL  1
+#define WET_CONTROL   2
+#define DRY_CONTROL   3
+#define INPUT_L       4
+#define OUTPUT_L      5
+
+#define INPUT_R       6
+#define OUTPUT_R      7
+
+// The range of each control, which the host may not keep to. The
+// decay time has to stay above 0 for the line gains to stay below 1.
+#define DECAY_LOWER   .1
+#define DECAY_UPPER   20
+#define UNIT_LOWER    0
+#define UNIT_UPPER    1
+
+
+static const unsigned long line_tuning[16] =
+  { 1499, 3803, 1777, 4019, 1949, 4271, 2111, 4493,
+    2311, 4733, 2539, 3581, 2707, 3347, 2917, 3119 };
+
+/**
+ * Structure to hold connections and state.
+ */
+typedef struct {
+  LADSPA_Data *decay_control_value;
+  LADSPA_Data *damp_control_value;
+  LADSPA_Data *wet_control_value;
+  LADSPA_Data *dry_control_value;
+
+  // l = mono
+  LADSPA_Data *input_buffer_l;
+  LADSPA_Data *output_buffer_l;
+
+  // stereo
+  LADSPA_Data *input_buffer_r;
+  LADSPA_Data *output_buffer_r;
+
+  // state
+  unsigned long sample_rate;
+
+  // every delay line lives in this one allocation
+  LADSPA_Data *memory;
+  unsigned long memory_size;
+
+  LADSPA_Data *history[FDN_LINES];
+  unsigned long length[FDN_LINES];
+  unsigned long position[FDN_LINES];
+  LADSPA_Data store[FDN_LINES];
+
+  // the decay time the line gains were last computed for
+  LADSPA_Data gain_decay;
+  LADSPA_Data gain[FDN_LINES];
+
+  smooth_type decay;
+  smooth_type damp;
+  smooth_type wet;
+  smooth_type dry;
+
+  // one tile of line outputs and new line inputs,
+  // with one row of lanes per sample
+  LADSPA_Data delayed[FDN_TILE][FDN_LINES] __attribute__ ((aligned (64)));
+  LADSPA_Data feedback[FDN_TILE][FDN_LINES] __attribute__ ((aligned (64)));
+} filter_type;
+
+
+/**
+ * Construct a new plugin instance.
+ */
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
+{
+  filter_type *filter = malloc(sizeof(filter_type));
+  LADSPA_Data *memory;
+  int line;
+
+  if(!filter)
+    return NULL;
+
+  filter->sample_rate = sample_rate;
+  filter->memory_size = 0;
+  for(line = 0; line < FDN_LINES; line ++) {
+    filter->length[line] = line_tuning[line] * sample_rate / TUNING_RATE;
+    filter->memory_size += filter->length[line];
+  }
+
+  // the delay lines are allocated here rather than in activate, which
+  // has no way to fail
+  memory = filter->memory = malloc(filter->memory_size *
+                                   sizeof(LADSPA_Data));
+  if(!memory) {
+    free(filter);
+    return NULL;
+  }
+  for(line = 0; line < FDN_LINES; line ++) {
+    filter->history[line] = memory;
+    memory += filter->length[line];
+  }
+
+  return filter;
+}
+
+static void activate_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  int line;
+
+  for(line = 0; line < FDN_LINES; line ++) {
+    filter->position[line] = 0;
+    filter->store[line] = 0;
+  }
+  memset(filter->memory, 0, filter->memory_size * sizeof(LADSPA_Data));
+
+  // no decay time in range, so the gains are computed on the first run
+  filter->gain_decay = 0;
+
+  smooth_reset(&filter->decay);
+  smooth_reset(&filter->damp);
+  smooth_reset(&filter->wet);
+  smooth_reset(&filter->dry);
+}
+
+/**
+ * Connect a port to a data location.
+*/
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
+{
+  filter_type *filter;
+
+  filter = (filter_type *)instance;
+  switch(port) {
+  case DECAY_CONTROL:
+    filter->decay_control_value = data_location;
+    break;
+  case DAMP_CONTROL:
+    filter->damp_control_value = data_location;
+    break;
+  case WET_CONTROL:
+    filter->wet_control_value = data_location;
+    break;
+  case DRY_CONTROL:
+    filter->dry_control_value = data_location;
+    break;
+  case INPUT_L:
+    filter->input_buffer_l = data_location;
+    break;
+  case OUTPUT_L:
+    filter->output_buffer_l = data_location;
+    break;
+  case INPUT_R:
+    filter->input_buffer_r = data_location;
+    break;
+  case OUTPUT_R:
+    filter->output_buffer_r = data_location;
+    break;
+  }
+}
+
+/**
+ * Copy the next tile_length samples of each delay line into a column
+ * of delayed, or copy a column of feedback back into them. The copy
+ * is split in two where the circular buffer wraps around.
+ */
+static inline void copy_lines(filter_type *filter, unsigned long tile_length,
+                              const int write)
+{
+  LADSPA_Data *history;
+  unsigned long position, run, i, j;
+  int line;
+
+  for(line = 0; line < FDN_LINES; line ++) {
+    history = filter->history[line];
+    position = filter->position[line];
+
+    for(i = 0; i < tile_length; i += run) {
+      run = filter->length[line] - position;
+      if(run > tile_length - i)
+        run = tile_length - i;
+
+      if(write)
+        for(j = 0; j < run; j ++)
+          history[position + j] = filter->feedback[i + j][line];
+      else
+        for(j = 0; j < run; j ++)
+          filter->delayed[i + j][line] = history[position + j];
+
+      position += run;
+      if(position == filter->length[line])
+        position = 0;
+    }
+
+    if(write)
+      filter->position[line] = position;
+  }
+}
+
+/**
+ * Compute the line gains for a decay time, if it has changed.
+ */
+static inline void get_gains(filter_type *filter, LADSPA_Data decay)
+{
+  int line;
+
+  if(decay == filter->gain_decay)
+    return;
+
+  filter->gain_decay = decay;
+  for(line = 0; line < FDN_LINES; line ++)
+    filter->gain[line] = pow(10, -3. * filter->length[line] /
+                             (decay * filter->sample_rate)) /
+      sqrt(FDN_LINES);
+}
+
+/**
+ * Multiply a row by the (unscaled) Hadamard matrix, in place.
+ */
+static inline void hadamard(LADSPA_Data *row)
+{
+  LADSPA_Data a, b;
+  int half, i, j;
+
+  for(half = 1; half < FDN_LINES; half *= 2) {
+    for(i = 0; i < FDN_LINES; i += 2 * half) {
+      for(j = i; j < i + half; j ++) {
+        a = row[j];
+        b = row[j + half];
+        row[j] = a + b;
+        row[j + half] = a - b;
+      }
+    }
+  }
+}
+
+/**
+ * Run the network over one tile, one line per lane.
+ */
+static inline void run_lines(filter_type *filter,
+                             LADSPA_Data *input_l, LADSPA_Data *input_r,
+                             unsigned long tile_length, LADSPA_Data damp)
+{
+  LADSPA_Data store[FDN_LINES];
+  LADSPA_Data row[FDN_LINES];
+  unsigned long i;
+  int line;
+
+  for(line = 0; line < FDN_LINES; line ++)
+    store[line] = filter->store[line];
+
+  for(i = 0; i < tile_length; i ++) {
+    for(line = 0; line < FDN_LINES; line ++) {
+      store[line] = filter->delayed[i][line] * (1 - damp) +
+        store[line] * damp;
+      row[line] = store[line] * filter->gain[line];
+    }
+
+    hadamard(row);
+
+    for(line = 0; line < FDN_LINES; line += 2) {
+      filter->feedback[i][line] = row[line] + input_l[i];
+      filter->feedback[i][line + 1] = row[line + 1] + input_r[i];
+    }
+  }
+
+  for(line = 0; line < FDN_LINES; line ++)
+    filter->store[line] = store[line];
+}
+
+/**
+ * This is where the action happens.
+ */
+static inline void run_filter(LADSPA_Handle instance,
+                              unsigned long sample_count, const int stereo)
+{
+  filter_type *filter = (filter_type *)instance;
+  LADSPA_Data input_l[FDN_TILE];
+  LADSPA_Data input_r[FDN_TILE];
+  LADSPA_Data wet_l, wet_r, damp, wet, dry, in_l, in_r;
+  unsigned long tile_length, offset, i;
+  int line;
+
+  smooth_start(&filter->decay, kernel_clamp(*filter->decay_control_value,
+                                             DECAY_LOWER, DECAY_UPPER),
+               sample_count);
+  smooth_start(&filter->damp, kernel_clamp(*filter->damp_control_value,
+                                            UNIT_LOWER, UNIT_UPPER),
+               sample_count);
+  smooth_start(&filter->wet, kernel_clamp(*filter->wet_control_value,
+                                          UNIT_LOWER, UNIT_UPPER),
+               sample_count);
+  smooth_start(&filter->dry, kernel_clamp(*filter->dry_control_value,
+                                          UNIT_LOWER, UNIT_UPPER),
+               sample_count);
+
+  for(offset = 0; offset < sample_count; offset += tile_length) {
+    tile_length = smooth_segment(sample_count - offset);
+
+    // the parameters move at control rate, one step per tile
+    get_gains(filter, smooth_advance(&filter->decay, tile_length));
+    damp = smooth_advance(&filter->damp, tile_length) * SCALE_DAMP;
+    wet = smooth_advance(&filter->wet, tile_length) * SCALE_WET;
+    dry = smooth_advance(&filter->dry, tile_length);
+
+    for(i = 0; i < tile_length; i ++) {
+      input_l[i] = filter->input_buffer_l[offset + i] * INPUT_GAIN +
+        ANTI_DENORMAL;
+      input_r[i] = stereo ? filter->input_buffer_r[offset + i] *
+        INPUT_GAIN + ANTI_DENORMAL : input_l[i];
+    }
+
+    copy_lines(filter, tile_length, 0);
+    run_lines(filter, input_l, input_r, tile_length, damp);
+    copy_lines(filter, tile_length, 1);
+
+    for(i = 0; i < tile_length; i ++) {
+      wet_l = 0;
+      wet_r = 0;
+      for(line = 0; line < FDN_LINES; line += 2) {
+        wet_l += filter->delayed[i][line];
+        wet_r += filter->delayed[i][line + 1];
+      }
+
+      in_l = filter->input_buffer_l[offset + i];
+      if(stereo) {
+        in_r = filter->input_buffer_r[offset + i];
+        filter->output_buffer_l[offset + i] = wet_l * wet + in_l * dry;
+        filter->output_buffer_r[offset + i] = wet_r * wet + in_r * dry;
+      }
+      else
+        filter->output_buffer_l[offset + i] = (wet_l + wet_r) * wet +
+          in_l * dry;
+    }
+  }
+
+  smooth_end(&filter->decay);
+  smooth_end(&filter->damp);
+  smooth_end(&filter->wet);
+  smooth_end(&filter->dry);
+}
+
+static void run_mono_filter(LADSPA_Handle instance,
+                            unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 0);
+}
+
+static void run_stereo_filter(LADSPA_Handle instance,
+                              unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 1);
+}
+
+static void cleanup_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+
+  free(filter->memory);
+  free(filter);
+}
+
+/**
+ * The ports of the stereo plugin. The mono plugin has the same ports
+ * without the right channel, so it uses the first PortCount entries
+ * of the same tables, apart from the names of the audio ports.
+ */
+static const LADSPA_PortDescriptor port_descriptors[] = {
+  [DECAY_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [DAMP_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [WET_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [DRY_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+  [INPUT_R] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_R] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+
+static const char *const mono_port_names[] = {
+  [DECAY_CONTROL] = "Decay time (s)",
+  [DAMP_CONTROL] = "Damping",
+  [WET_CONTROL] = "Wet level",
+  [DRY_CONTROL] = "Dry level",
+  [INPUT_L] = "Input",
+  [OUTPUT_L] = "Output"
+};
+
+static const char *const stereo_port_names[] = {
+  [DECAY_CONTROL] = "Decay time (s)",
+  [DAMP_CONTROL] = "Damping",
+  [WET_CONTROL] = "Wet level",
+  [DRY_CONTROL] = "Dry level",
+  [INPUT_L] = "Input Left",
+  [OUTPUT_L] = "Output Left",
+  [INPUT_R] = "Input Right",
+  [OUTPUT_R] = "Output Right"
+};
+
+static const LADSPA_PortRangeHint port_range_hints[] = {
+  [DECAY_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                      | LADSPA_HINT_BOUNDED_ABOVE
+                      | LADSPA_HINT_LOGARITHMIC
+                      | LADSPA_HINT_DEFAULT_MIDDLE,
+                      DECAY_LOWER, DECAY_UPPER },
+  [DAMP_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_DEFAULT_MIDDLE,
+                     UNIT_LOWER, UNIT_UPPER },
+  [WET_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                    | LADSPA_HINT_BOUNDED_ABOVE
+                    | LADSPA_HINT_DEFAULT_LOW,
+                    UNIT_LOWER, UNIT_UPPER },
+  [DRY_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                    | LADSPA_HINT_BOUNDED_ABOVE
+                    | LADSPA_HINT_DEFAULT_MIDDLE,
+                    UNIT_LOWER, UNIT_UPPER },
+  [INPUT_L] = { 0, 0, 0 },
+  [OUTPUT_L] = { 0, 0, 0 },
+  [INPUT_R] = { 0, 0, 0 },
+  [OUTPUT_R] = { 0, 0, 0 }
+};
+
+/**
+ * The descriptors the host will be using. They are constant data, so
+ * there is nothing to build when the library is loaded and nothing
+ * to free when it is unloaded.
+ */
+static const LADSPA_Descriptor mono_descriptor = {
+  .UniqueID = 0x00654335,
+  .Label = "fdn_mono",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "FDN reverb (mono)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 6,
+  .PortDescriptors = port_descriptors,
+  .PortNames = mono_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_mono_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+static const LADSPA_Descriptor stereo_descriptor = {
+  .UniqueID = 0x00654336,
+  .Label = "fdn_stereo",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "FDN reverb (stereo)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 8,
+  .PortDescriptors = port_descriptors,
+  .PortNames = stereo_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_stereo_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+/* Return a descriptor of the requested plugin type. There are two
+   plugin types available in this library (mono and stereo). */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  switch (index) {
+  case 0:
+    return &mono_descriptor;
+  case 1:
+    return &stereo_descriptor;
+  default:
+    return NULL;
+  }
+}
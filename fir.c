@@ -19,423 +19,182 @@
 
 /**
  * This simple FIR filter adds dips in the frequency response at odd
- * multiples of some initial frequency. It comes with both a mono
- * and a stereo version. In the stereo version you can have separate
- * configurations for the two channels.
+ * multiples of some initial frequency. It comes in versions for 1, 2,
+ * 4, 8 and 16 channels, and every channel has its own configuration.
  */
 
 #include <stdlib.h>
-#include <string.h>
+#include <stddef.h>
 
 #include "ladspa.h"
-
-#define MIN_FREQ 1
-
-// The port numbers for the plugin
-#define FREQ_CONTROL_L 0
-#define WET_CONTROL_L  1
-#define INPUT_L        2
-#define OUTPUT_L       3
-
-#define FREQ_CONTROL_R 4
-#define WET_CONTROL_R  5
-#define INPUT_R        6
-#define OUTPUT_R       7
-
-LADSPA_Descriptor *mono_descriptor = NULL;
-LADSPA_Descriptor *stereo_descriptor = NULL;
+#include "channels.h"
+#include "state.h"
+#include "fir.h"
+
+// The port numbers for each channel of the plugin
+#define FREQ_CONTROL      0
+#define WET_CONTROL       1
+#define INPUT             2
+#define OUTPUT            3
+#define PORTS_PER_CHANNEL 4
+
+// The range of each control, which the host may not keep to
+#define FREQ_LOWER        20
+#define FREQ_UPPER        20000
+#define WET_LOWER         0
+#define WET_UPPER         1
+
+// The ports of each channel, as PORT(name, port descriptor, hint
+// descriptor, lower bound, upper bound)
+#define CHANNEL_PORTS(PORT, suffix)                                         \
+  PORT("First frequency" suffix, LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,   \
+       LADSPA_HINT_BOUNDED_BELOW                                            \
+       | LADSPA_HINT_BOUNDED_ABOVE                                          \
+       | LADSPA_HINT_LOGARITHMIC                                            \
+       | LADSPA_HINT_INTEGER                                                \
+       | LADSPA_HINT_DEFAULT_LOW, FREQ_LOWER, FREQ_UPPER)                   \
+  PORT("Dry/Wet" suffix, LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,           \
+       LADSPA_HINT_BOUNDED_BELOW                                            \
+       | LADSPA_HINT_BOUNDED_ABOVE                                          \
+       | LADSPA_HINT_DEFAULT_0, WET_LOWER, WET_UPPER)                       \
+  PORT("Input" suffix, LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO, 0, 0, 0)      \
+  PORT("Output" suffix, LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO, 0, 0, 0)
 
 /**
  * Structure to hold connections and state.
  */
 typedef struct {
-  LADSPA_Data *freq_control_value_l;
-  LADSPA_Data *wet_control_value_l;
-  LADSPA_Data *freq_control_value_r;
-  LADSPA_Data *wet_control_value_r;
-
-  // l = mono
-  LADSPA_Data *input_buffer_l;
-  LADSPA_Data *output_buffer_l;
+  LADSPA_Data *freq_control_value[MAX_CHANNELS];
+  LADSPA_Data *wet_control_value[MAX_CHANNELS];
+  LADSPA_Data *input_buffer[MAX_CHANNELS];
+  LADSPA_Data *output_buffer[MAX_CHANNELS];
 
-  // stereo
-  LADSPA_Data *input_buffer_r;
-  LADSPA_Data *output_buffer_r;
+  // the variant of the run function picked for this machine
+  tune_run_type kernel;
 
-  // state
-  unsigned long sample_rate;
+  // how much memory the instance takes, with its history
+  unsigned long instance_size;
 
-  // The history array is a circular buffer used to
-  // keep track of old samples.
-  LADSPA_Data *history_l;
-  LADSPA_Data *history_r;
-  unsigned long history_position;
-  unsigned long history_length;
+  // everything from here on is the state a snapshot holds (see
+  // state.h)
+  fir_type fir;
 } filter_type;
 
-
-inline unsigned long get_sample_shift(float freq, unsigned long sample_rate)
-{
-  return (unsigned long)((1 / (2 * freq)) * sample_rate);
-}
+STATE_INTERFACE(fir);
 
 /**
  * Construct a new plugin instance.
  */
-LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
-                                 unsigned long sample_rate)
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
 {
-  filter_type *filter = malloc(sizeof(filter_type));
-  filter->sample_rate = sample_rate;
+  int channels = channels_of(descriptor, PORTS_PER_CHANNEL);
+  unsigned long instance_size = offsetof(filter_type, fir) +
+    fir_size(sample_rate, channels);
+  filter_type *filter = malloc(instance_size);
 
-  return filter;
-}
+  fir_init(&filter->fir, sample_rate, channels);
+  filter->kernel = tune_kernel(descriptor, sample_rate);
+  filter->instance_size = instance_size;
 
-void activate_filter(LADSPA_Handle instance, int stereo)
-{
-  filter_type *filter = (filter_type *)instance;
-  filter->history_position = 0;
-  filter->history_length = get_sample_shift(MIN_FREQ, filter->sample_rate);
-  filter->history_l = calloc(filter->history_length,
-                             sizeof(LADSPA_Descriptor));
-  if(stereo)
-    filter->history_r = calloc(filter->history_length,
-                               sizeof(LADSPA_Descriptor));
-  else
-    filter->history_r = NULL;
-}
-
-void activate_mono_filter(LADSPA_Handle instance)
-{
-  activate_filter(instance, 0);
+  return filter;
 }
 
-void activate_stereo_filter(LADSPA_Handle instance)
+static void activate_filter(LADSPA_Handle instance)
 {
-  activate_filter(instance, 1);
+  fir_reset(&((filter_type *)instance)->fir);
 }
 
 /**
  * Connect a port to a data location. 
 */
-void connect_port_to_filter(LADSPA_Handle instance,
-                            unsigned long port,
-                            LADSPA_Data *data_location)
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
 {
   filter_type *filter;
+  int channel = port / PORTS_PER_CHANNEL;
 
   filter = (filter_type *)instance;
-  switch(port) {
-  case FREQ_CONTROL_L:
-    filter->freq_control_value_l = data_location;
-    break;
-  case WET_CONTROL_L:
-    filter->wet_control_value_l = data_location;
-    break;
-  case FREQ_CONTROL_R:
-    filter->freq_control_value_r = data_location;
-    break;
-  case WET_CONTROL_R:
-    filter->wet_control_value_r = data_location;
+  switch(port % PORTS_PER_CHANNEL) {
+  case FREQ_CONTROL:
+    filter->freq_control_value[channel] = data_location;
     break;
-  case INPUT_L:
-    filter->input_buffer_l = data_location;
+  case WET_CONTROL:
+    filter->wet_control_value[channel] = data_location;
     break;
-  case OUTPUT_L:
-    filter->output_buffer_l = data_location;
+  case INPUT:
+    filter->input_buffer[channel] = data_location;
     break;
-  case INPUT_R:
-    filter->input_buffer_r = data_location;
-    break;
-  case OUTPUT_R:
-    filter->output_buffer_r = data_location;
+  case OUTPUT:
+    filter->output_buffer[channel] = data_location;
     break;
   }
 }
 
 /**
- * This is where the action happens.
+ * Run the kernel with the control values the host has set.
  */
-inline void run_filter(LADSPA_Handle instance, unsigned long sample_count,
-                       int stereo)
+static inline __attribute__ ((always_inline))
+void run_filter(LADSPA_Handle instance, unsigned long sample_count,
+                const int channels)
 {
-  LADSPA_Data *input_l;
-  LADSPA_Data *input_r = NULL;
-  LADSPA_Data *output_l;
-  LADSPA_Data *output_r = NULL;
-  filter_type *filter;
-  unsigned long sample_shift_l;
-  unsigned long sample_shift_r = 0;
-
-  filter = (filter_type *)instance;
-  input_l = filter->input_buffer_l;
-  output_l = filter->output_buffer_l;
-
-  if(stereo) {
-    input_r = filter->input_buffer_r;
-    output_r = filter->output_buffer_r;
-  }
-
-  // get the current sample shift as a function of the frequency
-  // control value set by the user.
-  sample_shift_l = get_sample_shift(*filter->freq_control_value_l,
-                                    filter->sample_rate);
-  if(stereo)
-    sample_shift_r = get_sample_shift(*filter->freq_control_value_r,
-                                      filter->sample_rate);
-
-  while(sample_count -- > 0) {
-
-    // add the current sample <sample_shift> steps ahead in the history
-    // buffer. this is the way we maintain the delay.
-    *(filter->history_l + ((sample_shift_l + filter->history_position) %
-                           filter->history_length)) = *input_l;
-
-    if(stereo)
-      *(filter->history_r + ((sample_shift_r + filter->history_position) %
-         filter->history_length)) = *input_r;
-    
-    *output_l = *input_l * (1 - *filter->wet_control_value_l / 2) +
-      *(filter->history_l + filter->history_position) *
-      *filter->wet_control_value_l / 2;
-
-    if(stereo)
-      *output_r = *input_r * (1 - *filter->wet_control_value_r / 2) +
-        *(filter->history_r + filter->history_position) *
-        *filter->wet_control_value_r / 2;
-
-    filter->history_position = (filter->history_position + 1) %
-      filter->history_length;
-
-    input_l ++;
-    output_l ++;
-
-    if(stereo) {
-      input_r ++;
-      output_r ++;
-    }
+  filter_type *filter = (filter_type *)instance;
+  kernel_io_type input, output;
+  LADSPA_Data freq[MAX_CHANNELS];
+  LADSPA_Data wet[MAX_CHANNELS];
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++) {
+    freq[channel] = kernel_clamp(*filter->freq_control_value[channel],
+                                 FREQ_LOWER, FREQ_UPPER);
+    wet[channel] = kernel_clamp(*filter->wet_control_value[channel],
+                                WET_LOWER, WET_UPPER);
   }
-}
-
-void run_mono_filter(LADSPA_Handle instance, unsigned long sample_count)
-{
-  run_filter(instance, sample_count, 0);
-}
 
-void run_stereo_filter(LADSPA_Handle instance, unsigned long sample_count)
-{
-  run_filter(instance, sample_count, 1);
+  kernel_planar(&input, filter->input_buffer);
+  kernel_planar(&output, filter->output_buffer);
+  fir_process(&filter->fir, freq, wet, &input, &output, sample_count,
+              channels);
 }
 
-void deactivate_filter(LADSPA_Handle instance)
-{
-  filter_type *filter = (filter_type *)instance;
-  free(filter->history_l);
-  if(filter->history_r)
-    free(filter->history_r);
-}
+CHANNEL_RUN_FIXED_BLOCK_FUNCTIONS(run_filter);
 
-void cleanup_filter(LADSPA_Handle instance)
+static void cleanup_filter(LADSPA_Handle instance)
 {
   free(instance);
 }
 
 /**
- * The constructor function is called automatically
- * when the plugin library is first loaded.
- * This is where we build the descriptors that the host
- * will be using.
+ * The descriptors the host will be using, one per channel layout.
+ * They are constant data, so there is nothing to build when the
+ * library is loaded and nothing to free when it is unloaded.
  */
-void __attribute__ ((constructor)) init(void)
-{
-  char **port_names;
-  LADSPA_PortDescriptor *port_descriptors;
-  LADSPA_PortRangeHint *port_range_hints;
-
-  mono_descriptor = (LADSPA_Descriptor *)malloc(sizeof(LADSPA_Descriptor));
-  stereo_descriptor = (LADSPA_Descriptor *)malloc(sizeof(LADSPA_Descriptor));
-
-  if(mono_descriptor) {
-    mono_descriptor->UniqueID = 0x00654321;
-    mono_descriptor->Label = strdup("fir_mono");
-    mono_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
-    mono_descriptor->Name = strdup("One-term FIR filter (mono)");
-    mono_descriptor->Maker = strdup("Andreas Jansson");
-    mono_descriptor->Copyright = strdup("GPL-3.0");
-    mono_descriptor->PortCount = 4;
-
-    port_descriptors
-      = (LADSPA_PortDescriptor *)calloc(4, sizeof(LADSPA_PortDescriptor));
-    mono_descriptor->PortDescriptors
-      = (const LADSPA_PortDescriptor *)port_descriptors;
-    port_descriptors[WET_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[FREQ_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-
-    port_names = (char **)calloc(4, sizeof(char *));
-    mono_descriptor->PortNames = (const char **)port_names;
-    port_names[WET_CONTROL_L] = strdup("Dry/Wet");
-    port_names[FREQ_CONTROL_L] = strdup("First frequency");
-    port_names[INPUT_L] = strdup("Input");
-    port_names[OUTPUT_L] = strdup("Output");
-
-    port_range_hints =
-      ((LADSPA_PortRangeHint *)calloc(4, sizeof(LADSPA_PortRangeHint)));
-    mono_descriptor->PortRangeHints =
-      (const LADSPA_PortRangeHint *)port_range_hints;
-    port_range_hints[WET_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[WET_CONTROL_L].LowerBound = 0;
-    port_range_hints[WET_CONTROL_L].UpperBound = 1;
-    port_range_hints[FREQ_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_LOGARITHMIC
-       | LADSPA_HINT_INTEGER
-       | LADSPA_HINT_DEFAULT_LOW);
-    port_range_hints[FREQ_CONTROL_L].LowerBound = 20;
-    port_range_hints[FREQ_CONTROL_L].UpperBound = 20000;
-    port_range_hints[INPUT_L].HintDescriptor = 0;
-    port_range_hints[OUTPUT_L].HintDescriptor = 0;
-
-    mono_descriptor->instantiate = instantiate_filter;
-    mono_descriptor->connect_port = connect_port_to_filter;
-    mono_descriptor->activate = activate_mono_filter;
-    mono_descriptor->run = run_mono_filter;
-    mono_descriptor->run_adding = NULL;
-    mono_descriptor->set_run_adding_gain = NULL;
-    mono_descriptor->deactivate = deactivate_filter;
-    mono_descriptor->cleanup = cleanup_filter;
-  }
-
-  if(stereo_descriptor) {
-    stereo_descriptor->UniqueID = 0x00654322;
-    stereo_descriptor->Label = strdup("fir_stereo");
-    stereo_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
-    stereo_descriptor->Name = strdup("One-term FIR filter (stereo)");
-    stereo_descriptor->Maker = strdup("Andreas Jansson");
-    stereo_descriptor->Copyright = strdup("GPL-3.0");
-    stereo_descriptor->PortCount = 8;
-
-    port_descriptors
-      = (LADSPA_PortDescriptor *)calloc(8, sizeof(LADSPA_PortDescriptor));
-    stereo_descriptor->PortDescriptors
-      = (const LADSPA_PortDescriptor *)port_descriptors;
-    port_descriptors[WET_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[FREQ_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[WET_CONTROL_R] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[FREQ_CONTROL_R] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[INPUT_R] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_R] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-
-    port_names = (char **)calloc(8, sizeof(char *));
-    stereo_descriptor->PortNames = (const char **)port_names;
-    port_names[WET_CONTROL_L] = strdup("Dry/Wet Left");
-    port_names[FREQ_CONTROL_L] = strdup("First frequency Left");
-    port_names[WET_CONTROL_R] = strdup("Dry/Wet Right");
-    port_names[FREQ_CONTROL_R] = strdup("First frequency Right");
-    port_names[INPUT_L] = strdup("Input Left");
-    port_names[OUTPUT_L] = strdup("Output Left");
-    port_names[INPUT_R] = strdup("Input Right");
-    port_names[OUTPUT_R] = strdup("Output Right");
-
-    port_range_hints =
-      ((LADSPA_PortRangeHint *)calloc(8, sizeof(LADSPA_PortRangeHint)));
-    stereo_descriptor->PortRangeHints =
-      (const LADSPA_PortRangeHint *)port_range_hints;
-    port_range_hints[WET_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[WET_CONTROL_L].LowerBound = 0;
-    port_range_hints[WET_CONTROL_L].UpperBound = 1;
-    port_range_hints[FREQ_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_LOGARITHMIC
-       | LADSPA_HINT_INTEGER
-       | LADSPA_HINT_DEFAULT_LOW);
-    port_range_hints[FREQ_CONTROL_L].LowerBound = 20;
-    port_range_hints[FREQ_CONTROL_L].UpperBound = 20000;
-    port_range_hints[WET_CONTROL_R].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[WET_CONTROL_R].LowerBound = 0;
-    port_range_hints[WET_CONTROL_R].UpperBound = 1;
-    port_range_hints[FREQ_CONTROL_R].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_LOGARITHMIC
-       | LADSPA_HINT_INTEGER
-       | LADSPA_HINT_DEFAULT_LOW);
-    port_range_hints[FREQ_CONTROL_R].LowerBound = 20;
-    port_range_hints[FREQ_CONTROL_R].UpperBound = 20000;
-    port_range_hints[INPUT_L].HintDescriptor = 0;
-    port_range_hints[OUTPUT_L].HintDescriptor = 0;
-    port_range_hints[INPUT_R].HintDescriptor = 0;
-    port_range_hints[OUTPUT_R].HintDescriptor = 0;
-
-    stereo_descriptor->instantiate = instantiate_filter;
-    stereo_descriptor->connect_port = connect_port_to_filter;
-    stereo_descriptor->activate = activate_stereo_filter;
-    stereo_descriptor->run = run_stereo_filter;
-    stereo_descriptor->run_adding = NULL;
-    stereo_descriptor->set_run_adding_gain = NULL;
-    stereo_descriptor->deactivate = deactivate_filter;
-    stereo_descriptor->cleanup = cleanup_filter;
-  }
-
-}
-
-void delete_descriptor(LADSPA_Descriptor *descriptor)
+CHANNEL_DESCRIPTORS("fir", "One-term FIR filter", NULL,
+                    0x00654321, 0x00654322, 0x00654337, 0x00654338,
+                    0x00654339);
+
+/* Return a descriptor of the requested plugin type. There is one
+   plugin type per channel layout in this library (mono, stereo, 4, 8
+   and 16 channels). */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
 {
-  unsigned long i;
-  if(descriptor) {
-    free((char *)descriptor->Label);
-    free((char *)descriptor->Name);
-    free((char *)descriptor->Maker);
-    free((char *)descriptor->Copyright);
-    free((LADSPA_PortDescriptor *)descriptor->PortDescriptors);
-
-    for(i = 0; i < descriptor->PortCount; i ++)
-      free((char *)(descriptor->PortNames[i]));
-
-    free((char **)descriptor->PortNames);
-    free((LADSPA_PortRangeHint *)descriptor->PortRangeHints);
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  if(index < CHANNEL_LAYOUTS)
+    return descriptors[index];
 
-    free(descriptor);
-  }
+  return NULL;
 }
 
-/**
- * The destructor function is called automatically when
- * the library is unloaded.
- */
-void __attribute__ ((destructor)) fini(void)
+/* Return the state interface of one of this library's descriptors, or
+   null if it is some other library's. */
+__attribute__ ((visibility ("default")))
+const state_interface_type *ladspa_state(const LADSPA_Descriptor *descriptor)
 {
-  delete_descriptor(mono_descriptor);
-  delete_descriptor(stereo_descriptor);
-}
+  if(descriptor->instantiate == instantiate_filter)
+    return &state_interface;
 
-/* Return a descriptor of the requested plugin type. There are two
-   plugin types available in this library (mono and stereo). */
-const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
-{
-  /* Return the requested descriptor or null if the index is out of
-     range. */
-  switch (index) {
-  case 0:
-    return mono_descriptor;
-  case 1:
-    return stereo_descriptor;
-  default:
-    return NULL;
-  }
+  return NULL;
 }
-
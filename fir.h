@@ -0,0 +1,200 @@
+/*
+ * fir.h - The kernel of the one-term FIR filter
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filter of fir.c, without LADSPA (see kernel.h). It mixes the
+ * input with itself delayed by half a period of a frequency, which
+ * puts dips at odd multiples of that frequency. Each channel has the
+ * frequency, from FIR_MIN_FREQ up, and how much of the delayed signal
+ * to mix in, from 0 to 1.
+ *
+ * The delay line is as long as the lowest frequency needs, and is
+ * allocated with the filter:
+ *
+ *   fir_type *fir = malloc(fir_size(sample_rate, channels));
+ *   fir_init(fir, sample_rate, channels);
+ */
+
+#ifndef FIR_H
+#define FIR_H
+
+#include <string.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define FIR_MIN_FREQ 1
+
+typedef struct {
+  unsigned long sample_rate;
+  int channels;
+
+  // how many rows the history has
+  unsigned long history_length;
+
+  unsigned long history_position;
+
+  // the control values, ramped across each block
+  smooth_type freq[KERNEL_MAX_CHANNELS];
+  smooth_type wet[KERNEL_MAX_CHANNELS];
+
+  // The history array is a circular buffer used to
+  // keep track of old samples. It holds one row of
+  // samples per position, one sample per channel.
+  LADSPA_Data history[];
+} fir_type;
+
+static inline unsigned long fir_sample_shift(float freq,
+                                             unsigned long sample_rate)
+{
+  return (unsigned long)((1 / (2 * freq)) * sample_rate);
+}
+
+/**
+ * How many bytes a filter takes, with its history.
+ */
+static inline unsigned long fir_size(unsigned long sample_rate,
+                                     int channels)
+{
+  return sizeof(fir_type) + fir_sample_shift(FIR_MIN_FREQ, sample_rate) *
+    channels * sizeof(LADSPA_Data);
+}
+
+static inline void fir_reset(fir_type *fir)
+{
+  int channel;
+
+  fir->history_position = 0;
+  memset(fir->history, 0, fir->history_length * fir->channels *
+         sizeof(LADSPA_Data));
+
+  for(channel = 0; channel < fir->channels; channel ++) {
+    smooth_reset(&fir->freq[channel]);
+    smooth_reset(&fir->wet[channel]);
+  }
+}
+
+/**
+ * Clear the state of one channel, its column of the history and all,
+ * leaving the others be.
+ */
+static inline void fir_reset_channel(fir_type *fir, int channel)
+{
+  unsigned long position;
+
+  for(position = 0; position < fir->history_length; position ++)
+    fir->history[position * fir->channels + channel] = 0;
+
+  smooth_reset(&fir->freq[channel]);
+  smooth_reset(&fir->wet[channel]);
+}
+
+/**
+ * Set up a filter in fir_size(sample_rate, channels) bytes.
+ */
+static inline void fir_init(fir_type *fir, unsigned long sample_rate,
+                            int channels)
+{
+  fir->sample_rate = sample_rate;
+  fir->channels = channels;
+  fir->history_length = fir_sample_shift(FIR_MIN_FREQ, sample_rate);
+  fir_reset(fir);
+}
+
+/**
+ * Filter sample_count frames of input into output, with each channel's
+ * controls ramped to frequency[channel] and dry_wet[channel]. channels
+ * must be the number the filter was set up for.
+ */
+static inline __attribute__ ((always_inline))
+void fir_process(fir_type *fir, const LADSPA_Data *frequency,
+                 const LADSPA_Data *dry_wet, const kernel_io_type *input,
+                 const kernel_io_type *output, unsigned long sample_count,
+                 const int channels)
+{
+  LADSPA_Data tile[KERNEL_TILE * KERNEL_MAX_CHANNELS];
+  LADSPA_Data wet[KERNEL_MAX_CHANNELS];
+  LADSPA_Data wet_step[KERNEL_MAX_CHANNELS];
+  unsigned long sample_shift[KERNEL_MAX_CHANNELS];
+  LADSPA_Data *history = fir->history;
+  unsigned long history_position = fir->history_position;
+  unsigned long history_length = fir->history_length;
+  unsigned long segment_length, offset, position, i;
+  LADSPA_Data *row;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_start(&fir->freq[channel], frequency[channel], sample_count);
+    smooth_start(&fir->wet[channel], dry_wet[channel], sample_count);
+    wet[channel] = fir->wet[channel].value;
+    wet_step[channel] = fir->wet[channel].step;
+  }
+
+  for(offset = 0; offset < sample_count; offset += segment_length) {
+
+    segment_length = smooth_segment(sample_count - offset);
+
+    // get the current sample shift as a function of the ramped
+    // frequency. it is only recomputed once per segment, and since
+    // it's a whole number of samples there is nothing to interpolate.
+    for(channel = 0; channel < channels; channel ++)
+      sample_shift[channel] =
+        fir_sample_shift(smooth_advance(&fir->freq[channel],
+                                        segment_length),
+                         fir->sample_rate);
+
+    kernel_load(tile, input, offset, segment_length, channels);
+
+    for(i = 0; i < segment_length; i ++) {
+      row = tile + i * channels;
+
+      // add the current sample <sample_shift> steps ahead in the history
+      // buffer. this is the way we maintain the delay.
+      for(channel = 0; channel < channels; channel ++) {
+        position = history_position + sample_shift[channel];
+        if(position >= history_length)
+          position -= history_length;
+        history[position * channels + channel] = row[channel];
+      }
+
+      // the wet amount is cheap to apply, so it follows the ramp
+      // sample by sample.
+      for(channel = 0; channel < channels; channel ++) {
+        wet[channel] += wet_step[channel];
+        row[channel] = row[channel] * (1 - wet[channel] / 2) +
+          history[history_position * channels + channel] * wet[channel] / 2;
+      }
+
+      if(++ history_position == history_length)
+        history_position = 0;
+    }
+
+    kernel_store(output, tile, offset, segment_length, channels);
+  }
+
+  fir->history_position = history_position;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_end(&fir->freq[channel]);
+    smooth_end(&fir->wet[channel]);
+  }
+}
+
+#endif
@@ -0,0 +1,596 @@
+/*
+ * freeverb.c - A Schroeder reverb in the style of Freeverb
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A reverb made of COMB_COUNT damped feedback comb filters (like the
+ * one in comb_lopass.c, but with a one-pole low-pass in the loop) in
+ * parallel, followed by ALLPASS_COUNT allpass filters in series, per
+ * channel. The delay lengths are the ones from Jezar's Freeverb, with
+ * the right channel's combs and allpasses STEREO_SPREAD samples longer.
+ *
+ * Filter equations, for each comb:
+ *  y_t = h_[t - L]                     # comb output
+ *  f_t = (1 - d) * y_t + d * f_[t - 1] # damping
+ *  h_t = x_t + R * f_t                 # feedback
+ * and for each allpass:
+ *  b_t = x_t + g * b_[t - L]
+ *  y_t = b_[t - L] - x_t
+ *
+ * All combs of all channels are processed together, one comb per
+ * lane. Since the shortest comb is longer than a tile, the delayed
+ * samples for a whole tile can be copied out of the delay lines
+ * before the tile is processed, so the feedback loop runs on
+ * contiguous rows of REVERB_LANES samples. All delay lines are stored
+ * in a single allocation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define COMB_COUNT    8
+#define ALLPASS_COUNT 4
+#define STEREO_SPREAD 23
+#define REVERB_LANES  (2 * COMB_COUNT)
+#define REVERB_TILE   SMOOTH_INTERVAL
+
+// the tunings are in samples at 44.1 kHz
+#define TUNING_RATE 44100
+
+#define FIXED_GAIN       .015
+#define SCALE_WET        3
+#define SCALE_DRY        2
+#define SCALE_DAMP       .4
+#define SCALE_ROOM       .28
+#define OFFSET_ROOM      .7
+#define ALLPASS_FEEDBACK .5
+
+// added to the comb input so that the feedback loops never decay
+// into denormals, which are very slow on most processors.
+#define ANTI_DENORMAL 1e-18
+
+// The port numbers for the plugin
+#define ROOM_CONTROL  0
+#define DAMP_CONTROL  1
+#define WET_CONTROL   2
+#define DRY_CONTROL   3
+#define INPUT_L       4
+#define OUTPUT_L      5
+
+#define WIDTH_CONTROL 6
+#define INPUT_R       7
+#define OUTPUT_R      8
+
+// The range of every control, which the host may not keep to. A room
+// size much above 1 would make the combs' feedback 1 or more.
+#define CONTROL_LOWER 0
+#define CONTROL_UPPER 1
+
+
+static const unsigned long comb_tuning[COMB_COUNT] =
+  { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 };
+static const unsigned long allpass_tuning[ALLPASS_COUNT] =
+  { 556, 441, 341, 225 };
+
+/**
+ * Structure to hold connections and state.
+ */
+typedef struct {
+  LADSPA_Data *room_control_value;
+  LADSPA_Data *damp_control_value;
+  LADSPA_Data *wet_control_value;
+  LADSPA_Data *dry_control_value;
+  LADSPA_Data *width_control_value;
+
+  // l = mono
+  LADSPA_Data *input_buffer_l;
+  LADSPA_Data *output_buffer_l;
+
+  // stereo
+  LADSPA_Data *input_buffer_r;
+  LADSPA_Data *output_buffer_r;
+
+  // state
+  unsigned long sample_rate;
+  int channels;
+
+  // every delay line lives in this one allocation
+  LADSPA_Data *memory;
+  unsigned long memory_size;
+
+  // the combs, left channel first
+  LADSPA_Data *comb_history[REVERB_LANES];
+  unsigned long comb_length[REVERB_LANES];
+  unsigned long comb_position[REVERB_LANES];
+  LADSPA_Data comb_store[REVERB_LANES];
+
+  LADSPA_Data *allpass_history[2][ALLPASS_COUNT];
+  unsigned long allpass_length[2][ALLPASS_COUNT];
+  unsigned long allpass_position[2][ALLPASS_COUNT];
+
+  smooth_type room;
+  smooth_type damp;
+  smooth_type wet;
+  smooth_type dry;
+  smooth_type width;
+
+  // one tile of delayed comb outputs and new comb inputs,
+  // with one row of lanes per sample
+  LADSPA_Data delayed[REVERB_TILE][REVERB_LANES]
+    __attribute__ ((aligned (64)));
+  LADSPA_Data feedback[REVERB_TILE][REVERB_LANES]
+    __attribute__ ((aligned (64)));
+} filter_type;
+
+
+/**
+ * Construct a new plugin instance.
+ */
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
+{
+  filter_type *filter = malloc(sizeof(filter_type));
+  LADSPA_Data *memory;
+  int channel, i, lane;
+
+  if(!filter)
+    return NULL;
+
+  // the stereo plugin is the one with a width control
+  filter->channels = descriptor->PortCount > WIDTH_CONTROL ? 2 : 1;
+  filter->sample_rate = sample_rate;
+  filter->memory_size = 0;
+
+  for(channel = 0; channel < filter->channels; channel ++) {
+    for(i = 0; i < COMB_COUNT; i ++) {
+      lane = channel * COMB_COUNT + i;
+      filter->comb_length[lane] = (comb_tuning[i] + channel * STEREO_SPREAD) *
+        sample_rate / TUNING_RATE;
+      filter->memory_size += filter->comb_length[lane];
+    }
+    for(i = 0; i < ALLPASS_COUNT; i ++) {
+      filter->allpass_length[channel][i] =
+        (allpass_tuning[i] + channel * STEREO_SPREAD) *
+        sample_rate / TUNING_RATE;
+      filter->memory_size += filter->allpass_length[channel][i];
+    }
+  }
+
+  // the delay lines are allocated here rather than in activate, which
+  // has no way to fail
+  memory = filter->memory = malloc(filter->memory_size *
+                                   sizeof(LADSPA_Data));
+  if(!memory) {
+    free(filter);
+    return NULL;
+  }
+  for(channel = 0; channel < filter->channels; channel ++) {
+    for(i = 0; i < COMB_COUNT; i ++) {
+      lane = channel * COMB_COUNT + i;
+      filter->comb_history[lane] = memory;
+      memory += filter->comb_length[lane];
+    }
+    for(i = 0; i < ALLPASS_COUNT; i ++) {
+      filter->allpass_history[channel][i] = memory;
+      memory += filter->allpass_length[channel][i];
+    }
+  }
+
+  return filter;
+}
+
+static void activate_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  int channel, i, lane;
+
+  for(channel = 0; channel < filter->channels; channel ++) {
+    for(i = 0; i < COMB_COUNT; i ++) {
+      lane = channel * COMB_COUNT + i;
+      filter->comb_position[lane] = 0;
+      filter->comb_store[lane] = 0;
+    }
+    for(i = 0; i < ALLPASS_COUNT; i ++)
+      filter->allpass_position[channel][i] = 0;
+  }
+  memset(filter->memory, 0, filter->memory_size * sizeof(LADSPA_Data));
+
+  smooth_reset(&filter->room);
+  smooth_reset(&filter->damp);
+  smooth_reset(&filter->wet);
+  smooth_reset(&filter->dry);
+  smooth_reset(&filter->width);
+}
+
+/**
+ * Connect a port to a data location.
+*/
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
+{
+  filter_type *filter;
+
+  filter = (filter_type *)instance;
+  switch(port) {
+  case ROOM_CONTROL:
+    filter->room_control_value = data_location;
+    break;
+  case DAMP_CONTROL:
+    filter->damp_control_value = data_location;
+    break;
+  case WET_CONTROL:
+    filter->wet_control_value = data_location;
+    break;
+  case DRY_CONTROL:
+    filter->dry_control_value = data_location;
+    break;
+  case WIDTH_CONTROL:
+    filter->width_control_value = data_location;
+    break;
+  case INPUT_L:
+    filter->input_buffer_l = data_location;
+    break;
+  case OUTPUT_L:
+    filter->output_buffer_l = data_location;
+    break;
+  case INPUT_R:
+    filter->input_buffer_r = data_location;
+    break;
+  case OUTPUT_R:
+    filter->output_buffer_r = data_location;
+    break;
+  }
+}
+
+/**
+ * Copy the next tile_length samples of each comb's delay line into a
+ * column of delayed, or copy a column of feedback back into them.
+ */
+static inline void copy_combs(filter_type *filter, unsigned long tile_length,
+                              int lanes, int write)
+{
+  LADSPA_Data *history;
+  unsigned long position, length, i;
+  int lane;
+
+  for(lane = 0; lane < lanes; lane ++) {
+    history = filter->comb_history[lane];
+    position = filter->comb_position[lane];
+    length = filter->comb_length[lane];
+
+    for(i = 0; i < tile_length; i ++) {
+      if(write)
+        history[position] = filter->feedback[i][lane];
+      else
+        filter->delayed[i][lane] = history[position];
+      if(++ position == length)
+        position = 0;
+    }
+
+    if(write)
+      filter->comb_position[lane] = position;
+  }
+}
+
+/**
+ * Run the feedback loops of all combs over one tile, one comb per lane.
+ */
+static inline void run_combs(filter_type *filter, LADSPA_Data *input,
+                             unsigned long tile_length, const int lanes,
+                             LADSPA_Data feedback, LADSPA_Data damp)
+{
+  LADSPA_Data store[REVERB_LANES];
+  unsigned long i;
+  int lane;
+
+  for(lane = 0; lane < lanes; lane ++)
+    store[lane] = filter->comb_store[lane];
+
+  for(i = 0; i < tile_length; i ++) {
+    for(lane = 0; lane < lanes; lane ++) {
+      store[lane] = filter->delayed[i][lane] * (1 - damp) +
+        store[lane] * damp;
+      filter->feedback[i][lane] = input[i] + store[lane] * feedback;
+    }
+  }
+
+  for(lane = 0; lane < lanes; lane ++)
+    filter->comb_store[lane] = store[lane];
+}
+
+/**
+ * Sum one channel's comb outputs and run them through its allpasses.
+ */
+static inline void run_allpasses(filter_type *filter, int channel,
+                                 unsigned long tile_length,
+                                 LADSPA_Data *output)
+{
+  LADSPA_Data *history;
+  LADSPA_Data delayed, sum;
+  unsigned long position, length, i;
+  int comb, allpass;
+
+  for(i = 0; i < tile_length; i ++) {
+    sum = 0;
+    for(comb = 0; comb < COMB_COUNT; comb ++)
+      sum += filter->delayed[i][channel * COMB_COUNT + comb];
+    output[i] = sum;
+  }
+
+  for(allpass = 0; allpass < ALLPASS_COUNT; allpass ++) {
+    history = filter->allpass_history[channel][allpass];
+    position = filter->allpass_position[channel][allpass];
+    length = filter->allpass_length[channel][allpass];
+
+    for(i = 0; i < tile_length; i ++) {
+      delayed = history[position];
+      history[position] = output[i] + delayed * ALLPASS_FEEDBACK;
+      output[i] = delayed - output[i];
+      if(++ position == length)
+        position = 0;
+    }
+
+    filter->allpass_position[channel][allpass] = position;
+  }
+}
+
+/**
+ * This is where the action happens.
+ */
+static inline void run_filter(LADSPA_Handle instance,
+                              unsigned long sample_count, const int stereo)
+{
+  filter_type *filter = (filter_type *)instance;
+  LADSPA_Data input[REVERB_TILE];
+  LADSPA_Data wet_l[REVERB_TILE];
+  LADSPA_Data wet_r[REVERB_TILE];
+  LADSPA_Data feedback, damp, wet, dry, wet_1, wet_2, in_l, in_r;
+  unsigned long tile_length, offset, i;
+
+  smooth_start(&filter->room, kernel_clamp(*filter->room_control_value,
+                                            CONTROL_LOWER, CONTROL_UPPER),
+               sample_count);
+  smooth_start(&filter->damp, kernel_clamp(*filter->damp_control_value,
+                                            CONTROL_LOWER, CONTROL_UPPER),
+               sample_count);
+  smooth_start(&filter->wet, kernel_clamp(*filter->wet_control_value,
+                                          CONTROL_LOWER, CONTROL_UPPER),
+               sample_count);
+  smooth_start(&filter->dry, kernel_clamp(*filter->dry_control_value,
+                                          CONTROL_LOWER, CONTROL_UPPER),
+               sample_count);
+  if(stereo)
+    smooth_start(&filter->width,
+                 kernel_clamp(*filter->width_control_value,
+                              CONTROL_LOWER, CONTROL_UPPER),
+                 sample_count);
+
+  for(offset = 0; offset < sample_count; offset += tile_length) {
+    tile_length = smooth_segment(sample_count - offset);
+
+    // the parameters move at control rate, one step per tile
+    feedback = smooth_advance(&filter->room, tile_length) * SCALE_ROOM +
+      OFFSET_ROOM;
+    damp = smooth_advance(&filter->damp, tile_length) * SCALE_DAMP;
+    wet = smooth_advance(&filter->wet, tile_length) * SCALE_WET;
+    dry = smooth_advance(&filter->dry, tile_length) * SCALE_DRY;
+    wet_1 = wet;
+    wet_2 = 0;
+    if(stereo) {
+      wet_1 = wet * (smooth_advance(&filter->width, tile_length) / 2 + .5);
+      wet_2 = wet * (1 - filter->width.value) / 2;
+    }
+
+    for(i = 0; i < tile_length; i ++)
+      input[i] = (stereo ? filter->input_buffer_l[offset + i] +
+                  filter->input_buffer_r[offset + i] :
+                  2 * filter->input_buffer_l[offset + i]) * FIXED_GAIN +
+        ANTI_DENORMAL;
+
+    if(stereo) {
+      copy_combs(filter, tile_length, 2 * COMB_COUNT, 0);
+      run_combs(filter, input, tile_length, 2 * COMB_COUNT, feedback, damp);
+      copy_combs(filter, tile_length, 2 * COMB_COUNT, 1);
+      run_allpasses(filter, 0, tile_length, wet_l);
+      run_allpasses(filter, 1, tile_length, wet_r);
+
+      for(i = 0; i < tile_length; i ++) {
+        in_l = filter->input_buffer_l[offset + i];
+        in_r = filter->input_buffer_r[offset + i];
+        filter->output_buffer_l[offset + i] =
+          wet_l[i] * wet_1 + wet_r[i] * wet_2 + in_l * dry;
+        filter->output_buffer_r[offset + i] =
+          wet_r[i] * wet_1 + wet_l[i] * wet_2 + in_r * dry;
+      }
+    }
+    else {
+      copy_combs(filter, tile_length, COMB_COUNT, 0);
+      run_combs(filter, input, tile_length, COMB_COUNT, feedback, damp);
+      copy_combs(filter, tile_length, COMB_COUNT, 1);
+      run_allpasses(filter, 0, tile_length, wet_l);
+
+      for(i = 0; i < tile_length; i ++)
+        filter->output_buffer_l[offset + i] = wet_l[i] * wet_1 +
+          filter->input_buffer_l[offset + i] * dry;
+    }
+  }
+
+  smooth_end(&filter->room);
+  smooth_end(&filter->damp);
+  smooth_end(&filter->wet);
+  smooth_end(&filter->dry);
+  if(stereo)
+    smooth_end(&filter->width);
+}
+
+static void run_mono_filter(LADSPA_Handle instance,
+                            unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 0);
+}
+
+static void run_stereo_filter(LADSPA_Handle instance,
+                              unsigned long sample_count)
+{
+  run_filter(instance, sample_count, 1);
+}
+
+static void cleanup_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+
+  free(filter->memory);
+  free(filter);
+}
+
+/**
+ * The ports of the stereo plugin. The mono plugin has the same ports
+ * without the right channel, so it uses the first PortCount entries
+ * of the same tables, apart from the names of the audio ports.
+ */
+static const LADSPA_PortDescriptor port_descriptors[] = {
+  [ROOM_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [DAMP_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [WET_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [DRY_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+  [WIDTH_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [INPUT_R] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT_R] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+
+static const char *const mono_port_names[] = {
+  [ROOM_CONTROL] = "Room size",
+  [DAMP_CONTROL] = "Damping",
+  [WET_CONTROL] = "Wet level",
+  [DRY_CONTROL] = "Dry level",
+  [INPUT_L] = "Input",
+  [OUTPUT_L] = "Output"
+};
+
+static const char *const stereo_port_names[] = {
+  [ROOM_CONTROL] = "Room size",
+  [DAMP_CONTROL] = "Damping",
+  [WET_CONTROL] = "Wet level",
+  [DRY_CONTROL] = "Dry level",
+  [INPUT_L] = "Input Left",
+  [OUTPUT_L] = "Output Left",
+  [WIDTH_CONTROL] = "Width",
+  [INPUT_R] = "Input Right",
+  [OUTPUT_R] = "Output Right"
+};
+
+static const LADSPA_PortRangeHint port_range_hints[] = {
+  [ROOM_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_DEFAULT_MIDDLE,
+                     CONTROL_LOWER, CONTROL_UPPER },
+  [DAMP_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_DEFAULT_MIDDLE,
+                     CONTROL_LOWER, CONTROL_UPPER },
+  [WET_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                    | LADSPA_HINT_BOUNDED_ABOVE
+                    | LADSPA_HINT_DEFAULT_LOW,
+                    CONTROL_LOWER, CONTROL_UPPER },
+  [DRY_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                    | LADSPA_HINT_BOUNDED_ABOVE
+                    | LADSPA_HINT_DEFAULT_MIDDLE,
+                    CONTROL_LOWER, CONTROL_UPPER },
+  [INPUT_L] = { 0, 0, 0 },
+  [OUTPUT_L] = { 0, 0, 0 },
+  [WIDTH_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                      | LADSPA_HINT_BOUNDED_ABOVE
+                      | LADSPA_HINT_DEFAULT_1,
+                      CONTROL_LOWER, CONTROL_UPPER },
+  [INPUT_R] = { 0, 0, 0 },
+  [OUTPUT_R] = { 0, 0, 0 }
+};
+
+/**
+ * The descriptors the host will be using. They are constant data, so
+ * there is nothing to build when the library is loaded and nothing
+ * to free when it is unloaded.
+ */
+static const LADSPA_Descriptor mono_descriptor = {
+  .UniqueID = 0x00654333,
+  .Label = "freeverb_mono",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "Freeverb-style reverb (mono)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 6,
+  .PortDescriptors = port_descriptors,
+  .PortNames = mono_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_mono_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+static const LADSPA_Descriptor stereo_descriptor = {
+  .UniqueID = 0x00654334,
+  .Label = "freeverb_stereo",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "Freeverb-style reverb (stereo)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 9,
+  .PortDescriptors = port_descriptors,
+  .PortNames = stereo_port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_stereo_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = NULL,
+  .cleanup = cleanup_filter
+};
+
+/* Return a descriptor of the requested plugin type. There are two
+   plugin types available in this library (mono and stereo). */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  switch (index) {
+  case 0:
+    return &mono_descriptor;
+  case 1:
+    return &stereo_descriptor;
+  default:
+    return NULL;
+  }
+}
@@ -0,0 +1,530 @@
+/*
+ * graph.c - Run a graph of plugins on a pool of threads
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "graph.h"
+
+// how many times a worker looks for work before it yields, when it
+// has a core to itself
+#define GRAPH_SPINS 1000
+
+static double now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Push a node on the bottom of a worker's own deque.
+ */
+static void deque_push(graph_deque_type *deque, int node)
+{
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+
+  atomic_store_explicit(&deque->nodes[bottom & deque->mask], node,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/**
+ * Take the node on the bottom of a worker's own deque, or -1 if it's
+ * empty. When there is one node left, the worker races the thieves
+ * for it.
+ */
+static int deque_take(graph_deque_type *deque)
+{
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  long top;
+  int node = -1;
+
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if(top <= bottom) {
+    node = atomic_load_explicit(&deque->nodes[bottom & deque->mask],
+                                memory_order_relaxed);
+    if(top == bottom) {
+      if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                  memory_order_seq_cst,
+                                                  memory_order_relaxed))
+        node = -1;
+      atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+  }
+  else
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+  return node;
+}
+
+/**
+ * Steal the node on the top of another worker's deque, or -1 if it's
+ * empty or another thread got there first.
+ */
+static int deque_steal(graph_deque_type *deque)
+{
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  long bottom;
+  int node;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if(top >= bottom)
+    return -1;
+
+  node = atomic_load_explicit(&deque->nodes[top & deque->mask],
+                              memory_order_relaxed);
+  if(!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                              memory_order_seq_cst,
+                                              memory_order_relaxed))
+    return -1;
+
+  return node;
+}
+
+/**
+ * Steal a node from any other worker, starting with a random one, or
+ * return -1 if none of them have any.
+ */
+static int steal(graph_worker_type *worker)
+{
+  graph_type *graph = worker->graph;
+  int victim = rand_r(&worker->seed) % graph->worker_count;
+  int i, node;
+
+  for(i = 0; i < graph->worker_count; i ++) {
+    if(victim != worker->index &&
+       (node = deque_steal(&graph->workers[victim].deque)) >= 0)
+      return node;
+    if(++ victim == graph->worker_count)
+      victim = 0;
+  }
+
+  return -1;
+}
+
+/**
+ * Add up a node's inputs, run its plugin and ready the nodes it feeds
+ * that have no other inputs left to run.
+ */
+static void run_node(graph_worker_type *worker, int index)
+{
+  graph_type *graph = worker->graph;
+  graph_node_type *node = &graph->nodes[index];
+  graph_node_type *output;
+  unsigned long sample_count = graph->sample_count, i;
+  LADSPA_Data *sum, *input;
+  int channel, j;
+
+  if(node->input_count > 0)
+    for(channel = 0; channel < graph->channels; channel ++) {
+      sum = node->buffers[channel];
+      memcpy(sum, graph->nodes[node->inputs[0]].buffers[channel],
+             sample_count * sizeof(LADSPA_Data));
+      for(j = 1; j < node->input_count; j ++) {
+        input = graph->nodes[node->inputs[j]].buffers[channel];
+        for(i = 0; i < sample_count; i ++)
+          sum[i] += input[i];
+      }
+    }
+
+  if(!node->bus)
+    host_chain_run(&node->chain, node->buffers, sample_count);
+
+  // its inputs have all run, so none of them will count it down again
+  // until the next block
+  atomic_store_explicit(&node->pending, node->input_count,
+                        memory_order_relaxed);
+
+  for(j = 0; j < node->output_count; j ++) {
+    output = &graph->nodes[node->outputs[j]];
+    if(atomic_fetch_sub_explicit(&output->pending, 1,
+                                 memory_order_acq_rel) == 1)
+      deque_push(&worker->deque, node->outputs[j]);
+  }
+
+  worker->runs ++;
+  if(node->home == worker->index)
+    worker->home_runs ++;
+  atomic_fetch_sub_explicit(&graph->remaining, 1, memory_order_release);
+}
+
+/**
+ * A worker's part of a block: ready its sources, then run nodes from
+ * its own deque or stolen from others until every node has run.
+ */
+static void run_block(graph_worker_type *worker)
+{
+  graph_type *graph = worker->graph;
+  int i, node, spins = 0;
+
+  for(i = 0; i < worker->source_count; i ++)
+    deque_push(&worker->deque, worker->sources[i]);
+
+  while(atomic_load_explicit(&graph->remaining, memory_order_acquire) > 0) {
+    if((node = deque_take(&worker->deque)) < 0 &&
+       (node = steal(worker)) >= 0)
+      worker->steals ++;
+
+    if(node >= 0) {
+      run_node(worker, node);
+      spins = 0;
+    }
+    else if(spins ++ < graph->spins) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    else
+      sched_yield();
+  }
+}
+
+static void *run_worker(void *data)
+{
+  graph_worker_type *worker = (graph_worker_type *)data;
+  graph_type *graph = worker->graph;
+
+  // wait until graph_start has started every worker, or given up
+  pthread_mutex_lock(&graph->starting);
+  pthread_mutex_unlock(&graph->starting);
+  if(graph->start_failed)
+    return NULL;
+
+  while(1) {
+    pthread_barrier_wait(&graph->start_barrier);
+    if(graph->stopping)
+      break;
+    run_block(worker);
+    pthread_barrier_wait(&graph->done_barrier);
+  }
+
+  return NULL;
+}
+
+static void free_graph(graph_type *graph)
+{
+  graph_node_type *node;
+  int i;
+
+  for(i = 0; i < graph->node_count; i ++) {
+    node = &graph->nodes[i];
+    if(!node->bus)
+      host_chain_cleanup(&node->chain);
+    free(node->buffers[0]);
+    free(node->inputs);
+    free(node->outputs);
+  }
+  for(i = 0; i < graph->worker_count; i ++) {
+    free(graph->workers[i].deque.nodes);
+    free(graph->workers[i].sources);
+  }
+  free(graph->workers);
+  free(graph->nodes);
+}
+
+/**
+ * The nth of the CPUs in a set, or -1 if it has no more than n.
+ */
+static int nth_cpu(const cpu_set_t *set, int n)
+{
+  int cpu;
+
+  for(cpu = 0; cpu < CPU_SETSIZE; cpu ++)
+    if(CPU_ISSET(cpu, set) && n -- == 0)
+      return cpu;
+
+  return -1;
+}
+
+/**
+ * Stop the workers from 1 up to count, which graph_start has started
+ * but not let run yet, and free the graph.
+ */
+static void unwind_start(graph_type *graph, int count)
+{
+  int i;
+
+  graph->start_failed = 1;
+  pthread_mutex_unlock(&graph->starting);
+  for(i = 1; i < count; i ++)
+    pthread_join(graph->workers[i].thread, NULL);
+  pthread_mutex_destroy(&graph->starting);
+  pthread_barrier_destroy(&graph->start_barrier);
+  pthread_barrier_destroy(&graph->done_barrier);
+  free_graph(graph);
+}
+
+void graph_init(graph_type *graph, int channels)
+{
+  memset(graph, 0, sizeof(graph_type));
+  graph->channels = channels;
+}
+
+/**
+ * Add a node that runs a stage, or a bus if stage is null, on the sum
+ * of the given nodes. Returns the new node's index, or -1 and says why
+ * if it can't be added.
+ */
+int graph_add_node(graph_type *graph, const host_stage_type *stage,
+                   const int *inputs, int input_count)
+{
+  graph_node_type *node;
+  int i;
+
+  if(stage && stage->channels != graph->channels) {
+    fprintf(stderr, "%s has %d channels, the graph %d\n",
+            stage->descriptor->Label, stage->channels, graph->channels);
+    return -1;
+  }
+  for(i = 0; i < input_count; i ++)
+    if(inputs[i] < 0 || inputs[i] >= graph->node_count) {
+      fprintf(stderr, "graph: no node %d to take input from\n", inputs[i]);
+      return -1;
+    }
+
+  if(graph->node_count == graph->node_room) {
+    graph->node_room = graph->node_room ? 2 * graph->node_room : 64;
+    node = realloc(graph->nodes, graph->node_room * sizeof(graph_node_type));
+    if(!node)
+      return -1;
+    graph->nodes = node;
+  }
+
+  node = &graph->nodes[graph->node_count];
+  memset(node, 0, sizeof(graph_node_type));
+  node->bus = !stage;
+  if(stage)
+    node->stage = *stage;
+  if(input_count > 0) {
+    if(!(node->inputs = malloc(input_count * sizeof(int))))
+      return -1;
+    memcpy(node->inputs, inputs, input_count * sizeof(int));
+  }
+  node->input_count = input_count;
+
+  return graph->node_count ++;
+}
+
+/**
+ * Instantiate every node, for blocks of up to block_size samples, and
+ * start threads - 1 workers to run them with the calling thread.
+ * Returns 0 and says why if it can't, and then the graph is freed.
+ */
+int graph_start(graph_type *graph, unsigned long sample_rate,
+                unsigned long block_size, int threads)
+{
+  graph_node_type *node, *input;
+  graph_worker_type *worker;
+  LADSPA_Data *buffer;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long room;
+  int i, j, source, channel, next_home = 0, error;
+  cpu_set_t allowed, cpu;
+
+  if(threads < 1 || graph->node_count == 0) {
+    fprintf(stderr, "graph: needs nodes and at least one thread\n");
+    free_graph(graph);
+    return 0;
+  }
+  graph->sample_rate = sample_rate;
+  graph->block_size = block_size;
+  graph->deadline = (double)block_size / sample_rate;
+
+  // the workers get the CPUs this process may run on, which needn't be
+  // numbered from 0 or one after another
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    cpus = CPU_COUNT(&allowed);
+  else
+    CPU_ZERO(&allowed);
+  graph->spins = threads <= cpus ? GRAPH_SPINS : 0;
+
+  if(!(graph->workers = calloc(threads, sizeof(graph_worker_type)))) {
+    fprintf(stderr, "graph: out of memory\n");
+    free_graph(graph);
+    return 0;
+  }
+  graph->worker_count = threads;
+  for(room = 1; room < graph->node_count; room <<= 1)
+    ;
+  for(i = 0; i < threads; i ++) {
+    worker = &graph->workers[i];
+    worker->graph = graph;
+    worker->index = i;
+    worker->seed = i + 1;
+    worker->deque.nodes = calloc(room, sizeof(atomic_int));
+    worker->deque.mask = room - 1;
+    worker->sources = malloc(graph->node_count * sizeof(int));
+    if(!worker->deque.nodes || !worker->sources) {
+      fprintf(stderr, "graph: out of memory\n");
+      free_graph(graph);
+      return 0;
+    }
+    atomic_init(&worker->deque.top, 0);
+    atomic_init(&worker->deque.bottom, 0);
+  }
+
+  // the outputs of each node, and its home: its first input's, or the
+  // next worker's in turn if it has none
+  for(i = 0; i < graph->node_count; i ++) {
+    node = &graph->nodes[i];
+    if(!(node->outputs = malloc(graph->node_count * sizeof(int)))) {
+      fprintf(stderr, "graph: out of memory\n");
+      free_graph(graph);
+      return 0;
+    }
+    if(node->input_count > 0)
+      node->home = graph->nodes[node->inputs[0]].home;
+    else
+      node->home = next_home ++ % threads;
+    for(j = 0; j < node->input_count; j ++) {
+      input = &graph->nodes[node->inputs[j]];
+      input->outputs[input->output_count ++] = i;
+    }
+    atomic_init(&node->pending, node->input_count);
+  }
+
+  // the rank of a node is the number of nodes on the longest path from
+  // it to the end of the graph. each worker pushes its sources in
+  // order of rank, so the highest are taken first.
+  for(i = graph->node_count - 1; i >= 0; i --) {
+    node = &graph->nodes[i];
+    node->rank = 1;
+    for(j = 0; j < node->output_count; j ++)
+      if(graph->nodes[node->outputs[j]].rank + 1 > node->rank)
+        node->rank = graph->nodes[node->outputs[j]].rank + 1;
+    if(node->input_count == 0) {
+      worker = &graph->workers[node->home];
+      for(source = worker->source_count ++; source > 0 &&
+            graph->nodes[worker->sources[source - 1]].rank > node->rank;
+          source --)
+        worker->sources[source] = worker->sources[source - 1];
+      worker->sources[source] = i;
+    }
+  }
+
+  for(i = 0; i < graph->node_count; i ++) {
+    node = &graph->nodes[i];
+    if(posix_memalign((void **)&buffer, 64, graph->channels * block_size *
+                      sizeof(LADSPA_Data))) {
+      fprintf(stderr, "graph: out of memory\n");
+      free_graph(graph);
+      return 0;
+    }
+    for(channel = 0; channel < graph->channels; channel ++)
+      node->buffers[channel] = buffer + channel * block_size;
+    if(!node->bus &&
+       !host_chain_instantiate(&node->chain, &node->stage, 1, sample_rate,
+                               block_size)) {
+      free_graph(graph);
+      return 0;
+    }
+  }
+
+  // the calling thread is worker 0, and the others get a core each if
+  // there are enough. they wait for all of them to be started, so if
+  // one can't be, those that were can be stopped before they touch the
+  // barriers.
+  pthread_barrier_init(&graph->start_barrier, NULL, threads);
+  pthread_barrier_init(&graph->done_barrier, NULL, threads);
+  pthread_mutex_init(&graph->starting, NULL);
+  pthread_mutex_lock(&graph->starting);
+  for(i = 1; i < threads; i ++) {
+    if((error = pthread_create(&graph->workers[i].thread, NULL, run_worker,
+                               &graph->workers[i]))) {
+      fprintf(stderr, "graph: can't start a worker: %s\n", strerror(error));
+      unwind_start(graph, i);
+      return 0;
+    }
+    if(threads <= cpus && nth_cpu(&allowed, i) >= 0) {
+      CPU_ZERO(&cpu);
+      CPU_SET(nth_cpu(&allowed, i), &cpu);
+      pthread_setaffinity_np(graph->workers[i].thread, sizeof(cpu), &cpu);
+    }
+  }
+  pthread_mutex_unlock(&graph->starting);
+
+  return 1;
+}
+
+/**
+ * The buffers of a node, one per channel, where the caller puts the
+ * input of a node with no inputs and finds the output of any node.
+ */
+LADSPA_Data **graph_buffers(graph_type *graph, int node)
+{
+  return graph->nodes[node].buffers;
+}
+
+/**
+ * Run every node once over sample_count samples (at most block_size),
+ * and time the block against the deadline.
+ */
+void graph_run(graph_type *graph, unsigned long sample_count)
+{
+  double start = now(), elapsed;
+
+  graph->sample_count = sample_count;
+  atomic_store_explicit(&graph->remaining, graph->node_count,
+                        memory_order_relaxed);
+
+  pthread_barrier_wait(&graph->start_barrier);
+  run_block(&graph->workers[0]);
+  pthread_barrier_wait(&graph->done_barrier);
+
+  elapsed = now() - start;
+  graph->total += elapsed;
+  if(elapsed > graph->worst)
+    graph->worst = elapsed;
+  if(elapsed > graph->deadline)
+    graph->misses ++;
+  graph->blocks ++;
+}
+
+/**
+ * Stop the workers and free the graph and its nodes.
+ */
+void graph_stop(graph_type *graph)
+{
+  int i;
+
+  graph->stopping = 1;
+  pthread_barrier_wait(&graph->start_barrier);
+  for(i = 1; i < graph->worker_count; i ++)
+    pthread_join(graph->workers[i].thread, NULL);
+  pthread_mutex_destroy(&graph->starting);
+  pthread_barrier_destroy(&graph->start_barrier);
+  pthread_barrier_destroy(&graph->done_barrier);
+
+  free_graph(graph);
+}
@@ -0,0 +1,147 @@
+/*
+ * graph.h - Run a graph of plugins on a pool of threads
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A mix as a graph: each node is an instance of a plugin (a stage, see
+ * host.h), or a bus with no plugin, and has its own buffers. A node
+ * adds up the outputs of the nodes it takes input from and runs its
+ * plugin on the sum in place. A node with no inputs runs on whatever
+ * the caller left in its buffers. Nodes can only take input from
+ * nodes added before them, so the graph has no cycles.
+ *
+ * Each block, the nodes run on a pool of threads as soon as their
+ * inputs are done. Every thread has a deque of ready nodes: it works
+ * from the bottom of its own, most recently readied first, and when
+ * it runs out it steals from the top of another's.
+ *
+ * Every node has a home thread, the home of its first input, with the
+ * nodes that have no inputs shared out in turn. Each block starts
+ * with every thread readying its own sources, and a node readied by
+ * a thread goes on that thread's deque, so a track's plugins run on
+ * the same thread block after block unless the work is uneven enough
+ * for another thread to steal them. Sources that lead to the longest
+ * paths through the graph are started first.
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ladspa.h"
+#include "host.h"
+
+/**
+ * A node, the nodes it feeds and how many of its inputs are still to
+ * run this block.
+ */
+typedef struct {
+  host_stage_type stage;
+  host_chain_type chain;
+  int bus;
+  LADSPA_Data *buffers[HOST_MAX_CHANNELS];
+
+  int *inputs;
+  int input_count;
+  int *outputs;
+  int output_count;
+
+  atomic_int pending;
+  int home;
+  int rank;
+} graph_node_type;
+
+/**
+ * A Chase-Lev deque of ready nodes. Only its worker pushes and takes,
+ * at the bottom; other workers steal from the top. It has room for
+ * every node, so it never grows.
+ */
+typedef struct {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  atomic_int *nodes;
+  long mask;
+} graph_deque_type;
+
+typedef struct graph_type graph_type;
+
+typedef struct {
+  graph_type *graph;
+  int index;
+  pthread_t thread;
+  graph_deque_type deque;
+  unsigned int seed;
+
+  // the nodes with no inputs that this worker starts, in the order
+  // it pushes them
+  int *sources;
+  int source_count;
+
+  // how many nodes it ran, how many of those were its own and how
+  // many it stole
+  unsigned long runs;
+  unsigned long home_runs;
+  unsigned long steals;
+} graph_worker_type;
+
+struct graph_type {
+  int channels;
+  graph_node_type *nodes;
+  int node_count;
+  int node_room;
+
+  unsigned long sample_rate;
+  unsigned long block_size;
+  unsigned long sample_count;
+  graph_worker_type *workers;
+  int worker_count;
+  int spins;
+  int stopping;
+  atomic_int remaining;
+  // held while graph_start starts the workers, and set if it couldn't
+  pthread_mutex_t starting;
+  int start_failed;
+  pthread_barrier_t start_barrier;
+  pthread_barrier_t done_barrier;
+
+  // how long the blocks took against the deadline, a block's length
+  // unless the caller sets another, in seconds
+  double deadline;
+  double total;
+  double worst;
+  unsigned long blocks;
+  unsigned long misses;
+};
+
+void graph_init(graph_type *graph, int channels);
+
+int graph_add_node(graph_type *graph, const host_stage_type *stage,
+                   const int *inputs, int input_count);
+
+int graph_start(graph_type *graph, unsigned long sample_rate,
+                unsigned long block_size, int threads);
+
+LADSPA_Data **graph_buffers(graph_type *graph, int node);
+
+void graph_run(graph_type *graph, unsigned long sample_count);
+
+void graph_stop(graph_type *graph);
+
+#endif
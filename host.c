@@ -0,0 +1,526 @@
+/*
+ * host.c - What the command-line hosts have in common
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+
+#include "ladspa.h"
+#include "host.h"
+
+/**
+ * The default value of a control port, as suggested by its hints.
+ */
+LADSPA_Data get_default(const LADSPA_PortRangeHint *hint)
+{
+  LADSPA_PortRangeHintDescriptor descriptor = hint->HintDescriptor;
+  LADSPA_Data lower = hint->LowerBound;
+  LADSPA_Data upper = hint->UpperBound;
+  LADSPA_Data value;
+  float weight;
+
+  switch(descriptor & LADSPA_HINT_DEFAULT_MASK) {
+  case LADSPA_HINT_DEFAULT_MINIMUM:
+    return lower;
+  case LADSPA_HINT_DEFAULT_MAXIMUM:
+    return upper;
+  case LADSPA_HINT_DEFAULT_0:
+    return 0;
+  case LADSPA_HINT_DEFAULT_1:
+    return 1;
+  case LADSPA_HINT_DEFAULT_100:
+    return 100;
+  case LADSPA_HINT_DEFAULT_440:
+    return 440;
+  case LADSPA_HINT_DEFAULT_LOW:
+    weight = .25;
+    break;
+  case LADSPA_HINT_DEFAULT_HIGH:
+    weight = .75;
+    break;
+  case LADSPA_HINT_DEFAULT_MIDDLE:
+    weight = .5;
+    break;
+  default:
+    return LADSPA_IS_HINT_BOUNDED_BELOW(descriptor) ? lower : 0;
+  }
+
+  if(LADSPA_IS_HINT_LOGARITHMIC(descriptor) && lower > 0)
+    value = exp(log(lower) * (1 - weight) + log(upper) * weight);
+  else
+    value = lower * (1 - weight) + upper * weight;
+
+  if(LADSPA_IS_HINT_INTEGER(descriptor))
+    value = floor(value + .5);
+
+  return value;
+}
+
+/**
+ * The descriptor with the given label in a library, or null. The
+ * library stays open.
+ */
+const LADSPA_Descriptor *host_find_plugin(const char *library,
+                                          const char *label)
+{
+  LADSPA_Descriptor_Function get_descriptor;
+  const LADSPA_Descriptor *descriptor;
+  unsigned long index;
+  void *handle;
+
+  handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+  if(!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    return NULL;
+  }
+
+  get_descriptor = (LADSPA_Descriptor_Function)
+    dlsym(handle, "ladspa_descriptor");
+  if(!get_descriptor) {
+    fprintf(stderr, "%s\n", dlerror());
+    return NULL;
+  }
+
+  for(index = 0; (descriptor = get_descriptor(index)); index ++)
+    if(strcmp(label, descriptor->Label) == 0)
+      return descriptor;
+
+  fprintf(stderr, "%s: no plugin %s\n", library, label);
+  return NULL;
+}
+
+/**
+ * The state interface (see state.h) of a plugin, from the ladspa_state
+ * of the library its descriptor is in, or null if it hasn't got one.
+ */
+static const state_interface_type *
+find_state(const LADSPA_Descriptor *descriptor)
+{
+  state_function_type get_state;
+  Dl_info info;
+  void *handle;
+
+  if(!dladdr(descriptor, &info) ||
+     !(handle = dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD)))
+    return NULL;
+  get_state = (state_function_type)dlsym(handle, "ladspa_state");
+  dlclose(handle);
+
+  return get_state ? get_state(descriptor) : NULL;
+}
+
+/**
+ * Make a stage of a plugin, with its controls at their defaults.
+ * Returns 0 and says why if it can't be run in place in a chain.
+ */
+int host_make_stage(host_stage_type *stage,
+                    const LADSPA_Descriptor *descriptor)
+{
+  LADSPA_PortDescriptor port_descriptor;
+  unsigned long port;
+  int inputs = 0, outputs = 0;
+
+  if(descriptor->PortCount > HOST_MAX_PORTS) {
+    fprintf(stderr, "%s: too many ports\n", descriptor->Label);
+    return 0;
+  }
+  stage->descriptor = descriptor;
+  stage->state = find_state(descriptor);
+
+  for(port = 0; port < descriptor->PortCount; port ++) {
+    port_descriptor = descriptor->PortDescriptors[port];
+    if(LADSPA_IS_PORT_CONTROL(port_descriptor))
+      stage->controls[port] = get_default(descriptor->PortRangeHints + port);
+    else if(LADSPA_IS_PORT_INPUT(port_descriptor)) {
+      if(inputs == HOST_MAX_CHANNELS)
+        break;
+      stage->inputs[inputs ++] = port;
+    }
+    else {
+      if(outputs == HOST_MAX_CHANNELS)
+        break;
+      stage->outputs[outputs ++] = port;
+    }
+  }
+  if(port < descriptor->PortCount || inputs != outputs || inputs == 0) {
+    fprintf(stderr, "%s: needs as many audio inputs as outputs, at most "
+            "%d\n", descriptor->Label, HOST_MAX_CHANNELS);
+    return 0;
+  }
+  stage->channels = inputs;
+
+  return 1;
+}
+
+/**
+ * Load a stage from its spec, library.so:label[:port=value,...].
+ * Returns 0 and says why if it can't.
+ */
+int host_load_stage(host_stage_type *stage, const char *spec)
+{
+  const LADSPA_Descriptor *descriptor;
+  char library[1024], label[256];
+  const char *settings;
+  unsigned long port;
+  LADSPA_Data value;
+  int length;
+
+  if(sscanf(spec, "%1023[^:]:%255[^:]%n", library, label, &length) != 2) {
+    fprintf(stderr, "%s: expected library.so:label\n", spec);
+    return 0;
+  }
+
+  if(!(descriptor = host_find_plugin(library, label)) ||
+     !host_make_stage(stage, descriptor))
+    return 0;
+
+  // the controls that are set in the spec
+  for(settings = spec + length; *settings; ) {
+    if(sscanf(settings + 1, "%lu=%f%n", &port, &value, &length) != 2 ||
+       port >= descriptor->PortCount ||
+       !LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port])) {
+      fprintf(stderr, "%s: expected control port=value at %s\n", label,
+              settings + 1);
+      return 0;
+    }
+    stage->controls[port] = value;
+    settings += length + 1;
+  }
+
+  return 1;
+}
+
+/**
+ * The plugins that forget, by unique ID, and their memory in seconds.
+ */
+static const struct {
+  unsigned long id;
+  double seconds;
+} memories[] = {
+  // fir, in every channel layout: its history holds half a period of
+  // its lowest frequency, 1 Hz, and nothing older is ever read
+  { 0x00654321, .5 },
+  { 0x00654322, .5 },
+  { 0x00654337, .5 },
+  { 0x00654338, .5 },
+  { 0x00654339, .5 },
+};
+
+/**
+ * How many samples of input the stage's output depends on when its
+ * controls are held still, or HOST_UNBOUNDED if it may depend on all
+ * of it.
+ */
+unsigned long host_stage_memory(const host_stage_type *stage,
+                                unsigned long sample_rate)
+{
+  int i;
+
+  for(i = 0; i < sizeof(memories) / sizeof(memories[0]); i ++)
+    if(memories[i].id == stage->descriptor->UniqueID)
+      return ceil(memories[i].seconds * sample_rate);
+
+  return HOST_UNBOUNDED;
+}
+
+/**
+ * Roughly how many samples it takes a chain to forget, by running an
+ * impulse through it on every channel: the length of its impulse
+ * response down to HOST_TAIL_LEVEL of its peak, once it has stayed
+ * below that for a second, and at least one. Gives up at limit
+ * samples, and returns 0 if the chain can't be instantiated or its
+ * buffers allocated.
+ */
+unsigned long host_chain_tail(const host_stage_type *stages, int stage_count,
+                              unsigned long sample_rate, unsigned long limit)
+{
+  host_chain_type chain;
+  LADSPA_Data *buffers[HOST_MAX_CHANNELS];
+  unsigned long done, tail = 1, i;
+  LADSPA_Data peak = 0, level;
+  int channels, channel;
+
+  if(!host_chain_instantiate(&chain, stages, stage_count, sample_rate,
+                             HOST_TAIL_BLOCK))
+    return 0;
+  channels = chain.channels;
+  for(channel = 0; channel < channels; channel ++)
+    if(!(buffers[channel] = calloc(HOST_TAIL_BLOCK, sizeof(LADSPA_Data)))) {
+      host_chain_cleanup(&chain);
+      while(channel -- > 0)
+        free(buffers[channel]);
+      return 0;
+    }
+
+  for(done = 0; done < limit && done < tail + sample_rate;
+      done += HOST_TAIL_BLOCK) {
+    for(channel = 0; channel < channels; channel ++) {
+      memset(buffers[channel], 0, HOST_TAIL_BLOCK * sizeof(LADSPA_Data));
+      buffers[channel][0] = done == 0;
+    }
+    host_chain_run(&chain, buffers, HOST_TAIL_BLOCK);
+
+    for(channel = 0; channel < channels; channel ++)
+      for(i = 0; i < HOST_TAIL_BLOCK; i ++) {
+        level = fabsf(buffers[channel][i]);
+        if(level > peak)
+          peak = level;
+        if(level > peak * HOST_TAIL_LEVEL && done + i + 1 > tail)
+          tail = done + i + 1;
+      }
+  }
+
+  host_chain_cleanup(&chain);
+  for(channel = 0; channel < channels; channel ++)
+    free(buffers[channel]);
+
+  return tail < limit ? tail : limit;
+}
+
+/**
+ * The number of channels of a series of stages, or 0 if they don't
+ * all have the same number.
+ */
+int host_chain_channels(const host_stage_type *stages, int stage_count)
+{
+  int stage;
+
+  for(stage = 1; stage < stage_count; stage ++)
+    if(stages[stage].channels != stages[0].channels) {
+      fprintf(stderr, "%s has %d channels but %s has %d\n",
+              stages[stage - 1].descriptor->Label, stages[stage - 1].channels,
+              stages[stage].descriptor->Label, stages[stage].channels);
+      return 0;
+    }
+
+  return stage_count > 0 ? stages[0].channels : 0;
+}
+
+/**
+ * Instantiate and activate every stage of a chain, for blocks of up to
+ * block_size samples. Returns 0 if a stage couldn't be instantiated.
+ */
+int host_chain_instantiate(host_chain_type *chain,
+                           const host_stage_type *stages, int stage_count,
+                           unsigned long sample_rate,
+                           unsigned long block_size)
+{
+  const LADSPA_Descriptor *descriptor;
+  unsigned long port;
+  int stage, channel;
+
+  memset(chain, 0, sizeof(host_chain_type));
+  chain->stages = stages;
+  chain->sample_rate = sample_rate;
+  chain->block_size = block_size;
+  if(stage_count > HOST_MAX_STAGES ||
+     !(chain->channels = host_chain_channels(stages, stage_count)))
+    return 0;
+
+  for(channel = 0; channel < chain->channels; channel ++)
+    if(!(chain->scratch[channel] =
+         malloc(block_size * sizeof(LADSPA_Data)))) {
+      host_chain_cleanup(chain);
+      return 0;
+    }
+
+  for(stage = 0; stage < stage_count; stage ++) {
+    descriptor = stages[stage].descriptor;
+    chain->instances[stage] = descriptor->instantiate(descriptor, sample_rate);
+    if(!chain->instances[stage]) {
+      fprintf(stderr, "%s: couldn't instantiate\n", descriptor->Label);
+      host_chain_cleanup(chain);
+      return 0;
+    }
+    chain->stage_count = stage + 1;
+
+    memcpy(chain->controls[stage], stages[stage].controls,
+           sizeof(chain->controls[stage]));
+    for(port = 0; port < descriptor->PortCount; port ++)
+      if(LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+        descriptor->connect_port(chain->instances[stage], port,
+                                 chain->controls[stage] + port);
+
+    if(descriptor->activate)
+      descriptor->activate(chain->instances[stage]);
+  }
+
+  return 1;
+}
+
+/**
+ * Run every stage of the chain, in place, over sample_count samples
+ * (at most block_size) of each channel's buffer. Stages that can't run
+ * in place write to the scratch buffers, which are copied back.
+ */
+void host_chain_run(host_chain_type *chain, LADSPA_Data **buffers,
+                    unsigned long sample_count)
+{
+  const host_stage_type *stage;
+  LADSPA_Handle instance;
+  int in_place, i, channel;
+
+  for(i = 0; i < chain->stage_count; i ++) {
+    stage = chain->stages + i;
+    instance = chain->instances[i];
+    in_place = !LADSPA_IS_INPLACE_BROKEN(stage->descriptor->Properties);
+
+    for(channel = 0; channel < chain->channels; channel ++) {
+      stage->descriptor->connect_port(instance, stage->inputs[channel],
+                                      buffers[channel]);
+      stage->descriptor->connect_port(instance, stage->outputs[channel],
+                                      in_place ? buffers[channel] :
+                                      chain->scratch[channel]);
+    }
+
+    stage->descriptor->run(instance, sample_count);
+
+    if(!in_place)
+      for(channel = 0; channel < chain->channels; channel ++)
+        memcpy(buffers[channel], chain->scratch[channel],
+               sample_count * sizeof(LADSPA_Data));
+  }
+}
+
+/**
+ * Deactivate and activate every stage of a chain again, so it starts
+ * afresh, as just instantiated, without being instantiated again.
+ */
+void host_chain_reset(host_chain_type *chain)
+{
+  const LADSPA_Descriptor *descriptor;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    descriptor = chain->stages[stage].descriptor;
+    if(descriptor->deactivate)
+      descriptor->deactivate(chain->instances[stage]);
+    if(descriptor->activate)
+      descriptor->activate(chain->instances[stage]);
+  }
+}
+
+/**
+ * Deactivate and clean up the stages of a chain.
+ */
+void host_chain_cleanup(host_chain_type *chain)
+{
+  const LADSPA_Descriptor *descriptor;
+  int stage, channel;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    descriptor = chain->stages[stage].descriptor;
+    if(descriptor->deactivate)
+      descriptor->deactivate(chain->instances[stage]);
+    descriptor->cleanup(chain->instances[stage]);
+  }
+  chain->stage_count = 0;
+
+  for(channel = 0; channel < HOST_MAX_CHANNELS; channel ++) {
+    free(chain->scratch[channel]);
+    chain->scratch[channel] = NULL;
+  }
+}
+
+/**
+ * The size of a snapshot of a chain's state, the states of all of its
+ * stages one after the other, or 0 if a stage can't save its state.
+ */
+unsigned long host_chain_state_size(const host_chain_type *chain)
+{
+  unsigned long size = 0;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    if(!chain->stages[stage].state)
+      return 0;
+    size += chain->stages[stage].state->size(chain->instances[stage]);
+  }
+
+  return size;
+}
+
+/**
+ * Save the state of every stage of a chain, between two runs, into a
+ * snapshot of host_chain_state_size() bytes.
+ */
+void host_chain_save(const host_chain_type *chain, void *snapshot)
+{
+  const state_interface_type *state;
+  unsigned char *at = snapshot;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    state = chain->stages[stage].state;
+    state->save(chain->instances[stage], at);
+    at += state->size(chain->instances[stage]);
+  }
+}
+
+/**
+ * Put a chain back in the state of a snapshot, saved from it or from
+ * another chain of the same stages at the same sample rate. The next
+ * run carries on exactly where the chain was when it was saved.
+ */
+void host_chain_restore(host_chain_type *chain, const void *snapshot)
+{
+  const state_interface_type *state;
+  const unsigned char *at = snapshot;
+  int stage;
+
+  for(stage = 0; stage < chain->stage_count; stage ++) {
+    state = chain->stages[stage].state;
+    state->restore(chain->instances[stage], at);
+    at += state->size(chain->instances[stage]);
+  }
+}
+
+/**
+ * Make clone a new chain in the same state as chain, with the same
+ * control values, so that it can go on from there on its own. Returns
+ * 0 and says why if it can't.
+ */
+int host_chain_clone(host_chain_type *clone, const host_chain_type *chain)
+{
+  unsigned long size = host_chain_state_size(chain);
+  void *snapshot;
+
+  if(size == 0) {
+    fprintf(stderr, "a stage of the chain can't save its state\n");
+    return 0;
+  }
+  if(!(snapshot = malloc(size)))
+    return 0;
+  if(!host_chain_instantiate(clone, chain->stages, chain->stage_count,
+                             chain->sample_rate, chain->block_size)) {
+    free(snapshot);
+    return 0;
+  }
+
+  memcpy(clone->controls, chain->controls, sizeof(clone->controls));
+  host_chain_save(chain, snapshot);
+  host_chain_restore(clone, snapshot);
+  free(snapshot);
+
+  return 1;
+}
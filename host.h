@@ -0,0 +1,135 @@
+/*
+ * host.h - What the command-line hosts have in common
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Loading plugins by name, setting their controls and running them in
+ * series, for the tools that host the plugins outside of a real host
+ * (bench, render, ...).
+ *
+ * A stage is one plugin in a chain, given on the command line as
+ *
+ *   library.so:label[:port=value[,port=value]...]
+ *
+ * with its controls at their default values unless they are set
+ * there. A stage has as many audio outputs as inputs, and a chain
+ * runs its stages in place on one buffer per channel, so each stage
+ * must have as many channels as the one before it.
+ *
+ * Some plugins forget: with their controls held still, their output
+ * only depends on a bounded stretch of recent input, their memory.
+ * A fresh instance run over that much input before some point gives
+ * from there on exactly the output of one that ran over everything
+ * before it, so a long file can be rendered in pieces. Filters with
+ * feedback never quite forget, but their impulse responses die out,
+ * and the length of the part that matters is their tail.
+ *
+ * A chain whose plugins all have ladspa_state (see state.h) can also
+ * be saved between two runs and restored later, to carry on from
+ * there without running anything over again, or cloned into a second
+ * chain that goes its own way from the same point.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include "ladspa.h"
+#include "state.h"
+
+#define HOST_MAX_PORTS    256
+#define HOST_MAX_STAGES   16
+#define HOST_MAX_CHANNELS 16
+
+// the memory of a stage whose output can depend on all of its input
+#define HOST_UNBOUNDED ((unsigned long)-1)
+
+// how far down an impulse response has to die out before a chain is
+// taken to have forgotten, and the blocks it is measured in
+#define HOST_TAIL_LEVEL 1e-7
+#define HOST_TAIL_BLOCK 1024
+
+/**
+ * A plugin and the values of its controls.
+ */
+typedef struct {
+  const LADSPA_Descriptor *descriptor;
+  const state_interface_type *state;
+  LADSPA_Data controls[HOST_MAX_PORTS];
+  int channels;
+  unsigned long inputs[HOST_MAX_CHANNELS];
+  unsigned long outputs[HOST_MAX_CHANNELS];
+} host_stage_type;
+
+/**
+ * Running instances of a series of stages. Each instance has its own
+ * copy of the controls, so several chains can run the same stages in
+ * different threads.
+ */
+typedef struct {
+  int stage_count;
+  int channels;
+  const host_stage_type *stages;
+  unsigned long sample_rate;
+  LADSPA_Handle instances[HOST_MAX_STAGES];
+  LADSPA_Data controls[HOST_MAX_STAGES][HOST_MAX_PORTS];
+
+  // where the stages that can't run in place write, to be copied
+  // back to the buffers
+  LADSPA_Data *scratch[HOST_MAX_CHANNELS];
+  unsigned long block_size;
+} host_chain_type;
+
+LADSPA_Data get_default(const LADSPA_PortRangeHint *hint);
+
+const LADSPA_Descriptor *host_find_plugin(const char *library,
+                                          const char *label);
+
+int host_make_stage(host_stage_type *stage,
+                    const LADSPA_Descriptor *descriptor);
+
+int host_load_stage(host_stage_type *stage, const char *spec);
+
+unsigned long host_stage_memory(const host_stage_type *stage,
+                                unsigned long sample_rate);
+
+unsigned long host_chain_tail(const host_stage_type *stages, int stage_count,
+                              unsigned long sample_rate, unsigned long limit);
+
+int host_chain_channels(const host_stage_type *stages, int stage_count);
+
+int host_chain_instantiate(host_chain_type *chain,
+                           const host_stage_type *stages, int stage_count,
+                           unsigned long sample_rate,
+                           unsigned long block_size);
+
+void host_chain_run(host_chain_type *chain, LADSPA_Data **buffers,
+                    unsigned long sample_count);
+
+void host_chain_reset(host_chain_type *chain);
+
+void host_chain_cleanup(host_chain_type *chain);
+
+unsigned long host_chain_state_size(const host_chain_type *chain);
+
+void host_chain_save(const host_chain_type *chain, void *snapshot);
+
+void host_chain_restore(host_chain_type *chain, const void *snapshot);
+
+int host_chain_clone(host_chain_type *clone, const host_chain_type *chain);
+
+#endif
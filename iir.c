@@ -21,311 +21,159 @@
  * A simple 1-pole IIR filter that is both a low pass and a high pass
  * filter. If the coefficient is positive, it is low pass, if it is
  * negative it is high pass. At coef = 0, the signal is unaffected.
+ * It comes in versions for 1, 2, 4, 8 and 16 channels, each channel
+ * with its own coefficient.
  */
 
 #include <stdlib.h>
-#include <math.h>
-#include <string.h>
 
 #include "ladspa.h"
-
-// The port numbers for the plugin
-#define COEF_CONTROL_L 0
-#define INPUT_L        1
-#define OUTPUT_L       2
-
-#define COEF_CONTROL_R 3
-#define INPUT_R        4
-#define OUTPUT_R       5
-
-LADSPA_Descriptor *mono_descriptor = NULL;
-LADSPA_Descriptor *stereo_descriptor = NULL;
+#include "channels.h"
+#include "state.h"
+#include "iir.h"
+
+// The port numbers for each channel of the plugin
+#define COEF_CONTROL      0
+#define INPUT             1
+#define OUTPUT            2
+#define PORTS_PER_CHANNEL 3
+
+// The range of each control, which the host may not keep to
+#define COEF_LOWER        -.99999
+#define COEF_UPPER        .99999
+
+// The ports of each channel, as PORT(name, port descriptor, hint
+// descriptor, lower bound, upper bound)
+#define CHANNEL_PORTS(PORT, suffix)                                         \
+  PORT("Coefficient" suffix, LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,       \
+       LADSPA_HINT_BOUNDED_BELOW                                            \
+       | LADSPA_HINT_BOUNDED_ABOVE                                          \
+       | LADSPA_HINT_DEFAULT_0, COEF_LOWER, COEF_UPPER)                     \
+  PORT("Input" suffix, LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO, 0, 0, 0)      \
+  PORT("Output" suffix, LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO, 0, 0, 0)
 
 /**
  * Structure to hold connections and state.
  */
 typedef struct {
-  LADSPA_Data *coef_control_value_l;
-  LADSPA_Data *input_buffer_l;
-  LADSPA_Data *output_buffer_l;
+  LADSPA_Data *coef_control_value[MAX_CHANNELS];
+  LADSPA_Data *input_buffer[MAX_CHANNELS];
+  LADSPA_Data *output_buffer[MAX_CHANNELS];
+
+  // the variant of the run function picked for this machine
+  tune_run_type kernel;
 
-  LADSPA_Data *coef_control_value_r;
-  LADSPA_Data *input_buffer_r;
-  LADSPA_Data *output_buffer_r;
+  // how much memory the instance takes
+  unsigned long instance_size;
 
-  // a one-sample buffer that holds the value of
-  // the previously output sample
-  LADSPA_Data previous_sample_l;
-  LADSPA_Data previous_sample_r;
+  // everything from here on is the state a snapshot holds (see
+  // state.h)
+  iir_type iir;
 } filter_type;
 
+STATE_INTERFACE(iir);
+
 /**
  * Construct a new plugin instance.
  */
-LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
-                                 unsigned long sample_rate)
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
 {
-  return malloc(sizeof(filter_type));
+  filter_type *filter = malloc(sizeof(filter_type));
+  iir_init(&filter->iir, channels_of(descriptor, PORTS_PER_CHANNEL));
+  filter->kernel = tune_kernel(descriptor, sample_rate);
+  filter->instance_size = sizeof(filter_type);
+
+  return filter;
 }
 
-void activate_filter(LADSPA_Handle instance)
+static void activate_filter(LADSPA_Handle instance)
 {
-  filter_type *filter = (filter_type *)instance;
-  filter->previous_sample_l = 0;
-  filter->previous_sample_r = 0;
+  iir_reset(&((filter_type *)instance)->iir);
 }
 
 /**
  * Connect a port to a data location. 
 */
-void connect_port_to_filter(LADSPA_Handle instance,
-                            unsigned long port,
-                            LADSPA_Data *data_location)
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
 {
   filter_type *filter;
+  int channel = port / PORTS_PER_CHANNEL;
 
   filter = (filter_type *)instance;
-  switch(port) {
-  case COEF_CONTROL_L:
-    filter->coef_control_value_l = data_location;
+  switch(port % PORTS_PER_CHANNEL) {
+  case COEF_CONTROL:
+    filter->coef_control_value[channel] = data_location;
     break;
-  case COEF_CONTROL_R:
-    filter->coef_control_value_r = data_location;
+  case INPUT:
+    filter->input_buffer[channel] = data_location;
     break;
-  case INPUT_L:
-    filter->input_buffer_l = data_location;
-    break;
-  case OUTPUT_L:
-    filter->output_buffer_l = data_location;
-    break;
-  case INPUT_R:
-    filter->input_buffer_r = data_location;
-    break;
-  case OUTPUT_R:
-    filter->output_buffer_r = data_location;
+  case OUTPUT:
+    filter->output_buffer[channel] = data_location;
     break;
   }
 }
 
 /**
- * This is where the action happens.
+ * Run the kernel with the control values the host has set.
  */
-inline void run_filter(LADSPA_Handle instance, unsigned long sample_count,
-                       int stereo)
+static inline __attribute__ ((always_inline))
+void run_filter(LADSPA_Handle instance, unsigned long sample_count,
+                const int channels)
 {
   filter_type *filter = (filter_type *)instance;
-  LADSPA_Data *input_l = filter->input_buffer_l;
-  LADSPA_Data *input_r = stereo ? filter->input_buffer_r : NULL;
-  LADSPA_Data *output_l = filter->output_buffer_l;
-  LADSPA_Data *output_r = stereo ? filter->output_buffer_r : NULL;
-  LADSPA_Data coef_l = *filter->coef_control_value_l;
-  LADSPA_Data coef_r = stereo ? *filter->coef_control_value_r : 0;
-
-  while(sample_count -- > 0) {
-
-    // add the current input sample to the previous output sample,
-    // times a coefficient. normalise so that peak amplitude is always 1.
-    *output_l = *input_l * (1 - fabs(coef_l)) +
-      filter->previous_sample_l * coef_l;
-
-    filter->previous_sample_l = *output_l;
+  kernel_io_type input, output;
+  LADSPA_Data coef[MAX_CHANNELS];
+  int channel;
 
-    if(stereo) {
-      *output_r = *input_r * (1 - fabs(coef_r)) +
-        filter->previous_sample_r * coef_r;
+  for(channel = 0; channel < channels; channel ++)
+    coef[channel] = kernel_clamp(*filter->coef_control_value[channel],
+                                 COEF_LOWER, COEF_UPPER);
 
-      filter->previous_sample_r = *output_r;
-    }      
-
-    input_l ++;
-    output_l ++;
-    if(stereo) {
-      input_r ++;
-      output_r ++;
-    }
-  }
+  kernel_planar(&input, filter->input_buffer);
+  kernel_planar(&output, filter->output_buffer);
+  iir_process(&filter->iir, coef, &input, &output, sample_count, channels);
 }
 
-void run_mono_filter(LADSPA_Handle instance, unsigned long sample_count)
-{
-  run_filter(instance, sample_count, 0);
-}
-
-void run_stereo_filter(LADSPA_Handle instance, unsigned long sample_count)
-{
-  run_filter(instance, sample_count, 1);
-}
+CHANNEL_RUN_FUNCTIONS(run_filter);
 
-void cleanup_filter(LADSPA_Handle instance)
+static void cleanup_filter(LADSPA_Handle instance)
 {
   free(instance);
 }
 
 /**
- * The constructor function is called automatically
- * when the plugin library is first loaded.
- * This is where we build the descriptors that the host
- * will be using.
+ * The descriptors the host will be using, one per channel layout.
+ * They are constant data, so there is nothing to build when the
+ * library is loaded and nothing to free when it is unloaded.
  */
-void __attribute__ ((constructor)) init(void)
-{
-  char **port_names;
-  LADSPA_PortDescriptor *port_descriptors;
-  LADSPA_PortRangeHint *port_range_hints;
-
-  mono_descriptor = (LADSPA_Descriptor *)malloc(sizeof(LADSPA_Descriptor));
-  stereo_descriptor = (LADSPA_Descriptor *)malloc(sizeof(LADSPA_Descriptor));
-
-  if(mono_descriptor) {
-    mono_descriptor->UniqueID = 0x00654323;
-    mono_descriptor->Label = strdup("iir_mono");
-    mono_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
-    mono_descriptor->Name = strdup("One-pole IIR filter (mono)");
-    mono_descriptor->Maker = strdup("Andreas Jansson");
-    mono_descriptor->Copyright = strdup("GPL-3.0");
-    mono_descriptor->PortCount = 3;
-
-    port_descriptors
-      = (LADSPA_PortDescriptor *)calloc(3, sizeof(LADSPA_PortDescriptor));
-    mono_descriptor->PortDescriptors
-      = (const LADSPA_PortDescriptor *)port_descriptors;
-    port_descriptors[COEF_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-
-    port_names = (char **)calloc(3, sizeof(char *));
-    mono_descriptor->PortNames = (const char **)port_names;
-    port_names[COEF_CONTROL_L] = strdup("Coefficient");
-    port_names[INPUT_L] = strdup("Input");
-    port_names[OUTPUT_L] = strdup("Output");
-
-    port_range_hints =
-      ((LADSPA_PortRangeHint *)calloc(3, sizeof(LADSPA_PortRangeHint)));
-    mono_descriptor->PortRangeHints =
-      (const LADSPA_PortRangeHint *)port_range_hints;
-    port_range_hints[COEF_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[COEF_CONTROL_L].LowerBound = -.99999;
-    port_range_hints[COEF_CONTROL_L].UpperBound = .99999;
-    port_range_hints[INPUT_L].HintDescriptor = 0;
-    port_range_hints[OUTPUT_L].HintDescriptor = 0;
-
-    mono_descriptor->instantiate = instantiate_filter;
-    mono_descriptor->connect_port = connect_port_to_filter;
-    mono_descriptor->activate = activate_filter;
-    mono_descriptor->run = run_mono_filter;
-    mono_descriptor->run_adding = NULL;
-    mono_descriptor->set_run_adding_gain = NULL;
-    mono_descriptor->deactivate = NULL;
-    mono_descriptor->cleanup = cleanup_filter;
-  }
-
-  if(stereo_descriptor) {
-    stereo_descriptor->UniqueID = 0x00654324;
-    stereo_descriptor->Label = strdup("iir_stereo");
-    stereo_descriptor->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE;
-    stereo_descriptor->Name = strdup("One-pole IIR filter (stereo)");
-    stereo_descriptor->Maker = strdup("Andreas Jansson");
-    stereo_descriptor->Copyright = strdup("GPL-3.0");
-    stereo_descriptor->PortCount = 6;
-
-    port_descriptors
-      = (LADSPA_PortDescriptor *)calloc(6, sizeof(LADSPA_PortDescriptor));
-    stereo_descriptor->PortDescriptors
-      = (const LADSPA_PortDescriptor *)port_descriptors;
-    port_descriptors[COEF_CONTROL_L] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[INPUT_L] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_L] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[COEF_CONTROL_R] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
-    port_descriptors[INPUT_R] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
-    port_descriptors[OUTPUT_R] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
-
-    port_names = (char **)calloc(6, sizeof(char *));
-    stereo_descriptor->PortNames = (const char **)port_names;
-    port_names[COEF_CONTROL_L] = strdup("Coefficient Left");
-    port_names[INPUT_L] = strdup("Input Left");
-    port_names[OUTPUT_L] = strdup("Output Left");
-    port_names[COEF_CONTROL_R] = strdup("Coefficient Right");
-    port_names[INPUT_R] = strdup("Input Right");
-    port_names[OUTPUT_R] = strdup("Output Right");
-
-    port_range_hints =
-      ((LADSPA_PortRangeHint *)calloc(6, sizeof(LADSPA_PortRangeHint)));
-    stereo_descriptor->PortRangeHints =
-      (const LADSPA_PortRangeHint *)port_range_hints;
-    port_range_hints[COEF_CONTROL_L].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[COEF_CONTROL_L].LowerBound = -.99999;
-    port_range_hints[COEF_CONTROL_L].UpperBound = .99999;
-    port_range_hints[INPUT_L].HintDescriptor = 0;
-    port_range_hints[OUTPUT_L].HintDescriptor = 0;
-    port_range_hints[COEF_CONTROL_R].HintDescriptor =
-      (LADSPA_HINT_BOUNDED_BELOW
-       | LADSPA_HINT_BOUNDED_ABOVE
-       | LADSPA_HINT_DEFAULT_0);
-    port_range_hints[COEF_CONTROL_R].LowerBound = -.99999;
-    port_range_hints[COEF_CONTROL_R].UpperBound = .99999;
-    port_range_hints[INPUT_R].HintDescriptor = 0;
-    port_range_hints[OUTPUT_R].HintDescriptor = 0;
-
-    stereo_descriptor->instantiate = instantiate_filter;
-    stereo_descriptor->connect_port = connect_port_to_filter;
-    stereo_descriptor->activate = activate_filter;
-    stereo_descriptor->run = run_stereo_filter;
-    stereo_descriptor->run_adding = NULL;
-    stereo_descriptor->set_run_adding_gain = NULL;
-    stereo_descriptor->deactivate = NULL;
-    stereo_descriptor->cleanup = cleanup_filter;
-  }
-}
-
-void delete_descriptor(LADSPA_Descriptor *descriptor)
+CHANNEL_DESCRIPTORS("iir", "One-pole IIR filter", NULL,
+                    0x00654323, 0x00654324, 0x0065433A, 0x0065433B,
+                    0x0065433C);
+
+/* Return a descriptor of the requested plugin type. There is one
+   plugin type per channel layout in this library (mono, stereo, 4, 8
+   and 16 channels). */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
 {
-  unsigned long i;
-  if(descriptor) {
-    free((char *)descriptor->Label);
-    free((char *)descriptor->Name);
-    free((char *)descriptor->Maker);
-    free((char *)descriptor->Copyright);
-    free((LADSPA_PortDescriptor *)descriptor->PortDescriptors);
-
-    for(i = 0; i < descriptor->PortCount; i ++)
-      free((char *)(descriptor->PortNames[i]));
-
-    free((char **)descriptor->PortNames);
-    free((LADSPA_PortRangeHint *)descriptor->PortRangeHints);
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  if(index < CHANNEL_LAYOUTS)
+    return descriptors[index];
 
-    free(descriptor);
-  }
+  return NULL;
 }
 
-/**
- * The destructor function is called automatically when
- * the library is unloaded.
- */
-void __attribute__ ((destructor)) fini(void)
+/* Return the state interface of one of this library's descriptors, or
+   null if it is some other library's. */
+__attribute__ ((visibility ("default")))
+const state_interface_type *ladspa_state(const LADSPA_Descriptor *descriptor)
 {
-  delete_descriptor(mono_descriptor);
-  delete_descriptor(stereo_descriptor);
-}
+  if(descriptor->instantiate == instantiate_filter)
+    return &state_interface;
 
-/* Return a descriptor of the requested plugin type. There are two
-   plugin types available in this library (mono and stereo). */
-const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
-{
-  /* Return the requested descriptor or null if the index is out of
-     range. */
-  switch (index) {
-  case 0:
-    return mono_descriptor;
-  case 1:
-    return stereo_descriptor;
-  default:
-    return NULL;
-  }
+  return NULL;
 }
-
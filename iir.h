@@ -0,0 +1,130 @@
+/*
+ * iir.h - The kernel of the one-pole infinite impulse response filter
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filter of iir.c, without LADSPA (see kernel.h). Each channel has
+ * a coefficient between -1 and 1: above 0 the filter is a low pass,
+ * below 0 a high pass, and at 0 the signal is unaffected.
+ */
+
+#ifndef IIR_H
+#define IIR_H
+
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+typedef struct {
+  int channels;
+
+  // a one-sample buffer that holds the value of
+  // the previously output sample
+  LADSPA_Data previous_sample[KERNEL_MAX_CHANNELS];
+
+  // the coefficients, ramped towards the control values
+  smooth_type coef[KERNEL_MAX_CHANNELS];
+} iir_type;
+
+static inline void iir_reset(iir_type *iir)
+{
+  int channel;
+
+  for(channel = 0; channel < iir->channels; channel ++) {
+    iir->previous_sample[channel] = 0;
+    smooth_reset(&iir->coef[channel]);
+  }
+}
+
+/**
+ * Clear the state of one channel, leaving the others be.
+ */
+static inline void iir_reset_channel(iir_type *iir, int channel)
+{
+  iir->previous_sample[channel] = 0;
+  smooth_reset(&iir->coef[channel]);
+}
+
+static inline void iir_init(iir_type *iir, int channels)
+{
+  iir->channels = channels;
+  iir_reset(iir);
+}
+
+/**
+ * Filter sample_count frames of input into output, with each channel's
+ * coefficient ramped to coefficient[channel]. channels must be the
+ * number the filter was set up for.
+ */
+static inline __attribute__ ((always_inline))
+void iir_process(iir_type *iir, const LADSPA_Data *coefficient,
+                 const kernel_io_type *input, const kernel_io_type *output,
+                 unsigned long sample_count, const int channels)
+{
+  LADSPA_Data tile[KERNEL_TILE * KERNEL_MAX_CHANNELS];
+  LADSPA_Data coef[KERNEL_MAX_CHANNELS];
+  LADSPA_Data coef_step[KERNEL_MAX_CHANNELS];
+  LADSPA_Data previous_sample[KERNEL_MAX_CHANNELS];
+  LADSPA_Data *row;
+  unsigned long tile_length, offset, i;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_start(&iir->coef[channel], coefficient[channel], sample_count);
+    coef[channel] = iir->coef[channel].value;
+    coef_step[channel] = iir->coef[channel].step;
+    previous_sample[channel] = iir->previous_sample[channel];
+  }
+
+  for(offset = 0; offset < sample_count; offset += tile_length) {
+    tile_length = sample_count - offset < KERNEL_TILE ?
+      sample_count - offset : KERNEL_TILE;
+
+    kernel_load(tile, input, offset, tile_length, channels);
+
+    for(i = 0; i < tile_length; i ++) {
+      row = tile + i * channels;
+
+      for(channel = 0; channel < channels; channel ++) {
+
+        // the coefficient is cheap to apply, so it follows the
+        // ramp sample by sample.
+        coef[channel] += coef_step[channel];
+
+        // add the current input sample to the previous output sample,
+        // times a coefficient. normalise so that peak amplitude is
+        // always 1.
+        row[channel] = row[channel] * (1 - fabsf(coef[channel])) +
+          previous_sample[channel] * coef[channel];
+
+        previous_sample[channel] = row[channel];
+      }
+    }
+
+    kernel_store(output, tile, offset, tile_length, channels);
+  }
+
+  for(channel = 0; channel < channels; channel ++) {
+    iir->previous_sample[channel] = previous_sample[channel];
+    smooth_end(&iir->coef[channel]);
+  }
+}
+
+#endif
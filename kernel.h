@@ -0,0 +1,156 @@
+/*
+ * kernel.h - What the filter kernels have in common
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filters of fir.h, iir.h, reson.h, comb.h, comb_lopass.h and
+ * plucked_string.h can be used without LADSPA. Each is a struct that
+ * holds its state and a few functions over it, all static inline, so
+ * an engine that includes them has no calls through pointers and the
+ * kernel can be inlined into its own loop. The plugins are thin
+ * wrappers around the same code.
+ *
+ * For a filter called x there is x_type, x_init() to set it up for a
+ * number of channels at a sample rate, x_reset() to clear its state,
+ * as activate() does, x_reset_channel() to clear one channel's, and
+ * x_process() to filter some frames. The filters with a delay line
+ * keep it at the end of x_type, and x_size() says how much memory to
+ * allocate for one. process() takes the control values for each
+ * channel as arrays, and ramps them from the values of the call
+ * before across the frames, like the plugins do between blocks.
+ *
+ * The kernels trust their controls to be in range: a delay or a
+ * frequency outside the range of the plugin's port can make one write
+ * outside its history. The plugins kernel_clamp() what the host gives
+ * them, since a host doesn't have to keep to the ports' hints, and so
+ * do biquad, reson_bank, freeverb and fdn, which aren't built on these
+ * kernels but can blow up or crash on controls out of range too.
+ *
+ * Audio comes and goes through a kernel_io_type, which has a pointer
+ * to each channel's first sample and the distance between samples, so
+ * separate buffers per channel (kernel_planar()), interleaved frames
+ * (kernel_interleaved()) and any other stride all work. Input and
+ * output may be the same memory.
+ *
+ * process() is fastest with its channels argument a constant, since
+ * the loops over channels are then unrolled and vectorised. Internally
+ * the kernels transpose the audio in tiles of KERNEL_TILE rows, with
+ * one sample of every channel per row, so those loops work on
+ * contiguous memory. The kernels only ever read and write the tile,
+ * which is local, so the compiler knows the caller's buffers can't
+ * alias it. And since the inputs of every channel are loaded into the
+ * tile before any outputs are stored from it, they work in place, even
+ * when one channel's output is another channel's input.
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "ladspa.h"
+#include "smooth.h"
+
+#define KERNEL_MAX_CHANNELS 16
+#define KERNEL_TILE         SMOOTH_INTERVAL
+
+/**
+ * Where a kernel reads or writes audio: sample i of channel c is at
+ * channels[c][i * stride]. The array of pointers is the caller's.
+ */
+typedef struct {
+  LADSPA_Data *const *channels;
+  unsigned long stride;
+} kernel_io_type;
+
+/**
+ * Point io at one buffer per channel.
+ */
+static inline void kernel_planar(kernel_io_type *io,
+                                 LADSPA_Data *const *buffers)
+{
+  io->channels = buffers;
+  io->stride = 1;
+}
+
+/**
+ * Point io at one buffer of interleaved frames, through an array of
+ * one pointer per channel that must live as long as io is used.
+ */
+static inline void kernel_interleaved(kernel_io_type *io,
+                                      LADSPA_Data **pointers,
+                                      LADSPA_Data *buffer, int channels)
+{
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++)
+    pointers[channel] = buffer + channel;
+  io->channels = pointers;
+  io->stride = channels;
+}
+
+/**
+ * A control value brought into the range lower to upper. Not a number
+ * is taken to be lower.
+ */
+static inline LADSPA_Data kernel_clamp(LADSPA_Data value, LADSPA_Data lower,
+                                       LADSPA_Data upper)
+{
+  if(value > upper)
+    return upper;
+  if(!(value >= lower))
+    return lower;
+
+  return value;
+}
+
+/**
+ * Transpose tile_length samples of each channel, from offset, into rows
+ * of the tile.
+ */
+static inline void kernel_load(LADSPA_Data *tile, const kernel_io_type *io,
+                               unsigned long offset,
+                               unsigned long tile_length,
+                               const int channels)
+{
+  LADSPA_Data *const *buffers = io->channels;
+  unsigned long stride = io->stride, i;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++)
+    for(i = 0; i < tile_length; i ++)
+      tile[i * channels + channel] = buffers[channel][(offset + i) * stride];
+}
+
+/**
+ * Transpose the rows of the tile back into each channel.
+ */
+static inline void kernel_store(const kernel_io_type *io,
+                                const LADSPA_Data *tile,
+                                unsigned long offset,
+                                unsigned long tile_length,
+                                const int channels)
+{
+  LADSPA_Data *const *buffers = io->channels;
+  unsigned long stride = io->stride, i;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++)
+    for(i = 0; i < tile_length; i ++)
+      buffers[channel][(offset + i) * stride] = tile[i * channels + channel];
+}
+
+#endif
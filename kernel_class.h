@@ -0,0 +1,272 @@
+/*
+ * kernel_class.h - The filter kernels, picked by name at run time
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A table of the kernels of kernel.h, for code that doesn't know
+ * until it runs which one it wants, like the Python module and
+ * streamd. Each entry has the kernel's name, its controls with the
+ * ranges of the plugin's ports, and its functions wrapped to take the
+ * same arguments, with the kernel as a void pointer and the controls
+ * as an array of arrays.
+ *
+ * The kernels trust their controls to be in range (see kernel.h), so
+ * code that takes controls from elsewhere should check them against
+ * kernel_class_upper() and the lower bound, or kernel_class_clamp()
+ * them.
+ */
+
+#ifndef KERNEL_CLASS_H
+#define KERNEL_CLASS_H
+
+#include <string.h>
+
+#include "ladspa.h"
+#include "kernel.h"
+#include "fir.h"
+#include "iir.h"
+#include "reson.h"
+#include "comb.h"
+#include "comb_lopass.h"
+#include "plucked_string.h"
+
+#define KERNEL_CLASS_MAX_CONTROLS 2
+
+/**
+ * A control of a kernel, with the range of the plugin's port. The
+ * upper bound of a frequency is at most half the sample rate.
+ */
+typedef struct {
+  char *name;
+  LADSPA_Data lower;
+  LADSPA_Data upper;
+  int frequency;
+} kernel_control_type;
+
+typedef struct {
+  const char *name;
+  int control_count;
+  kernel_control_type controls[KERNEL_CLASS_MAX_CONTROLS];
+  unsigned long (*size)(unsigned long sample_rate, int channels);
+  void (*init)(void *kernel, unsigned long sample_rate, int channels);
+  void (*reset)(void *kernel);
+  void (*reset_channel)(void *kernel, int channel);
+  void (*process)(void *kernel, LADSPA_Data *const *controls,
+                  const kernel_io_type *input, const kernel_io_type *output,
+                  unsigned long sample_count, int channels);
+} kernel_class_type;
+
+/**
+ * Define kernel_class_process_<kind>(), which calls <kind>_process()
+ * with the controls given after kind. The layouts the plugins have get
+ * the number of channels as a constant, so their loops are unrolled
+ * and vectorised the same way.
+ */
+#define KERNEL_CLASS_LAYOUT(kind, layout, ...)                          \
+  case layout:                                                          \
+    kind##_process(kernel, __VA_ARGS__, input, output, sample_count,    \
+                   layout);                                             \
+    break;
+
+#define KERNEL_CLASS_PROCESS(kind, ...)                                 \
+  static void kernel_class_process_##kind(void *kernel,                 \
+                                          LADSPA_Data *const *controls, \
+                                          const kernel_io_type *input,  \
+                                          const kernel_io_type *output, \
+                                          unsigned long sample_count,   \
+                                          int channels)                 \
+  {                                                                     \
+    switch(channels) {                                                  \
+    KERNEL_CLASS_LAYOUT(kind, 1, __VA_ARGS__)                           \
+    KERNEL_CLASS_LAYOUT(kind, 2, __VA_ARGS__)                           \
+    KERNEL_CLASS_LAYOUT(kind, 4, __VA_ARGS__)                           \
+    KERNEL_CLASS_LAYOUT(kind, 8, __VA_ARGS__)                           \
+    KERNEL_CLASS_LAYOUT(kind, 16, __VA_ARGS__)                          \
+    default:                                                            \
+      kind##_process(kernel, __VA_ARGS__, input, output, sample_count,  \
+                     channels);                                         \
+    }                                                                   \
+  }
+
+/**
+ * Define kernel_class_reset_<kind>() and
+ * kernel_class_reset_channel_<kind>().
+ */
+#define KERNEL_CLASS_RESET(kind)                                        \
+  static void kernel_class_reset_##kind(void *kernel)                   \
+  {                                                                     \
+    kind##_reset(kernel);                                               \
+  }                                                                     \
+                                                                        \
+  static void kernel_class_reset_channel_##kind(void *kernel,           \
+                                                int channel)            \
+  {                                                                     \
+    kind##_reset_channel(kernel, channel);                              \
+  }
+
+KERNEL_CLASS_PROCESS(fir, controls[0], controls[1]);
+KERNEL_CLASS_PROCESS(iir, controls[0]);
+KERNEL_CLASS_PROCESS(reson, controls[0], controls[1]);
+KERNEL_CLASS_PROCESS(comb, controls[0], controls[1]);
+KERNEL_CLASS_PROCESS(comb_lopass, controls[0], controls[1]);
+KERNEL_CLASS_PROCESS(plucked_string, controls[0], controls[1]);
+
+KERNEL_CLASS_RESET(fir);
+KERNEL_CLASS_RESET(iir);
+KERNEL_CLASS_RESET(reson);
+KERNEL_CLASS_RESET(comb);
+KERNEL_CLASS_RESET(comb_lopass);
+KERNEL_CLASS_RESET(plucked_string);
+
+static unsigned long kernel_class_size_fir(unsigned long sample_rate,
+                                           int channels)
+{
+  return fir_size(sample_rate, channels);
+}
+
+static unsigned long kernel_class_size_iir(unsigned long sample_rate,
+                                           int channels)
+{
+  return sizeof(iir_type);
+}
+
+static unsigned long kernel_class_size_reson(unsigned long sample_rate,
+                                             int channels)
+{
+  return sizeof(reson_type);
+}
+
+static unsigned long kernel_class_size_comb(unsigned long sample_rate,
+                                            int channels)
+{
+  return comb_size(channels);
+}
+
+static unsigned long kernel_class_size_comb_lopass(unsigned long sample_rate,
+                                                   int channels)
+{
+  return comb_lopass_size(channels);
+}
+
+static unsigned long
+kernel_class_size_plucked_string(unsigned long sample_rate, int channels)
+{
+  return plucked_string_size(sample_rate, channels);
+}
+
+static void kernel_class_init_fir(void *kernel, unsigned long sample_rate,
+                                  int channels)
+{
+  fir_init(kernel, sample_rate, channels);
+}
+
+static void kernel_class_init_iir(void *kernel, unsigned long sample_rate,
+                                  int channels)
+{
+  iir_init(kernel, channels);
+}
+
+static void kernel_class_init_reson(void *kernel, unsigned long sample_rate,
+                                    int channels)
+{
+  reson_init(kernel, sample_rate, channels);
+}
+
+static void kernel_class_init_comb(void *kernel, unsigned long sample_rate,
+                                   int channels)
+{
+  comb_init(kernel, channels);
+}
+
+static void kernel_class_init_comb_lopass(void *kernel,
+                                          unsigned long sample_rate,
+                                          int channels)
+{
+  comb_lopass_init(kernel, channels);
+}
+
+static void kernel_class_init_plucked_string(void *kernel,
+                                             unsigned long sample_rate,
+                                             int channels)
+{
+  plucked_string_init(kernel, sample_rate, channels);
+}
+
+#define KERNEL_CLASS(kind, count, ...)                                  \
+  { #kind, count, { __VA_ARGS__ }, kernel_class_size_##kind,            \
+    kernel_class_init_##kind, kernel_class_reset_##kind,                \
+    kernel_class_reset_channel_##kind, kernel_class_process_##kind }
+
+static const kernel_class_type kernel_classes[] = {
+  KERNEL_CLASS(fir, 2,
+               { "frequency", 20, 20000, 1 }, { "dry_wet", 0, 1, 0 }),
+  KERNEL_CLASS(iir, 1, { "coefficient", -.99999, .99999, 0 }),
+  KERNEL_CLASS(reson, 2,
+               { "frequency", 20, 20000, 1 }, { "bandwidth", 1, 20000, 0 }),
+  KERNEL_CLASS(comb, 2,
+               { "delay", 1, COMB_MAX_DELAY, 0 }, { "sharpness", .5, 1, 0 }),
+  KERNEL_CLASS(comb_lopass, 2,
+               { "delay", 1, COMB_LOPASS_MAX_DELAY, 0 },
+               { "sharpness", .5, 1, 0 }),
+  KERNEL_CLASS(plucked_string, 2,
+               { "frequency", PLUCKED_STRING_MIN_FREQ,
+                 PLUCKED_STRING_MAX_FREQ, 1 },
+               { "sharpness", .5, 1, 0 }),
+};
+
+#define KERNEL_CLASSES (sizeof(kernel_classes) / sizeof(*kernel_classes))
+
+/**
+ * The kernel with a name, or null if there is none.
+ */
+static inline const kernel_class_type *kernel_class_find(const char *name)
+{
+  unsigned int i;
+
+  for(i = 0; i < KERNEL_CLASSES; i ++)
+    if(!strcmp(kernel_classes[i].name, name))
+      return &kernel_classes[i];
+
+  return NULL;
+}
+
+/**
+ * The upper bound of a control at a sample rate.
+ */
+static inline double kernel_class_upper(const kernel_control_type *control,
+                                        unsigned long sample_rate)
+{
+  if(control->frequency && control->upper > sample_rate / 2.)
+    return sample_rate / 2.;
+
+  return control->upper;
+}
+
+/**
+ * A value brought into the range of a control. Not a number is taken
+ * to be the lower bound.
+ */
+static inline LADSPA_Data
+kernel_class_clamp(const kernel_control_type *control,
+                   unsigned long sample_rate, LADSPA_Data value)
+{
+  return kernel_clamp(value, control->lower,
+                      kernel_class_upper(control, sample_rate));
+}
+
+#endif
@@ -0,0 +1,435 @@
+/*
+ * my_ladspa.c - The filter kernels as a Python module
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A CPython extension with the kernels of kernel.h as classes, Fir,
+ * Iir, Reson, Comb, CombLopass and PluckedString:
+ *
+ *   import my_ladspa
+ *   reson = my_ladspa.Reson(44100, channels=2)
+ *   reson.process(clip, 1000, [50, 200])
+ *
+ * process() filters a C-contiguous float32 buffer, anything with the
+ * buffer protocol, in place or into out=, without copying it. A
+ * two-dimensional buffer, such as a numpy array, has one channel per
+ * row (channels x samples), and a one-dimensional one holds
+ * interleaved frames. Each control is either one number for all
+ * channels or a sequence with one per channel, and is ramped from its
+ * value in the call before, like the plugins do between blocks, so a
+ * long clip can be filtered a piece at a time. It must be within the
+ * range of the plugin's port. reset() clears the state, as activate()
+ * does.
+ *
+ * The GIL is released while the kernel runs, so threads that filter
+ * clips with instances of their own run in parallel. An instance
+ * can't be used by two threads at once: the second one gets a
+ * RuntimeError.
+ *
+ * The module is built with the same flags as the scalar variant of
+ * the plugins (see autotune.h), and gives exactly the same output.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ladspa.h"
+#include "kernel_class.h"
+
+/**
+ * An instance of one of the classes.
+ */
+typedef struct {
+  PyObject_HEAD
+  const kernel_class_type *class;
+  unsigned long sample_rate;
+  int channels;
+
+  // set while a thread runs the kernel without the GIL
+  int busy;
+
+  void *kernel;
+} filter_type;
+
+// the names of the classes, in the same order as kernel_classes
+static const char *class_names[KERNEL_CLASSES] = {
+  "Fir", "Iir", "Reson", "Comb", "CombLopass", "PluckedString"
+};
+
+static PyTypeObject filter_types[KERNEL_CLASSES];
+
+static PyObject *filter_new(PyTypeObject *type, PyObject *args,
+                            PyObject *keywords)
+{
+  static char *keyword_list[] = {"sample_rate", "channels", NULL};
+  unsigned long sample_rate;
+  int channels = 1;
+  filter_type *filter;
+
+  if(!PyArg_ParseTupleAndKeywords(args, keywords, "k|i", keyword_list,
+                                  &sample_rate, &channels))
+    return NULL;
+
+  if(sample_rate == 0) {
+    PyErr_SetString(PyExc_ValueError, "the sample rate must be positive");
+    return NULL;
+  }
+  if(channels < 1 || channels > KERNEL_MAX_CHANNELS) {
+    PyErr_Format(PyExc_ValueError, "channels must be between 1 and %d",
+                 KERNEL_MAX_CHANNELS);
+    return NULL;
+  }
+
+  filter = (filter_type *)type->tp_alloc(type, 0);
+  if(!filter)
+    return NULL;
+
+  filter->class = &kernel_classes[type - filter_types];
+  filter->sample_rate = sample_rate;
+  filter->channels = channels;
+  filter->busy = 0;
+  filter->kernel = malloc(filter->class->size(sample_rate, channels));
+  if(!filter->kernel) {
+    Py_DECREF(filter);
+    return PyErr_NoMemory();
+  }
+  filter->class->init(filter->kernel, sample_rate, channels);
+
+  return (PyObject *)filter;
+}
+
+static void filter_dealloc(filter_type *filter)
+{
+  free(filter->kernel);
+  Py_TYPE(filter)->tp_free((PyObject *)filter);
+}
+
+/**
+ * Raise a RuntimeError if another thread is running the filter.
+ */
+static int check_idle(filter_type *filter)
+{
+  if(filter->busy) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "the filter is in use by another thread");
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Read a control, a number or a sequence of one number per channel,
+ * into values.
+ */
+static int parse_control(filter_type *filter,
+                         const kernel_control_type *control,
+                         PyObject *object, LADSPA_Data *values)
+{
+  double upper = kernel_class_upper(control, filter->sample_rate), value;
+  char message[80];
+  PyObject *sequence;
+  int channel;
+
+  value = PyFloat_AsDouble(object);
+  if(value == -1 && PyErr_Occurred()) {
+    if(!PyErr_ExceptionMatches(PyExc_TypeError))
+      return 0;
+    PyErr_Clear();
+
+    sequence = PySequence_Fast(object, "");
+    if(!sequence || PySequence_Fast_GET_SIZE(sequence) != filter->channels) {
+      PyErr_Clear();
+      Py_XDECREF(sequence);
+      PyErr_Format(PyExc_TypeError,
+                   "%s must be a number or a sequence of %d numbers",
+                   control->name, filter->channels);
+      return 0;
+    }
+
+    for(channel = 0; channel < filter->channels; channel ++) {
+      values[channel] =
+        PyFloat_AsDouble(PySequence_Fast_GET_ITEM(sequence, channel));
+      if(values[channel] == -1 && PyErr_Occurred()) {
+        Py_DECREF(sequence);
+        return 0;
+      }
+    }
+    Py_DECREF(sequence);
+  }
+  else
+    for(channel = 0; channel < filter->channels; channel ++)
+      values[channel] = value;
+
+  // a value out of range could make the kernel write outside its
+  // history, which a host is trusted not to do but Python isn't
+  for(channel = 0; channel < filter->channels; channel ++)
+    if(!(values[channel] >= control->lower && values[channel] <= upper)) {
+      snprintf(message, sizeof(message), "%s must be between %g and %g",
+               control->name, control->lower, upper);
+      PyErr_SetString(PyExc_ValueError, message);
+      return 0;
+    }
+
+  return 1;
+}
+
+/**
+ * Get a C-contiguous float32 buffer from object, with a row per
+ * channel or interleaved frames, and point io at it.
+ */
+static int get_buffer(filter_type *filter, PyObject *object, int writable,
+                      Py_buffer *view, kernel_io_type *io,
+                      LADSPA_Data **pointers, unsigned long *frames)
+{
+  const char *format;
+  int channel;
+
+  if(PyObject_GetBuffer(object, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+                        (writable ? PyBUF_WRITABLE : 0)))
+    return 0;
+
+  format = view->format;
+  if(strchr("@=<", *format))
+    format ++;
+  if(view->itemsize != sizeof(LADSPA_Data) || strcmp(format, "f")) {
+    PyErr_SetString(PyExc_TypeError, "the buffer must be float32");
+    PyBuffer_Release(view);
+    return 0;
+  }
+
+  if(view->ndim == 2 && view->shape[0] == filter->channels) {
+    *frames = view->shape[1];
+    for(channel = 0; channel < filter->channels; channel ++)
+      pointers[channel] = (LADSPA_Data *)view->buf + channel * *frames;
+    kernel_planar(io, pointers);
+  }
+  else if(view->ndim == 1 && view->shape[0] % filter->channels == 0) {
+    *frames = view->shape[0] / filter->channels;
+    kernel_interleaved(io, pointers, view->buf, filter->channels);
+  }
+  else {
+    PyErr_Format(PyExc_ValueError,
+                 "the buffer must have %d rows, or whole frames of %d "
+                 "interleaved samples", filter->channels, filter->channels);
+    PyBuffer_Release(view);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Filter a buffer, with the filter marked busy. Anything that reads
+ * the controls or the buffers can run Python code, which can let
+ * another thread in.
+ */
+static PyObject *run_process(filter_type *filter, PyObject *buffer,
+                             PyObject *const *objects, PyObject *out)
+{
+  const kernel_class_type *class = filter->class;
+  LADSPA_Data values[KERNEL_CLASS_MAX_CONTROLS][KERNEL_MAX_CHANNELS];
+  LADSPA_Data *controls[KERNEL_CLASS_MAX_CONTROLS];
+  LADSPA_Data *input_pointers[KERNEL_MAX_CHANNELS];
+  LADSPA_Data *output_pointers[KERNEL_MAX_CHANNELS];
+  kernel_io_type input, output;
+  Py_buffer input_view, output_view;
+  unsigned long frames, output_frames;
+  int k;
+
+  for(k = 0; k < class->control_count; k ++) {
+    if(!parse_control(filter, &class->controls[k], objects[k], values[k]))
+      return NULL;
+    controls[k] = values[k];
+  }
+
+  if(out == Py_None)
+    out = NULL;
+  if(!get_buffer(filter, buffer, out == NULL, &input_view, &input,
+                 input_pointers, &frames))
+    return NULL;
+  if(out) {
+    if(!get_buffer(filter, out, 1, &output_view, &output, output_pointers,
+                   &output_frames)) {
+      PyBuffer_Release(&input_view);
+      return NULL;
+    }
+    if(output_view.ndim != input_view.ndim || output_frames != frames) {
+      PyErr_SetString(PyExc_ValueError,
+                      "out must have the same shape as the buffer");
+      PyBuffer_Release(&output_view);
+      PyBuffer_Release(&input_view);
+      return NULL;
+    }
+  }
+  else
+    output = input;
+
+  // the views keep the buffers from being resized or freed meanwhile
+  Py_BEGIN_ALLOW_THREADS
+  class->process(filter->kernel, controls, &input, &output, frames,
+                 filter->channels);
+  Py_END_ALLOW_THREADS
+
+  if(out)
+    PyBuffer_Release(&output_view);
+  PyBuffer_Release(&input_view);
+
+  out = out ? out : buffer;
+  Py_INCREF(out);
+  return out;
+}
+
+static PyObject *filter_process(filter_type *filter, PyObject *args,
+                                PyObject *keywords)
+{
+  const kernel_class_type *class = filter->class;
+  char *keyword_list[KERNEL_CLASS_MAX_CONTROLS + 3];
+  PyObject *buffer, *out = NULL, *objects[KERNEL_CLASS_MAX_CONTROLS];
+  PyObject *result;
+  int parsed, k;
+
+  keyword_list[0] = "buffer";
+  for(k = 0; k < class->control_count; k ++)
+    keyword_list[k + 1] = class->controls[k].name;
+  keyword_list[k + 1] = "out";
+  keyword_list[k + 2] = NULL;
+
+  if(class->control_count == 1)
+    parsed = PyArg_ParseTupleAndKeywords(args, keywords, "OO|$O:process",
+                                         keyword_list, &buffer,
+                                         &objects[0], &out);
+  else
+    parsed = PyArg_ParseTupleAndKeywords(args, keywords, "OOO|$O:process",
+                                         keyword_list, &buffer,
+                                         &objects[0], &objects[1], &out);
+
+  // the check and the mark happen under the GIL, with no Python code
+  // in between, so only one thread can get past them
+  if(!parsed || !check_idle(filter))
+    return NULL;
+  filter->busy = 1;
+  result = run_process(filter, buffer, objects, out);
+  filter->busy = 0;
+
+  return result;
+}
+
+static PyObject *filter_reset(filter_type *filter, PyObject *unused)
+{
+  if(!check_idle(filter))
+    return NULL;
+
+  filter->class->reset(filter->kernel);
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef filter_methods[] = {
+  {"process", (PyCFunction)(void (*)(void))filter_process,
+   METH_VARARGS | METH_KEYWORDS,
+   "process(buffer, *controls, out=None)\n\n"
+   "Filter a float32 buffer of channels x samples, or of interleaved\n"
+   "frames, in place or into out, and return the output. Each control\n"
+   "is a number or a sequence with one per channel."},
+  {"reset", (PyCFunction)filter_reset, METH_NOARGS,
+   "Clear the state, as if the filter were new."},
+  {NULL}
+};
+
+static PyMemberDef filter_members[] = {
+  {"sample_rate", T_ULONG, offsetof(filter_type, sample_rate), READONLY,
+   NULL},
+  {"channels", T_INT, offsetof(filter_type, channels), READONLY, NULL},
+  {NULL}
+};
+
+static struct PyModuleDef module = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "my_ladspa",
+  .m_doc = "The filters of my_ladspa_plugins, without LADSPA.",
+  .m_size = -1,
+};
+
+/**
+ * Set up the type of each class, the first time the module is
+ * imported.
+ */
+static int ready_types(void)
+{
+  static char names[KERNEL_CLASSES][32];
+  PyTypeObject *type;
+  unsigned int i;
+
+  for(i = 0; i < KERNEL_CLASSES; i ++) {
+    type = &filter_types[i];
+    if(type->tp_name)
+      continue;
+
+    snprintf(names[i], sizeof(names[i]), "my_ladspa.%s", class_names[i]);
+    Py_SET_TYPE(type, &PyType_Type);
+    Py_SET_REFCNT(type, 1);
+    type->tp_name = names[i];
+    type->tp_basicsize = sizeof(filter_type);
+    type->tp_flags = Py_TPFLAGS_DEFAULT;
+    type->tp_doc = "(sample_rate, channels=1)\n\n"
+      "A filter of my_ladspa_plugins, for 1 to 16 channels.";
+    type->tp_new = filter_new;
+    type->tp_dealloc = (destructor)filter_dealloc;
+    type->tp_methods = filter_methods;
+    type->tp_members = filter_members;
+    if(PyType_Ready(type))
+      return 0;
+  }
+
+  return 1;
+}
+
+PyMODINIT_FUNC PyInit_my_ladspa(void)
+{
+  PyObject *python_module;
+  unsigned int i;
+
+  if(!ready_types())
+    return NULL;
+
+  python_module = PyModule_Create(&module);
+  if(!python_module)
+    return NULL;
+
+  for(i = 0; i < KERNEL_CLASSES; i ++) {
+    Py_INCREF(&filter_types[i]);
+    if(PyModule_AddObject(python_module, class_names[i],
+                          (PyObject *)&filter_types[i])) {
+      Py_DECREF(&filter_types[i]);
+      Py_DECREF(python_module);
+      return NULL;
+    }
+  }
+
+  if(PyModule_AddIntConstant(python_module, "MAX_CHANNELS",
+                             KERNEL_MAX_CHANNELS)) {
+    Py_DECREF(python_module);
+    return NULL;
+  }
+
+  return python_module;
+}
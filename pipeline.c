@@ -0,0 +1,276 @@
+/*
+ * pipeline.c - Run the stages of a chain on their own cores
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "pipeline.h"
+
+// how many times a thread looks at an empty ring before it yields,
+// when it has a core to itself
+#define PIPELINE_SPINS 1000
+
+double pipeline_seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Add a block to a ring. There are never more blocks than the ring
+ * has room for, so it never has to wait.
+ */
+static void ring_push(pipeline_ring_type *ring, pipeline_block_type *block)
+{
+  unsigned long head = atomic_load_explicit(&ring->head,
+                                            memory_order_relaxed);
+
+  ring->blocks[head % PIPELINE_RING] = block;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Take the oldest block off a ring, waiting for one if it's empty.
+ */
+static pipeline_block_type *ring_pop(pipeline_ring_type *ring, int spins)
+{
+  unsigned long tail = atomic_load_explicit(&ring->tail,
+                                            memory_order_relaxed);
+  pipeline_block_type *block;
+
+  while(atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+    if(spins -- > 0) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    else
+      sched_yield();
+  }
+
+  block = ring->blocks[tail % PIPELINE_RING];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return block;
+}
+
+static void ring_init(pipeline_ring_type *ring)
+{
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+}
+
+/**
+ * A stage's thread: run the stage on each block from the ring before
+ * it and pass the block on, until the stop marker (the block past the
+ * last of depth) comes along. Empty blocks are passed on as they are.
+ */
+static void *run_stage(void *data)
+{
+  pipeline_stage_type *stage = (pipeline_stage_type *)data;
+  pipeline_type *pipeline = stage->pipeline;
+  pipeline_ring_type *in = &pipeline->rings[stage->index];
+  pipeline_ring_type *out = &pipeline->rings[stage->index + 1];
+  pipeline_block_type *marker = &pipeline->blocks[pipeline->depth];
+  pipeline_block_type *block;
+  cpu_set_t cpus;
+  double start;
+
+  if(stage->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(stage->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  while((block = ring_pop(in, pipeline->spins)) != marker) {
+    if(block->sample_count > 0) {
+      start = pipeline_seconds();
+      host_chain_run(&stage->chain, block->buffers, block->sample_count);
+      stage->busy += pipeline_seconds() - start;
+    }
+    ring_push(out, block);
+  }
+  ring_push(out, block);
+
+  return NULL;
+}
+
+static void free_blocks(pipeline_type *pipeline)
+{
+  int block;
+
+  for(block = 0; block <= pipeline->depth; block ++)
+    free(pipeline->blocks[block].buffers[0]);
+}
+
+/**
+ * Start a thread for each stage, with depth blocks of up to block_size
+ * samples between them. Stage n is pinned to core first_cpu + n
+ * (wrapping around), or left to the scheduler if first_cpu is
+ * negative. Returns 0 and says why if it can't.
+ */
+int pipeline_start(pipeline_type *pipeline, const host_stage_type *stages,
+                   int stage_count, unsigned long sample_rate,
+                   unsigned long block_size, int depth, int first_cpu)
+{
+  pipeline_block_type *block;
+  LADSPA_Data *buffer;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, channel, error;
+
+  memset(pipeline, 0, sizeof(pipeline_type));
+  if(depth < 1 || depth > PIPELINE_MAX_DEPTH ||
+     stage_count > HOST_MAX_STAGES) {
+    fprintf(stderr, "pipeline: depth must be 1 to %d, and at most %d "
+            "stages\n", PIPELINE_MAX_DEPTH, HOST_MAX_STAGES);
+    return 0;
+  }
+  if(!(pipeline->channels = host_chain_channels(stages, stage_count)))
+    return 0;
+  pipeline->stage_count = stage_count;
+  pipeline->depth = depth;
+  pipeline->spins = stage_count < cpus ? PIPELINE_SPINS : 0;
+  pipeline->block_size = block_size;
+
+  for(i = 0; i <= stage_count; i ++)
+    ring_init(&pipeline->rings[i]);
+  ring_init(&pipeline->free);
+
+  // the extra block is the stop marker
+  for(i = 0; i <= depth; i ++) {
+    block = &pipeline->blocks[i];
+    if(posix_memalign((void **)&buffer, 64, pipeline->channels * block_size *
+                      sizeof(LADSPA_Data))) {
+      pipeline->depth = i - 1;
+      free_blocks(pipeline);
+      return 0;
+    }
+    for(channel = 0; channel < pipeline->channels; channel ++)
+      block->buffers[channel] = buffer + channel * block_size;
+    if(i < depth)
+      ring_push(&pipeline->free, block);
+  }
+
+  for(i = 0; i < stage_count; i ++)
+    if(!host_chain_instantiate(&pipeline->stages[i].chain, stages + i, 1,
+                               sample_rate, block_size)) {
+      while(i -- > 0)
+        host_chain_cleanup(&pipeline->stages[i].chain);
+      free_blocks(pipeline);
+      return 0;
+    }
+
+  for(i = 0; i < stage_count; i ++) {
+    pipeline->stages[i].pipeline = pipeline;
+    pipeline->stages[i].index = i;
+    pipeline->stages[i].cpu = first_cpu < 0 ? -1 : (first_cpu + i) % cpus;
+    if((error = pthread_create(&pipeline->stages[i].thread, NULL,
+                               run_stage, &pipeline->stages[i]))) {
+      fprintf(stderr, "pipeline: can't start a stage: %s\n",
+              strerror(error));
+      // the marker stops the stages that did start, and waits in
+      // front of the first one that didn't
+      ring_push(&pipeline->rings[0], &pipeline->blocks[depth]);
+      while(i -- > 0)
+        pthread_join(pipeline->stages[i].thread, NULL);
+      for(i = 0; i < stage_count; i ++)
+        host_chain_cleanup(&pipeline->stages[i].chain);
+      free_blocks(pipeline);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Copy sample_count samples (at most block_size) of each channel into
+ * a free block and send it down the pipeline. Waits until a block is
+ * free, and a block is only free again once it has been pulled, so a
+ * caller that pushes and pulls in the same thread must pull before it
+ * pushes more than depth blocks ahead. An empty block goes through
+ * without running the stages.
+ */
+void pipeline_push(pipeline_type *pipeline, LADSPA_Data **buffers,
+                   unsigned long sample_count)
+{
+  pipeline_block_type *block = ring_pop(&pipeline->free, pipeline->spins);
+  int channel;
+
+  for(channel = 0; channel < pipeline->channels; channel ++)
+    memcpy(block->buffers[channel], buffers[channel],
+           sample_count * sizeof(LADSPA_Data));
+  block->sample_count = sample_count;
+  block->pushed = pipeline_seconds();
+  ring_push(&pipeline->rings[0], block);
+}
+
+/**
+ * Copy the oldest processed block into buffers, waiting for it if it
+ * isn't done yet, and return its sample count.
+ */
+unsigned long pipeline_pull(pipeline_type *pipeline, LADSPA_Data **buffers)
+{
+  pipeline_block_type *block =
+    ring_pop(&pipeline->rings[pipeline->stage_count], pipeline->spins);
+  unsigned long sample_count = block->sample_count;
+  double latency = pipeline_seconds() - block->pushed;
+  int channel;
+
+  for(channel = 0; channel < pipeline->channels; channel ++)
+    memcpy(buffers[channel], block->buffers[channel],
+           sample_count * sizeof(LADSPA_Data));
+
+  pipeline->latency += latency;
+  if(latency > pipeline->max_latency)
+    pipeline->max_latency = latency;
+  pipeline->pulled ++;
+
+  ring_push(&pipeline->free, block);
+  return sample_count;
+}
+
+/**
+ * Stop the threads, dropping any blocks that weren't pulled, and clean
+ * up the stages.
+ */
+void pipeline_stop(pipeline_type *pipeline)
+{
+  pipeline_block_type *marker = &pipeline->blocks[pipeline->depth];
+  int i;
+
+  ring_push(&pipeline->rings[0], marker);
+  while(ring_pop(&pipeline->rings[pipeline->stage_count], 0) != marker)
+    ;
+
+  for(i = 0; i < pipeline->stage_count; i ++) {
+    pthread_join(pipeline->stages[i].thread, NULL);
+    host_chain_cleanup(&pipeline->stages[i].chain);
+  }
+  free_blocks(pipeline);
+}
@@ -0,0 +1,118 @@
+/*
+ * pipeline.h - Run the stages of a chain on their own cores
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A chain (see host.h) with each stage on a thread of its own, pinned
+ * to its own core, so a chain that is too slow for one core can use
+ * several. The stages pass blocks along single-producer,
+ * single-consumer rings: the caller pushes a block into the first
+ * stage and pulls processed blocks out of the last one, and the
+ * stages work on different blocks at the same time.
+ *
+ * There are depth blocks in all, so at most depth blocks are in
+ * flight. With depth at least the number of stages, every stage can
+ * be busy at once. The price is latency: a host that pushes a block
+ * and then pulls one gets its output depth - 1 blocks late.
+ *
+ * Neither push nor pull takes a lock. A thread that finds its ring
+ * empty yields its core until it isn't. If there are enough cores
+ * for every stage and the caller, it spins for a while first.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ladspa.h"
+#include "host.h"
+
+// a ring holds all the blocks and a stop marker, so pushes never wait
+#define PIPELINE_MAX_DEPTH 63
+#define PIPELINE_RING      64
+
+/**
+ * A block of samples, one buffer per channel, and when it was pushed.
+ */
+typedef struct {
+  LADSPA_Data *buffers[HOST_MAX_CHANNELS];
+  unsigned long sample_count;
+  double pushed;
+} pipeline_block_type;
+
+/**
+ * A single-producer, single-consumer ring of blocks. head is only
+ * written by the producer and tail by the consumer, each on its own
+ * cache line.
+ */
+typedef struct {
+  _Alignas(64) atomic_ulong head;
+  _Alignas(64) atomic_ulong tail;
+  pipeline_block_type *blocks[PIPELINE_RING];
+} pipeline_ring_type;
+
+typedef struct pipeline_type pipeline_type;
+
+/**
+ * A stage, its thread and how long it was busy.
+ */
+typedef struct {
+  pipeline_type *pipeline;
+  int index;
+  int cpu;
+  pthread_t thread;
+  host_chain_type chain;
+  double busy;
+} pipeline_stage_type;
+
+struct pipeline_type {
+  int stage_count;
+  int channels;
+  int depth;
+  int spins;
+  unsigned long block_size;
+
+  // ring n feeds stage n, ring stage_count holds the processed
+  // blocks, and the free ring takes them back to the caller
+  pipeline_ring_type rings[HOST_MAX_STAGES + 1];
+  pipeline_ring_type free;
+  pipeline_block_type blocks[PIPELINE_MAX_DEPTH + 1];
+  pipeline_stage_type stages[HOST_MAX_STAGES];
+
+  // how long blocks took from push to pull, in seconds
+  double latency;
+  double max_latency;
+  unsigned long pulled;
+};
+
+int pipeline_start(pipeline_type *pipeline, const host_stage_type *stages,
+                   int stage_count, unsigned long sample_rate,
+                   unsigned long block_size, int depth, int first_cpu);
+
+void pipeline_push(pipeline_type *pipeline, LADSPA_Data **buffers,
+                   unsigned long sample_count);
+
+unsigned long pipeline_pull(pipeline_type *pipeline, LADSPA_Data **buffers);
+
+void pipeline_stop(pipeline_type *pipeline);
+
+double pipeline_seconds(void);
+
+#endif
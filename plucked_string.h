@@ -0,0 +1,266 @@
+/*
+ * plucked_string.h - The kernel of the plucked string filter
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filter of plucked_string.c, without LADSPA (see kernel.h): a
+ * comb, an allpass and a low pass that together ring like a string.
+ * Each channel has the frequency of its string, from
+ * PLUCKED_STRING_MIN_FREQ to PLUCKED_STRING_MAX_FREQ, and how long it
+ * rings, its sharpness, from .5 to 1.
+ *
+ * The delay line is as long as the lowest string needs, and is
+ * allocated with the filter:
+ *
+ *   plucked_string_type *string =
+ *     malloc(plucked_string_size(sample_rate, channels));
+ *   plucked_string_init(string, sample_rate, channels);
+ */
+
+#ifndef PLUCKED_STRING_H
+#define PLUCKED_STRING_H
+
+#include <string.h>
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define PLUCKED_STRING_MIN_FREQ 20
+#define PLUCKED_STRING_MAX_FREQ 20000
+
+typedef struct {
+  unsigned long sample_rate;
+  int channels;
+
+  // how many rows the history has
+  unsigned long history_length;
+
+  unsigned long history_position;
+
+  // one previous sample is kept for the low-pass filter
+  LADSPA_Data previous_v[KERNEL_MAX_CHANNELS];
+  LADSPA_Data previous_w[KERNEL_MAX_CHANNELS];
+
+  // the control values, ramped across each block, and the
+  // coefficients interpolated between them
+  smooth_type freq[KERNEL_MAX_CHANNELS];
+  smooth_type sharp[KERNEL_MAX_CHANNELS];
+  LADSPA_Data a[KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain[KERNEL_MAX_CHANNELS];
+
+  // The history array is a circular buffer used to
+  // keep track of old samples. It holds one row of
+  // samples per position, one sample per channel.
+  LADSPA_Data history[];
+} plucked_string_type;
+
+/**
+ * How many bytes a filter takes, with its history.
+ */
+static inline unsigned long plucked_string_size(unsigned long sample_rate,
+                                                int channels)
+{
+  return sizeof(plucked_string_type) +
+    sample_rate / PLUCKED_STRING_MIN_FREQ * channels * sizeof(LADSPA_Data);
+}
+
+static inline void plucked_string_reset(plucked_string_type *string)
+{
+  int channel;
+
+  string->history_position = 0;
+  memset(string->history, 0, string->history_length * string->channels *
+         sizeof(LADSPA_Data));
+
+  for(channel = 0; channel < string->channels; channel ++) {
+    string->previous_v[channel] = 0;
+    string->previous_w[channel] = 0;
+    smooth_reset(&string->freq[channel]);
+    smooth_reset(&string->sharp[channel]);
+  }
+}
+
+/**
+ * Clear the state of one channel, its column of the history and all,
+ * leaving the others be.
+ */
+static inline void plucked_string_reset_channel(plucked_string_type *string,
+                                                int channel)
+{
+  unsigned long position;
+
+  for(position = 0; position < string->history_length; position ++)
+    string->history[position * string->channels + channel] = 0;
+
+  string->previous_v[channel] = 0;
+  string->previous_w[channel] = 0;
+  smooth_reset(&string->freq[channel]);
+  smooth_reset(&string->sharp[channel]);
+}
+
+/**
+ * Set up a filter in plucked_string_size(sample_rate, channels) bytes.
+ */
+static inline void plucked_string_init(plucked_string_type *string,
+                                       unsigned long sample_rate,
+                                       int channels)
+{
+  string->sample_rate = sample_rate;
+  string->channels = channels;
+  string->history_length = sample_rate / PLUCKED_STRING_MIN_FREQ;
+  plucked_string_reset(string);
+}
+
+/**
+ * Compute the integer loop delay and the allpass coefficient that
+ * together tune the string to the given frequency.
+ */
+static inline void plucked_string_tuning(unsigned int frequency,
+                                         unsigned long sample_rate,
+                                         int *loop_delay, float *a)
+{
+  float delay, phase_delay, freq_rad;
+
+  freq_rad = 2 * M_PI * frequency / sample_rate;
+  delay = (float)sample_rate / frequency;
+  *loop_delay = floor(delay - .5);
+  phase_delay = delay - (*loop_delay + .5);
+  *a = (sin(1 - phase_delay) * freq_rad / 2) /
+    (sin(1 + phase_delay) * freq_rad / 2);
+}
+
+/**
+ * Filter sample_count frames of input into output, with each channel's
+ * controls ramped to frequency[channel] and sharpness[channel].
+ * channels must be the number the filter was set up for.
+ */
+static inline __attribute__ ((always_inline))
+void plucked_string_process(plucked_string_type *string,
+                            const LADSPA_Data *frequency,
+                            const LADSPA_Data *sharpness,
+                            const kernel_io_type *input,
+                            const kernel_io_type *output,
+                            unsigned long sample_count, const int channels)
+{
+  LADSPA_Data tile[KERNEL_TILE * KERNEL_MAX_CHANNELS];
+  LADSPA_Data a[KERNEL_MAX_CHANNELS];
+  LADSPA_Data a_step[KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain[KERNEL_MAX_CHANNELS];
+  LADSPA_Data gain_step[KERNEL_MAX_CHANNELS];
+  LADSPA_Data previous_v[KERNEL_MAX_CHANNELS];
+  LADSPA_Data previous_w[KERNEL_MAX_CHANNELS];
+  int loop_delay[KERNEL_MAX_CHANNELS];
+  LADSPA_Data *history = string->history;
+  LADSPA_Data *delayed;
+  unsigned long history_position = string->history_position;
+  unsigned long history_length = string->history_length;
+  unsigned long segment_length, offset, position, i;
+  LADSPA_Data *row;
+  LADSPA_Data w, v;
+  float a_target;
+  int channel;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_start(&string->sharp[channel], sharpness[channel], sample_count);
+    if(smooth_start(&string->freq[channel], frequency[channel],
+                    sample_count)) {
+      plucked_string_tuning((unsigned int)string->freq[channel].value,
+                            string->sample_rate, &loop_delay[channel],
+                            &string->a[channel]);
+      string->gain[channel] = pow(string->sharp[channel].value,
+                                  loop_delay[channel]);
+    }
+    a[channel] = string->a[channel];
+    gain[channel] = string->gain[channel];
+    previous_v[channel] = string->previous_v[channel];
+    previous_w[channel] = string->previous_w[channel];
+  }
+
+  for(offset = 0; offset < sample_count; offset += segment_length) {
+
+    segment_length = smooth_segment(sample_count - offset);
+
+    // the tuning is recomputed from the ramped frequency once per
+    // segment. the loop delay is a whole number of samples and steps,
+    // while the allpass coefficient and the feedback gain are
+    // interpolated up to their values at the end of the segment.
+    for(channel = 0; channel < channels; channel ++) {
+      plucked_string_tuning((unsigned int)
+                            smooth_advance(&string->freq[channel],
+                                           segment_length),
+                            string->sample_rate, &loop_delay[channel],
+                            &a_target);
+      a_step[channel] = (a_target - a[channel]) / segment_length;
+      gain_step[channel] =
+        (pow(smooth_advance(&string->sharp[channel], segment_length),
+             loop_delay[channel]) - gain[channel]) / segment_length;
+    }
+
+    kernel_load(tile, input, offset, segment_length, channels);
+
+    for(i = 0; i < segment_length; i ++) {
+      row = tile + i * channels;
+      delayed = history + history_position * channels;
+
+      for(channel = 0; channel < channels; channel ++) {
+        a[channel] += a_step[channel];
+        gain[channel] += gain_step[channel];
+
+        w = row[channel] * (1 - gain[channel]) +
+          gain[channel] * delayed[channel];
+
+        v = a[channel] * w + previous_w[channel] -
+          a[channel] * previous_v[channel];
+
+        row[channel] = (v + previous_v[channel]) / 2;
+
+        previous_v[channel] = v;
+        previous_w[channel] = w;
+      }
+
+      // add the current output sample <delay> steps ahead in the history
+      // buffer. this is the way we maintain the delay.
+      for(channel = 0; channel < channels; channel ++) {
+        position = history_position + loop_delay[channel];
+        if(position >= history_length)
+          position -= history_length;
+        history[position * channels + channel] = row[channel];
+      }
+
+      if(++ history_position == history_length)
+        history_position = 0;
+    }
+
+    kernel_store(output, tile, offset, segment_length, channels);
+  }
+
+  string->history_position = history_position;
+
+  for(channel = 0; channel < channels; channel ++) {
+    string->a[channel] = a[channel];
+    string->gain[channel] = gain[channel];
+    string->previous_v[channel] = previous_v[channel];
+    string->previous_w[channel] = previous_w[channel];
+    smooth_end(&string->freq[channel]);
+    smooth_end(&string->sharp[channel]);
+  }
+}
+
+#endif
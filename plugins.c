@@ -0,0 +1,115 @@
+/*
+ * plugins.c - All of the plugins in a single library
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The combined library (make combined) links every plugin into one
+ * shared object, so a host scanning its plugin directory only has to
+ * open one file. Each plugin is compiled with its ladspa_descriptor
+ * renamed to <plugin>_descriptor, and the ladspa_descriptor here runs
+ * through all descriptors of the first plugin, then all of the second,
+ * and so on. Labels and UniqueIDs are the plugins' own, so the
+ * combined library must not be installed next to the separate ones.
+ * ladspa_state asks each plugin that has one whether a descriptor is
+ * its own.
+ */
+
+#include <stdlib.h>
+
+#include "ladspa.h"
+#include "state.h"
+
+// keep in the same order as PLUGINS in the Makefile
+const LADSPA_Descriptor *fir_descriptor(unsigned long index);
+const LADSPA_Descriptor *iir_descriptor(unsigned long index);
+const LADSPA_Descriptor *reson_descriptor(unsigned long index);
+const LADSPA_Descriptor *comb_descriptor(unsigned long index);
+const LADSPA_Descriptor *comb_lopass_descriptor(unsigned long index);
+const LADSPA_Descriptor *plucked_string_descriptor(unsigned long index);
+const LADSPA_Descriptor *reson_bank_descriptor(unsigned long index);
+const LADSPA_Descriptor *biquad_descriptor(unsigned long index);
+const LADSPA_Descriptor *freeverb_descriptor(unsigned long index);
+const LADSPA_Descriptor *fdn_descriptor(unsigned long index);
+const LADSPA_Descriptor *chain_descriptor(unsigned long index);
+
+static const LADSPA_Descriptor_Function plugins[] = {
+  fir_descriptor,
+  iir_descriptor,
+  reson_descriptor,
+  comb_descriptor,
+  comb_lopass_descriptor,
+  plucked_string_descriptor,
+  reson_bank_descriptor,
+  biquad_descriptor,
+  freeverb_descriptor,
+  fdn_descriptor,
+  chain_descriptor
+};
+
+#define PLUGIN_COUNT (sizeof(plugins) / sizeof(plugins[0]))
+
+const state_interface_type *fir_state(const LADSPA_Descriptor *descriptor);
+const state_interface_type *iir_state(const LADSPA_Descriptor *descriptor);
+const state_interface_type *reson_state(const LADSPA_Descriptor *descriptor);
+const state_interface_type *comb_state(const LADSPA_Descriptor *descriptor);
+const state_interface_type *
+comb_lopass_state(const LADSPA_Descriptor *descriptor);
+const state_interface_type *
+plucked_string_state(const LADSPA_Descriptor *descriptor);
+
+static const state_function_type states[] = {
+  fir_state,
+  iir_state,
+  reson_state,
+  comb_state,
+  comb_lopass_state,
+  plucked_string_state
+};
+
+#define STATE_COUNT (sizeof(states) / sizeof(states[0]))
+
+/* Return a descriptor of the requested plugin type. The indices of
+   each plugin's descriptors follow on from the previous plugin's. */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  const LADSPA_Descriptor *descriptor;
+  unsigned long plugin, i;
+
+  for(plugin = 0; plugin < PLUGIN_COUNT; plugin ++)
+    for(i = 0; (descriptor = plugins[plugin](i)); i ++)
+      if(index -- == 0)
+        return descriptor;
+
+  return NULL;
+}
+
+/* Return the state interface of a descriptor, or null if its plugin
+   can't save its state. */
+__attribute__ ((visibility ("default")))
+const state_interface_type *ladspa_state(const LADSPA_Descriptor *descriptor)
+{
+  const state_interface_type *state;
+  unsigned long plugin;
+
+  for(plugin = 0; plugin < STATE_COUNT; plugin ++)
+    if((state = states[plugin](descriptor)))
+      return state;
+
+  return NULL;
+}
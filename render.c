@@ -0,0 +1,622 @@
+/*
+ * render.c - Render audio files through a chain of plugins
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Runs audio files through a chain of plugins (see host.h for how the
+ * stages are given) and writes the results, with the same names, to
+ * another directory. The files are shared out between -j threads, one
+ * per core by default, so a directory of stems renders in about the
+ * time of the longest ones.
+ *
+ * A file is either WAV (16, 24 or 32 bit integer, or 32 bit float) or
+ * raw interleaved 32 bit floats, in which case -c and -r give its
+ * channels and sample rate. The output is 32 bit float in the same
+ * kind of file. A file can have more channels than the chain, as long
+ * as it has a multiple of them: a mono chain renders each channel of
+ * a stereo file with its own instance of the chain.
+ *
+ * If every plugin in the chain forgets (see host.h), a file is cut into
+ * pieces of -k seconds, 30 by default, that are rendered in parallel.
+ * Each piece is run in from as far before it as the chain remembers,
+ * so the result is exactly what rendering the file in one go would
+ * give, and one long file through fir renders on every core.
+ *
+ * The input is mapped rather than read, with the kernel told to read
+ * ahead of where the chain is and to drop what it is done with. The
+ * output is collected in a large page-aligned buffer and written in
+ * a few big writes, each piece to its own place in the file.
+ *
+ * With -z, each file goes through the chain forwards and then
+ * backwards, like filtfilt, so the response is the square of the
+ * chain's magnitude response with no phase shift at all: iir and reson
+ * without the delay they add to the signal. The output file is mapped,
+ * the forward pass is written straight into it and the backward pass
+ * works back through it a block at a time, reversing each block, so
+ * neither pass holds more than a block in memory. Each lane (each
+ * channel, with a mono chain) is its own piece, on its own thread.
+ * Unlike scipy's filtfilt, the ends aren't padded.
+ *
+ * The chain's tail, how long its impulse response takes to die away
+ * below HOST_TAIL_LEVEL (see host_chain_tail), decides how zero phase
+ * pieces are cut. With -k 0 every lane is one piece and the result is
+ * exact. Otherwise a lane is also cut into -k second pieces, each run
+ * in from a tail before it and, backwards, from a tail after it. That
+ * differs from the exact result by what's left of the impulse response
+ * after the tail, but mostly by rounding, since each piece starts from
+ * a different state; a narrow resonance amplifies the difference, and
+ * no longer tail makes it smaller (see the README).
+ *
+ *   render -o directory [-j threads] [-b block_size] [-k seconds] [-z]
+ *          [-r sample_rate] [-c channels]
+ *          -p library.so:label[:port=value,...]... file...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "audio.h"
+
+#define MAX_FILE_CHANNELS 64
+#define OUTPUT_BUFFER     (1 << 20)
+#define PAGE_ALIGNMENT    4096
+#define READAHEAD         (4 << 20)
+#define TAIL_LIMIT        60
+
+/**
+ * A file being rendered, and how many of its pieces are left.
+ */
+typedef struct {
+  const char *path;
+  char output_path[4096];
+  audio_input_type input;
+  int output;
+  size_t header;
+  unsigned long memory;
+  unsigned long tail;
+  unsigned char *output_map;
+  size_t output_size;
+  int pieces_left;
+  int failed;
+} file_type;
+
+/**
+ * A stretch of a file for one thread to render, in every lane or, when
+ * zero phase, in one.
+ */
+typedef struct {
+  file_type *file;
+  unsigned long first;
+  unsigned long last;
+  int lane;
+} piece_type;
+
+unsigned long block_size = 1024;
+unsigned long raw_sample_rate = 48000;
+int raw_channels = 1;
+double piece_seconds = 30;
+int zero_phase = 0;
+const char *output_directory = NULL;
+
+host_stage_type stages[HOST_MAX_STAGES];
+int stage_count = 0;
+int chain_channels;
+
+// the pieces of all the files, and the next one a thread should take
+file_type *files;
+int file_count;
+piece_type *pieces;
+int piece_count = 0;
+int next_piece = 0;
+int failed = 0;
+double rendered_seconds = 0;
+pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Get a file ready to render: map its input, and create its output at
+ * full size with its header. Returns 0 and says why if it can't.
+ */
+int open_file(file_type *file, const char *path)
+{
+  struct stat input_status, output_status;
+  unsigned char header[AUDIO_WAV_HEADER];
+  const char *name = strrchr(path, '/');
+  unsigned long memory;
+  int stage;
+
+  memset(file, 0, sizeof(file_type));
+  file->path = path;
+  file->output = -1;
+  if(!audio_open(&file->input, path, raw_sample_rate, raw_channels))
+    return 0;
+
+  if(file->input.channels > MAX_FILE_CHANNELS ||
+     file->input.channels % chain_channels != 0) {
+    fprintf(stderr, "%s: %d channels, the chain has %d\n", path,
+            file->input.channels, chain_channels);
+    audio_close(&file->input);
+    return 0;
+  }
+
+  // the chain's memory is the sum of its stages', if they all forget
+  for(stage = 0; stage < stage_count; stage ++) {
+    memory = host_stage_memory(&stages[stage], file->input.sample_rate);
+    file->memory = memory == HOST_UNBOUNDED ? memory : file->memory + memory;
+    if(memory == HOST_UNBOUNDED)
+      break;
+  }
+
+  // where the output goes: the file's name in the output directory
+  snprintf(file->output_path, sizeof(file->output_path), "%s/%s",
+           output_directory, name ? name + 1 : path);
+  stat(path, &input_status);
+  if(stat(file->output_path, &output_status) == 0 &&
+     output_status.st_dev == input_status.st_dev &&
+     output_status.st_ino == input_status.st_ino) {
+    fprintf(stderr, "%s: would overwrite its input\n", file->output_path);
+    audio_close(&file->input);
+    return 0;
+  }
+
+  file->header = file->input.wav ? AUDIO_WAV_HEADER : 0;
+  if(file->input.wav)
+    audio_wav_header(header, file->input.channels, file->input.sample_rate,
+                     file->input.frames);
+  file->output_size = file->header + file->input.frames *
+    file->input.channels * sizeof(float);
+  if((file->output = open(file->output_path, O_RDWR | O_CREAT | O_TRUNC,
+                          0666)) < 0 ||
+     ftruncate(file->output, file->output_size) < 0 ||
+     !audio_write_all(file->output, header, file->header, 0))
+    goto failed;
+
+  // zero phase passes work on the output in place
+  if(zero_phase) {
+    file->tail = host_chain_tail(stages, stage_count,
+                                 file->input.sample_rate,
+                                 TAIL_LIMIT * file->input.sample_rate);
+    if(file->tail == 0 && file->input.frames > 0)
+      goto failed;
+    if(file->input.frames > 0 &&
+       (file->output_map = mmap(NULL, file->output_size,
+                                PROT_READ | PROT_WRITE, MAP_SHARED,
+                                file->output, 0)) == MAP_FAILED)
+      goto failed;
+  }
+
+  return 1;
+
+failed:
+  perror(file->output_path);
+  if(file->output >= 0)
+    close(file->output);
+  audio_close(&file->input);
+  return 0;
+}
+
+/**
+ * Render a piece of a file. A piece that doesn't start at the
+ * beginning is preceded by as much of the file as the chain
+ * remembers, rendered by fresh instances with the output thrown
+ * away, so its output is exactly what rendering the whole file would
+ * have given. Returns 0 and says why if it can't.
+ */
+int render_piece(const piece_type *piece)
+{
+  host_chain_type chains[MAX_FILE_CHANNELS];
+  LADSPA_Data *buffers[MAX_FILE_CHANNELS];
+  file_type *file = piece->file;
+  audio_input_type *input = &file->input;
+  unsigned char *output;
+  size_t output_size, used = 0, done_bytes, readahead, window;
+  off_t offset;
+  unsigned long start, frame, count, i;
+  int lanes = 0, lane, channel, ok = 0, channels_ready = 0;
+
+  start = piece->first > file->memory ? piece->first - file->memory : 0;
+  offset = file->header + piece->first * input->channels * sizeof(float);
+
+  // room for at least one block, in whole pages
+  output_size = block_size * input->channels * sizeof(float);
+  if(output_size < OUTPUT_BUFFER)
+    output_size = OUTPUT_BUFFER;
+  output_size = (output_size + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT *
+    PAGE_ALIGNMENT;
+  if(posix_memalign((void **)&output, PAGE_ALIGNMENT, output_size))
+    return 0;
+
+  for(channel = 0; channel < input->channels; channel ++, channels_ready ++)
+    if(!(buffers[channel] = malloc(block_size * sizeof(LADSPA_Data))))
+      goto done;
+  for(lanes = 0; lanes < input->channels / chain_channels; lanes ++)
+    if(!host_chain_instantiate(&chains[lanes], stages, stage_count,
+                               input->sample_rate, block_size))
+      goto done;
+
+  // the window of the input the kernel is asked to read next, in whole
+  // pages
+  window = ((input->samples - input->map) +
+            start * input->channels * input->bytes) / PAGE_ALIGNMENT *
+    PAGE_ALIGNMENT;
+  readahead = window;
+
+  for(frame = start; frame < piece->last; frame += count) {
+    count = piece->last - frame < block_size ?
+      piece->last - frame : block_size;
+    if(frame < piece->first && frame + count > piece->first)
+      count = piece->first - frame;
+
+    // keep the kernel reading ahead of the chain, and let it drop
+    // the pages the chain is done with
+    done_bytes = (input->samples - input->map) +
+      frame * input->channels * input->bytes;
+    if(done_bytes + READAHEAD / 2 >= readahead &&
+       readahead < input->map_size) {
+      madvise(input->map + readahead,
+              input->map_size - readahead < READAHEAD ?
+              input->map_size - readahead : READAHEAD, MADV_WILLNEED);
+      if(readahead >= window + 2 * READAHEAD)
+        madvise(input->map + readahead - 2 * READAHEAD, READAHEAD,
+                MADV_DONTNEED);
+      readahead += READAHEAD;
+    }
+
+    audio_read_frames(input, frame, count, 0, input->channels, buffers);
+    for(lane = 0; lane < lanes; lane ++)
+      host_chain_run(&chains[lane], buffers + lane * chain_channels, count);
+    if(frame < piece->first)
+      continue;
+
+    if(used + count * input->channels * sizeof(float) > output_size) {
+      if(!audio_write_all(file->output, output, used, offset))
+        break;
+      offset += used;
+      used = 0;
+    }
+    for(i = 0; i < count; i ++)
+      for(channel = 0; channel < input->channels; channel ++) {
+        memcpy(output + used, &buffers[channel][i], sizeof(float));
+        used += sizeof(float);
+      }
+  }
+
+  ok = frame >= piece->last &&
+    audio_write_all(file->output, output, used, offset);
+  if(!ok)
+    perror(file->output_path);
+
+done:
+  while(lanes -- > 0)
+    host_chain_cleanup(&chains[lanes]);
+  for(channel = 0; channel < channels_ready; channel ++)
+    free(buffers[channel]);
+  free(output);
+
+  return ok;
+}
+
+/**
+ * Render a piece of one lane of a file forwards and then backwards.
+ * The forward pass runs from a tail before the piece to a tail after
+ * it, with fresh instances; what it gives for the piece goes straight
+ * into the output, and what it gives after the piece is kept to run
+ * the backward pass in from. The backward pass, with fresh instances
+ * again, then runs back through that and the piece, reversing each
+ * block on its way in and out. Returns 0 and says why if it can't.
+ */
+int render_zero_phase(const piece_type *piece)
+{
+  host_chain_type chain;
+  LADSPA_Data *buffers[HOST_MAX_CHANNELS];
+  file_type *file = piece->file;
+  audio_input_type *input = &file->input;
+  float *output = (float *)(file->output_map + file->header);
+  LADSPA_Data *after = NULL;
+  unsigned long start, end, frame, count, frames, i, at;
+  int first_channel = piece->lane * chain_channels, channel, ok = 0;
+  int channels_ready = 0, instantiated = 0;
+
+  start = piece->first > file->tail ? piece->first - file->tail : 0;
+  end = input->frames - piece->last > file->tail ?
+    piece->last + file->tail : input->frames;
+  frames = end - piece->last;
+
+  for(channel = 0; channel < chain_channels; channel ++, channels_ready ++)
+    if(!(buffers[channel] = malloc(block_size * sizeof(LADSPA_Data))))
+      goto done;
+  if(frames > 0 &&
+     !(after = malloc(frames * chain_channels * sizeof(LADSPA_Data))))
+    goto done;
+
+  // forwards, with each block either before, in or after the piece
+  if(!(instantiated = host_chain_instantiate(&chain, stages, stage_count,
+                                             input->sample_rate,
+                                             block_size)))
+    goto done;
+  for(frame = start; frame < end; frame += count) {
+    count = end - frame < block_size ? end - frame : block_size;
+    if(frame < piece->first && frame + count > piece->first)
+      count = piece->first - frame;
+    if(frame < piece->last && frame + count > piece->last)
+      count = piece->last - frame;
+
+    audio_read_frames(input, frame, count, first_channel, chain_channels,
+                      buffers);
+    host_chain_run(&chain, buffers, count);
+    if(frame < piece->first)
+      continue;
+
+    for(channel = 0; channel < chain_channels; channel ++)
+      for(i = 0; i < count; i ++) {
+        if(frame >= piece->last)
+          after[channel * frames + frame - piece->last + i] =
+            buffers[channel][i];
+        else
+          output[(frame + i) * input->channels + first_channel + channel] =
+            buffers[channel][i];
+      }
+  }
+  host_chain_cleanup(&chain);
+
+  // and backwards, from the end of what the forward pass gave
+  if(!(instantiated = host_chain_instantiate(&chain, stages, stage_count,
+                                             input->sample_rate,
+                                             block_size)))
+    goto done;
+  for(frame = end; frame > piece->first; frame -= count) {
+    count = frame - piece->first < block_size ?
+      frame - piece->first : block_size;
+    if(frame > piece->last && frame - count < piece->last)
+      count = frame - piece->last;
+
+    for(channel = 0; channel < chain_channels; channel ++)
+      for(i = 0; i < count; i ++) {
+        at = frame - 1 - i;
+        buffers[channel][i] = at >= piece->last ?
+          after[channel * frames + at - piece->last] :
+          output[at * input->channels + first_channel + channel];
+      }
+    host_chain_run(&chain, buffers, count);
+    if(frame > piece->last)
+      continue;
+
+    for(channel = 0; channel < chain_channels; channel ++)
+      for(i = 0; i < count; i ++)
+        output[(frame - 1 - i) * input->channels + first_channel + channel] =
+          buffers[channel][i];
+  }
+  ok = 1;
+
+done:
+  if(instantiated)
+    host_chain_cleanup(&chain);
+  else
+    fprintf(stderr, "%s: couldn't render\n", file->output_path);
+  for(channel = 0; channel < channels_ready; channel ++)
+    free(buffers[channel]);
+  free(after);
+
+  return ok;
+}
+
+/**
+ * Take pieces off the list and render them until there are none left,
+ * closing each file when its last piece is done.
+ */
+void *render_pieces(void *data)
+{
+  piece_type *piece;
+  file_type *file;
+  int ok;
+
+  while(1) {
+    pthread_mutex_lock(&files_lock);
+    piece = next_piece < piece_count ? &pieces[next_piece ++] : NULL;
+    pthread_mutex_unlock(&files_lock);
+    if(!piece)
+      break;
+
+    ok = zero_phase ? render_zero_phase(piece) : render_piece(piece);
+
+    file = piece->file;
+    pthread_mutex_lock(&files_lock);
+    file->failed |= !ok;
+    if(-- file->pieces_left == 0) {
+      if(file->output_map)
+        munmap(file->output_map, file->output_size);
+      if(close(file->output) < 0) {
+        perror(file->output_path);
+        file->failed = 1;
+      }
+      audio_close(&file->input);
+      if(file->failed)
+        failed ++;
+      else
+        rendered_seconds += (double)file->input.frames /
+          file->input.sample_rate;
+    }
+    pthread_mutex_unlock(&files_lock);
+  }
+
+  return NULL;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s -o directory [-j threads] [-b block_size] "
+          "[-k seconds] [-z] [-r sample_rate] [-c channels]\n"
+          "       -p library.so:label[:port=value,...]... file...\n", name);
+  exit(1);
+}
+
+/**
+ * How long the pieces of a file are: the whole file unless the chain
+ * forgets or it's rendered zero phase, and then piece_seconds.
+ */
+unsigned long piece_frames(const file_type *file)
+{
+  unsigned long frames = piece_seconds * file->input.sample_rate;
+
+  if((file->memory == HOST_UNBOUNDED && !zero_phase) || piece_seconds <= 0)
+    return file->input.frames;
+
+  return frames > 0 ? frames : 1;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t threads[256];
+  struct timespec start, end;
+  file_type *file;
+  double elapsed;
+  long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long frames, first;
+  int option, i, lane, lanes, opened = 0;
+
+  while((option = getopt(argc, argv, "o:j:b:k:zr:c:p:")) != -1) {
+    switch(option) {
+    case 'o':
+      output_directory = optarg;
+      break;
+    case 'j':
+      thread_count = atol(optarg);
+      break;
+    case 'b':
+      block_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'k':
+      piece_seconds = atof(optarg);
+      break;
+    case 'z':
+      zero_phase = 1;
+      break;
+    case 'r':
+      raw_sample_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      raw_channels = atoi(optarg);
+      break;
+    case 'p':
+      if(stage_count == HOST_MAX_STAGES)
+        usage(argv[0]);
+      if(!host_load_stage(&stages[stage_count ++], optarg))
+        return 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  file_count = argc - optind;
+  if(!output_directory || stage_count == 0 || file_count == 0 ||
+     block_size == 0 || raw_sample_rate == 0 || raw_channels < 1 ||
+     raw_channels > MAX_FILE_CHANNELS)
+    usage(argv[0]);
+  if(!(chain_channels = host_chain_channels(stages, stage_count)))
+    return 1;
+
+  if(mkdir(output_directory, 0777) < 0 && errno != EEXIST) {
+    perror(output_directory);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // open every file, and cut them into pieces, zero phase ones in each
+  // lane
+  if(!(files = malloc(file_count * sizeof(file_type)))) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for(i = 0; i < file_count; i ++) {
+    if(!open_file(&files[opened], argv[optind + i])) {
+      failed ++;
+      continue;
+    }
+    file = &files[opened ++];
+    frames = piece_frames(file);
+    lanes = zero_phase ? file->input.channels / chain_channels : 1;
+    file->pieces_left = lanes * (file->input.frames > frames ?
+                                 (file->input.frames + frames - 1) / frames :
+                                 1);
+    piece_count += file->pieces_left;
+  }
+  if(!(pieces = malloc(piece_count * sizeof(piece_type))) && piece_count) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  piece_count = 0;
+  for(i = 0; i < opened; i ++) {
+    file = &files[i];
+    frames = piece_frames(file);
+    lanes = zero_phase ? file->input.channels / chain_channels : 1;
+    for(lane = 0; lane < lanes; lane ++) {
+      first = 0;
+      do {
+        pieces[piece_count].file = file;
+        pieces[piece_count].lane = lane;
+        pieces[piece_count].first = first;
+        first = file->input.frames - first > frames ?
+          first + frames : file->input.frames;
+        pieces[piece_count ++].last = first;
+      } while(first < file->input.frames);
+    }
+  }
+
+  if(thread_count < 1)
+    thread_count = 1;
+  if(thread_count > piece_count)
+    thread_count = piece_count ? piece_count : 1;
+  if(thread_count > (long)(sizeof(threads) / sizeof(threads[0])))
+    thread_count = sizeof(threads) / sizeof(threads[0]);
+
+  // the threads share out the pieces, so any that started can do the
+  // work of those that didn't
+  for(i = 1; i < thread_count; i ++)
+    if(pthread_create(&threads[i], NULL, render_pieces, NULL)) {
+      fprintf(stderr, "couldn't start %ld threads, rendering on %d\n",
+              thread_count, i);
+      thread_count = i;
+      break;
+    }
+  render_pieces(NULL);
+  for(i = 1; i < thread_count; i ++)
+    pthread_join(threads[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%d files in %d pieces, %.1f s of audio in %.2f s on %ld threads, "
+         "%.0fx real time\n", file_count - failed, piece_count,
+         rendered_seconds, elapsed, thread_count, rendered_seconds / elapsed);
+
+  free(pieces);
+  free(files);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,501 @@
+/*
+ * replay.c - Run a captured trace again and time it
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Runs a trace that capture.so recorded (see trace.h) again, against
+ * the library it was recorded from or, with -l, another build of the
+ * same plugins. Every instance is made, connected, activated and run
+ * just as the host did, with the same block sizes, automation, input
+ * and floating point mode, so a slow stretch of a real session can be
+ * timed over and over.
+ *
+ * The trace is mapped before anything runs, and only the calls to
+ * run() are timed. For each plugin it prints the time per sample of
+ * the fastest of -n passes, the slowest block in that pass, and how
+ * many blocks didn't give exactly the output that was recorded. It
+ * exits with 1 if any didn't, so it can check a new build for
+ * regressions too.
+ *
+ *   replay [-n passes] [-l library.so] trace
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "ladspa.h"
+#include "host.h"
+#include "trace.h"
+
+#define MAX_PLUGINS 256
+
+/**
+ * A plugin in the trace, and how its runs went.
+ */
+typedef struct {
+  char label[256];
+  const LADSPA_Descriptor *descriptor;
+  unsigned long runs;
+  unsigned long samples;
+  unsigned long mismatches;
+  double seconds;
+  double worst;
+  double best_seconds;
+  double best_worst;
+} plugin_type;
+
+/**
+ * An instance the trace made, and the state of its ports.
+ */
+typedef struct {
+  plugin_type *plugin;
+  LADSPA_Handle handle;
+  unsigned long port_count;
+  LADSPA_Data *controls;
+  uint16_t *layout;
+} instance_type;
+
+const unsigned char *trace;
+size_t trace_size;
+size_t records_start;
+char *library;
+
+plugin_type plugins[MAX_PLUGINS];
+int plugin_count;
+instance_type *instances;
+unsigned long instance_count;
+
+// room for every buffer of the largest block of the plugin with the
+// most ports, and one more for audio ports the host left unconnected
+LADSPA_Data *pool;
+unsigned long pool_samples;
+unsigned long pool_buffers;
+
+double replay_seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void set_fp_control(uint32_t control)
+{
+#if defined(__SSE__)
+  if(control && control != _mm_getcsr())
+    _mm_setcsr(control);
+#endif
+}
+
+/**
+ * The plugin with a label, found in the library the first time. Exits
+ * if the library hasn't got it.
+ */
+plugin_type *find_plugin(const char *label, size_t length,
+                         const trace_instance_type *header)
+{
+  plugin_type *plugin;
+  int i;
+
+  for(i = 0; i < plugin_count; i ++)
+    if(strlen(plugins[i].label) == length &&
+       memcmp(plugins[i].label, label, length) == 0)
+      return &plugins[i];
+
+  if(plugin_count == MAX_PLUGINS || length >= sizeof(plugin->label)) {
+    fprintf(stderr, "too many plugins in the trace\n");
+    exit(1);
+  }
+  plugin = &plugins[plugin_count ++];
+  memcpy(plugin->label, label, length);
+  plugin->label[length] = 0;
+  plugin->best_seconds = -1;
+  if(!(plugin->descriptor = host_find_plugin(library, plugin->label)))
+    exit(1);
+  if(plugin->descriptor->UniqueID != header->unique_id ||
+     plugin->descriptor->PortCount != header->port_count) {
+    fprintf(stderr, "%s: %s isn't the plugin that was captured\n", library,
+            plugin->label);
+    exit(1);
+  }
+
+  return plugin;
+}
+
+/**
+ * Check the trace, and find the largest block and the most ports of
+ * any plugin in it. A trace that ends in the middle of a record, as
+ * it does if the host crashed, is replayed up to there. Returns 0 and
+ * says why if it isn't a trace.
+ */
+int check_trace(void)
+{
+  const trace_header_type *header = (const trace_header_type *)trace;
+  trace_record_type record;
+  trace_instance_type instance;
+  trace_run_type run;
+  size_t at, start;
+
+  if(trace_size < sizeof(*header) ||
+     memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+     header->version != TRACE_VERSION ||
+     trace_size - sizeof(*header) < header->library_length) {
+    fprintf(stderr, "not a trace\n");
+    return 0;
+  }
+  if(!library) {
+    library = malloc(header->library_length + 1);
+    memcpy(library, trace + sizeof(*header), header->library_length);
+    library[header->library_length] = 0;
+  }
+  records_start = sizeof(*header) + header->library_length;
+
+  for(at = start = records_start; at < trace_size;
+      at += record.size, start = at) {
+    if(trace_size - at < sizeof(record))
+      break;
+    memcpy(&record, trace + at, sizeof(record));
+    at += sizeof(record);
+    if(trace_size - at < record.size)
+      break;
+
+    if(record.type == TRACE_INSTANTIATE) {
+      if(record.size < sizeof(instance))
+        break;
+      memcpy(&instance, trace + at, sizeof(instance));
+      if(instance.port_count + 1 > pool_buffers)
+        pool_buffers = instance.port_count + 1;
+      if(record.instance >= instance_count)
+        instance_count = record.instance + 1;
+    }
+    else if(record.instance >= instance_count)
+      break;
+    else if(record.type == TRACE_RUN) {
+      if(record.size < sizeof(run))
+        break;
+      memcpy(&run, trace + at, sizeof(run));
+      if(run.sample_count > pool_samples)
+        pool_samples = run.sample_count;
+    }
+  }
+  if(at != trace_size) {
+    fprintf(stderr, "the trace is cut short or damaged at byte %lu, "
+            "replaying it up to there\n", (unsigned long)start);
+    trace_size = start;
+  }
+
+  instances = calloc(instance_count ? instance_count : 1,
+                     sizeof(instance_type));
+  pool = calloc(pool_buffers * pool_samples > 0 ?
+                pool_buffers * pool_samples : 1, sizeof(LADSPA_Data));
+  return instances && pool;
+}
+
+/**
+ * Make an instance as the host did, with its control ports connected
+ * to its own controls.
+ */
+void replay_instantiate(uint32_t id, const unsigned char *payload,
+                        size_t size)
+{
+  instance_type *instance = &instances[id];
+  const LADSPA_Descriptor *descriptor;
+  trace_instance_type header;
+  unsigned long port;
+
+  memcpy(&header, payload, sizeof(header));
+  instance->plugin = find_plugin((const char *)payload + sizeof(header),
+                                 size - sizeof(header), &header);
+  descriptor = instance->plugin->descriptor;
+  instance->port_count = header.port_count;
+  instance->controls = calloc(header.port_count, sizeof(LADSPA_Data));
+  instance->layout = malloc(header.port_count * sizeof(uint16_t));
+  if(!instance->controls || !instance->layout ||
+     !(instance->handle = descriptor->instantiate(descriptor,
+                                                  header.sample_rate))) {
+    fprintf(stderr, "%s: couldn't instantiate\n", descriptor->Label);
+    exit(1);
+  }
+
+  for(port = 0; port < instance->port_count; port ++) {
+    instance->layout[port] = TRACE_NO_BUFFER;
+    if(LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+      descriptor->connect_port(instance->handle, port,
+                               instance->controls + port);
+  }
+}
+
+/**
+ * The number of buffers an input or an output is connected to.
+ */
+unsigned long count_buffers(const instance_type *instance, int inputs)
+{
+  const LADSPA_Descriptor *descriptor = instance->plugin->descriptor;
+  LADSPA_PortDescriptor port_descriptor;
+  unsigned long port, buffer, count = 0;
+
+  for(buffer = 0; buffer < pool_buffers - 1; buffer ++)
+    for(port = 0; port < instance->port_count; port ++) {
+      port_descriptor = descriptor->PortDescriptors[port];
+      if(instance->layout[port] == buffer &&
+         LADSPA_IS_PORT_AUDIO(port_descriptor) &&
+         (inputs ? LADSPA_IS_PORT_INPUT(port_descriptor) :
+          LADSPA_IS_PORT_OUTPUT(port_descriptor))) {
+        count ++;
+        break;
+      }
+    }
+
+  return count;
+}
+
+/**
+ * Run a block as the host did: set the controls that changed, connect
+ * the audio ports to buffers laid out as the host's were, fill the
+ * input buffers and time the call to run(). Then compare the output
+ * buffers with what was recorded. Exits if the record doesn't add up.
+ */
+void replay_run(uint32_t id, const unsigned char *payload, size_t size)
+{
+  instance_type *instance = &instances[id];
+  plugin_type *plugin = instance->plugin;
+  const LADSPA_Descriptor *descriptor = plugin->descriptor;
+  LADSPA_PortDescriptor port_descriptor;
+  trace_control_type control;
+  trace_run_type run;
+  unsigned long port, buffer, block;
+  uint32_t i;
+  int mismatch = 0;
+  double start, elapsed;
+
+  memcpy(&run, payload, sizeof(run));
+  payload += sizeof(run);
+  if(size - sizeof(run) < (run.control_count * sizeof(control) +
+                           (run.layout_changed ? instance->port_count *
+                            sizeof(uint16_t) : 0)))
+    goto damaged;
+  for(i = 0; i < run.control_count; i ++) {
+    memcpy(&control, payload, sizeof(control));
+    payload += sizeof(control);
+    if(control.port < instance->port_count)
+      instance->controls[control.port] = control.value;
+  }
+  if(run.layout_changed) {
+    memcpy(instance->layout, payload,
+           instance->port_count * sizeof(uint16_t));
+    payload += instance->port_count * sizeof(uint16_t);
+  }
+
+  block = run.sample_count * sizeof(LADSPA_Data);
+  if(size != sizeof(run) + run.control_count * sizeof(control) +
+     (run.layout_changed ? instance->port_count * sizeof(uint16_t) : 0) +
+     (count_buffers(instance, 1) + count_buffers(instance, 0)) * block)
+    goto damaged;
+
+  for(port = 0; port < instance->port_count; port ++) {
+    if(LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[port]))
+      continue;
+    buffer = instance->layout[port] < pool_buffers - 1 ?
+      instance->layout[port] : pool_buffers - 1;
+    descriptor->connect_port(instance->handle, port,
+                             pool + buffer * pool_samples);
+  }
+
+  // a buffer's data is in the trace once, however many ports share it
+  for(buffer = 0; buffer < pool_buffers - 1; buffer ++)
+    for(port = 0; port < instance->port_count; port ++) {
+      port_descriptor = descriptor->PortDescriptors[port];
+      if(instance->layout[port] == buffer &&
+         LADSPA_IS_PORT_AUDIO(port_descriptor) &&
+         LADSPA_IS_PORT_INPUT(port_descriptor)) {
+        memcpy(pool + buffer * pool_samples, payload, block);
+        payload += block;
+        break;
+      }
+    }
+
+  set_fp_control(run.fp_control);
+  start = replay_seconds();
+  descriptor->run(instance->handle, run.sample_count);
+  elapsed = replay_seconds() - start;
+
+  for(buffer = 0; buffer < pool_buffers - 1; buffer ++)
+    for(port = 0; port < instance->port_count; port ++) {
+      port_descriptor = descriptor->PortDescriptors[port];
+      if(instance->layout[port] == buffer &&
+         LADSPA_IS_PORT_AUDIO(port_descriptor) &&
+         LADSPA_IS_PORT_OUTPUT(port_descriptor)) {
+        mismatch |= memcmp(pool + buffer * pool_samples, payload, block);
+        payload += block;
+        break;
+      }
+    }
+
+  plugin->runs ++;
+  plugin->samples += run.sample_count;
+  plugin->mismatches += mismatch != 0;
+  plugin->seconds += elapsed;
+  if(elapsed > plugin->worst)
+    plugin->worst = elapsed;
+  return;
+
+damaged:
+  fprintf(stderr, "a block of %s in the trace is damaged\n", plugin->label);
+  exit(1);
+}
+
+/**
+ * Run the whole trace once.
+ */
+void replay_pass(void)
+{
+  const LADSPA_Descriptor *descriptor;
+  trace_record_type record;
+  instance_type *instance;
+  uint32_t fp_control = 0;
+  unsigned long id;
+  size_t at;
+
+#if defined(__SSE__)
+  fp_control = _mm_getcsr();
+#endif
+
+  for(at = records_start; at < trace_size; at += record.size) {
+    memcpy(&record, trace + at, sizeof(record));
+    at += sizeof(record);
+    instance = &instances[record.instance];
+    descriptor = instance->plugin ? instance->plugin->descriptor : NULL;
+    if(record.type != TRACE_INSTANTIATE && !instance->handle)
+      continue;
+
+    switch(record.type) {
+    case TRACE_INSTANTIATE:
+      replay_instantiate(record.instance, trace + at, record.size);
+      break;
+    case TRACE_ACTIVATE:
+      if(descriptor->activate)
+        descriptor->activate(instance->handle);
+      break;
+    case TRACE_RUN:
+      replay_run(record.instance, trace + at, record.size);
+      break;
+    case TRACE_DEACTIVATE:
+      if(descriptor->deactivate)
+        descriptor->deactivate(instance->handle);
+      break;
+    case TRACE_CLEANUP:
+      descriptor->cleanup(instance->handle);
+      instance->handle = NULL;
+      break;
+    }
+  }
+
+  // the host may have been stopped before it cleaned up
+  for(id = 0; id < instance_count; id ++) {
+    instance = &instances[id];
+    if(instance->handle)
+      instance->plugin->descriptor->cleanup(instance->handle);
+    free(instance->controls);
+    free(instance->layout);
+    memset(instance, 0, sizeof(*instance));
+  }
+  set_fp_control(fp_control);
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n passes] [-l library.so] trace\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct stat status;
+  plugin_type *plugin;
+  unsigned long runs = 0, mismatches = 0;
+  int option, passes = 1, pass, i, file;
+
+  while((option = getopt(argc, argv, "n:l:")) != -1) {
+    switch(option) {
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    case 'l':
+      library = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if(optind != argc - 1 || passes < 1)
+    usage(argv[0]);
+
+  if((file = open(argv[optind], O_RDONLY)) < 0 || fstat(file, &status) < 0 ||
+     (trace_size = status.st_size) == 0 ||
+     (trace = mmap(NULL, trace_size, PROT_READ, MAP_PRIVATE, file, 0)) ==
+     MAP_FAILED) {
+    perror(argv[optind]);
+    return 1;
+  }
+  close(file);
+  if(!check_trace())
+    return 1;
+
+  for(pass = 0; pass < passes; pass ++) {
+    replay_pass();
+    for(i = 0; i < plugin_count; i ++) {
+      plugin = &plugins[i];
+      if(plugin->best_seconds < 0 || plugin->seconds < plugin->best_seconds) {
+        plugin->best_seconds = plugin->seconds;
+        plugin->best_worst = plugin->worst;
+      }
+      if(pass < passes - 1)
+        plugin->runs = plugin->samples = plugin->mismatches = 0;
+      plugin->seconds = plugin->worst = 0;
+    }
+  }
+
+  printf("%s, %d passes\n", library, passes);
+  for(i = 0; i < plugin_count; i ++) {
+    plugin = &plugins[i];
+    printf("%-24s %8lu blocks %10lu samples %8.2f ns/sample  worst block "
+           "%8.1f us  ", plugin->label, plugin->runs, plugin->samples,
+           plugin->samples ? 1e9 * plugin->best_seconds / plugin->samples : 0,
+           1e6 * plugin->best_worst);
+    if(plugin->mismatches)
+      printf("%lu blocks differ\n", plugin->mismatches);
+    else
+      printf("exact\n");
+    runs += plugin->runs;
+    mismatches += plugin->mismatches;
+  }
+  if(mismatches)
+    printf("%lu of %lu blocks differ from the trace\n", mismatches, runs);
+
+  return mismatches ? 1 : 0;
+}
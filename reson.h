@@ -0,0 +1,192 @@
+/*
+ * reson.h - The kernel of the two-pole reson filter
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The filter of reson.c, without LADSPA (see kernel.h). It passes a
+ * band around a resonant frequency, and each channel has the frequency
+ * and the bandwidth, both in Hz.
+ */
+
+#ifndef RESON_H
+#define RESON_H
+
+#include <math.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+// The filter coefficients
+#define RESON_GAIN         0
+#define RESON_B1           1
+#define RESON_B2           2
+#define RESON_COEFFICIENTS 3
+
+typedef struct {
+  unsigned long sample_rate;
+  int channels;
+
+  // keep the two most recent samples
+  LADSPA_Data history[2][KERNEL_MAX_CHANNELS];
+
+  // the control values, ramped across each block, and the
+  // coefficients interpolated between them
+  smooth_type freq[KERNEL_MAX_CHANNELS];
+  smooth_type bw[KERNEL_MAX_CHANNELS];
+  LADSPA_Data coefficients[RESON_COEFFICIENTS][KERNEL_MAX_CHANNELS];
+} reson_type;
+
+static inline void reson_reset(reson_type *reson)
+{
+  int channel;
+
+  for(channel = 0; channel < reson->channels; channel ++) {
+    reson->history[0][channel] = 0;
+    reson->history[1][channel] = 0;
+    smooth_reset(&reson->freq[channel]);
+    smooth_reset(&reson->bw[channel]);
+  }
+}
+
+/**
+ * Clear the state of one channel, leaving the others be.
+ */
+static inline void reson_reset_channel(reson_type *reson, int channel)
+{
+  reson->history[0][channel] = 0;
+  reson->history[1][channel] = 0;
+  smooth_reset(&reson->freq[channel]);
+  smooth_reset(&reson->bw[channel]);
+}
+
+static inline void reson_init(reson_type *reson, unsigned long sample_rate,
+                              int channels)
+{
+  reson->sample_rate = sample_rate;
+  reson->channels = channels;
+  reson_reset(reson);
+}
+
+/**
+ * Compute the gain and the two feedback coefficients of the
+ * resonator from its centre frequency and bandwidth.
+ */
+static inline void reson_coefficients(float freq, float bw,
+                                      unsigned long sample_rate,
+                                      LADSPA_Data *coefficients)
+{
+  float pole_radius;
+  float pole_angle;
+
+  pole_radius = 1 - M_PI * bw / sample_rate;
+  pole_angle = acos(((2 * pole_radius) / (1 + pow(pole_radius, 2))) *
+                      cos(2 * M_PI * freq / sample_rate));
+
+  coefficients[RESON_GAIN] = (1 - pow(pole_radius, 2)) * sin(pole_angle);
+  coefficients[RESON_B1] = 2 * pole_radius * cos(pole_angle);
+  coefficients[RESON_B2] = pow(pole_radius, 2);
+}
+
+/**
+ * Filter sample_count frames of input into output, with each channel's
+ * controls ramped to frequency[channel] and bandwidth[channel].
+ * channels must be the number the filter was set up for.
+ */
+static inline __attribute__ ((always_inline))
+void reson_process(reson_type *reson, const LADSPA_Data *frequency,
+                   const LADSPA_Data *bandwidth,
+                   const kernel_io_type *input,
+                   const kernel_io_type *output,
+                   unsigned long sample_count, const int channels)
+{
+  LADSPA_Data tile[KERNEL_TILE * KERNEL_MAX_CHANNELS];
+  LADSPA_Data coefficients[RESON_COEFFICIENTS][KERNEL_MAX_CHANNELS];
+  LADSPA_Data step[RESON_COEFFICIENTS][KERNEL_MAX_CHANNELS];
+  LADSPA_Data history[2][KERNEL_MAX_CHANNELS];
+  LADSPA_Data target[RESON_COEFFICIENTS];
+  unsigned long segment_length, offset, i;
+  LADSPA_Data *row;
+  int channel, k;
+
+  for(channel = 0; channel < channels; channel ++) {
+    smooth_start(&reson->bw[channel], bandwidth[channel], sample_count);
+    if(smooth_start(&reson->freq[channel], frequency[channel],
+                    sample_count)) {
+      reson_coefficients(reson->freq[channel].value,
+                         reson->bw[channel].value, reson->sample_rate,
+                         target);
+      for(k = 0; k < RESON_COEFFICIENTS; k ++)
+        reson->coefficients[k][channel] = target[k];
+    }
+
+    for(k = 0; k < RESON_COEFFICIENTS; k ++)
+      coefficients[k][channel] = reson->coefficients[k][channel];
+    history[0][channel] = reson->history[0][channel];
+    history[1][channel] = reson->history[1][channel];
+  }
+
+  for(offset = 0; offset < sample_count; offset += segment_length) {
+
+    segment_length = smooth_segment(sample_count - offset);
+
+    // the coefficients are recomputed from the ramped controls once
+    // per segment, and interpolated up to those values sample by sample.
+    for(channel = 0; channel < channels; channel ++) {
+      reson_coefficients(smooth_advance(&reson->freq[channel],
+                                        segment_length),
+                         smooth_advance(&reson->bw[channel], segment_length),
+                         reson->sample_rate, target);
+      for(k = 0; k < RESON_COEFFICIENTS; k ++)
+        step[k][channel] = (target[k] - coefficients[k][channel]) /
+          segment_length;
+    }
+
+    kernel_load(tile, input, offset, segment_length, channels);
+
+    for(i = 0; i < segment_length; i ++) {
+      row = tile + i * channels;
+
+      for(channel = 0; channel < channels; channel ++) {
+        coefficients[RESON_GAIN][channel] += step[RESON_GAIN][channel];
+        coefficients[RESON_B1][channel] += step[RESON_B1][channel];
+        coefficients[RESON_B2][channel] += step[RESON_B2][channel];
+
+        row[channel] = coefficients[RESON_GAIN][channel] * row[channel] +
+          coefficients[RESON_B1][channel] * history[0][channel] -
+          coefficients[RESON_B2][channel] * history[1][channel];
+
+        history[1][channel] = history[0][channel];
+        history[0][channel] = row[channel];
+      }
+    }
+
+    kernel_store(output, tile, offset, segment_length, channels);
+  }
+
+  for(channel = 0; channel < channels; channel ++) {
+    for(k = 0; k < RESON_COEFFICIENTS; k ++)
+      reson->coefficients[k][channel] = coefficients[k][channel];
+    reson->history[0][channel] = history[0][channel];
+    reson->history[1][channel] = history[1][channel];
+    smooth_end(&reson->freq[channel]);
+    smooth_end(&reson->bw[channel]);
+  }
+}
+
+#endif
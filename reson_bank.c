@@ -0,0 +1,700 @@
+/*
+ * reson_bank.c - A bank of parallel two-pole reson filters
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Up to MAX_MODES reson filters (see reson.c) running in parallel on
+ * the same input, with their outputs summed. This is the building
+ * block of modal synthesis and formant filtering.
+ *
+ * Each mode has a frequency ratio, a bandwidth and a gain, read from
+ * a table. The frequency of a mode is its ratio times the Fundamental
+ * control, and its bandwidth is its table bandwidth times the
+ * Bandwidth control. If the environment variable RESON_BANK_TABLE
+ * names a file, the table is read from there, one mode per line:
+ *
+ *   # ratio  bandwidth  gain
+ *   1.0      1.0        1.0
+ *   2.76     1.5        0.5
+ *
+ * Otherwise the bank defaults to a harmonic series with gains 1/n.
+ *
+ * Coefficients and state are stored as arrays with one element per
+ * mode, and the modes are processed BANK_LANES at a time so that the
+ * compiler can keep a whole group of resonators in vector registers.
+ * If RESON_BANK_THREADS is set to more than 1, large banks are split
+ * across that many threads (including the host's own), each running
+ * a contiguous range of modes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ladspa.h"
+#include "smooth.h"
+#include "kernel.h"
+
+#define MAX_MODES 256
+#define BANK_LANES 16
+#define BANK_CHUNK 1024
+#define BANK_SEGMENTS (BANK_CHUNK / SMOOTH_INTERVAL)
+#define MAX_THREADS 8
+#define MIN_MODES_PER_THREAD 64
+
+// The port numbers for the plugin
+#define FREQ_CONTROL  0
+#define BW_CONTROL    1
+#define MODES_CONTROL 2
+#define INPUT         3
+#define OUTPUT        4
+
+// The range of each control, which the host may not keep to
+#define FREQ_LOWER    20
+#define FREQ_UPPER    20000
+#define BW_LOWER      1
+#define BW_UPPER      1000
+#define MODES_LOWER   1
+#define MODES_UPPER   MAX_MODES
+
+
+/**
+ * A helper thread and the range of modes it is responsible for.
+ */
+typedef struct {
+  pthread_t thread;
+  void *filter;
+  unsigned long first_mode;
+  unsigned long last_mode;
+  LADSPA_Data output[BANK_CHUNK];
+} worker_type;
+
+/**
+ * Structure to hold connections and state.
+ */
+typedef struct {
+  LADSPA_Data *freq_control_value;
+  LADSPA_Data *bw_control_value;
+  LADSPA_Data *modes_control_value;
+
+  LADSPA_Data *input_buffer;
+  LADSPA_Data *output_buffer;
+
+  // state
+  unsigned long sample_rate;
+
+  // the mode table
+  unsigned long mode_count;
+  LADSPA_Data *ratio;
+  LADSPA_Data *bandwidth;
+  LADSPA_Data *amplitude;
+
+  // per-mode coefficients, their per-sample steps while the controls
+  // are ramping, and the two most recent outputs of each mode. all
+  // of these live in the same allocation as the table.
+  LADSPA_Data *gain;
+  LADSPA_Data *b1;
+  LADSPA_Data *b2;
+  LADSPA_Data *gain_step;
+  LADSPA_Data *b1_step;
+  LADSPA_Data *b2_step;
+  LADSPA_Data *history_1;
+  LADSPA_Data *history_2;
+  LADSPA_Data *arrays;
+
+  // number of modes the Modes control switched on for the last block
+  unsigned long active_modes;
+
+  smooth_type freq;
+  smooth_type bw;
+
+  // the ramped control values at the end of each segment of the
+  // current chunk, shared with the helper threads
+  LADSPA_Data segment_freq[BANK_SEGMENTS];
+  LADSPA_Data segment_bw[BANK_SEGMENTS];
+  int segment_moving[BANK_SEGMENTS];
+  LADSPA_Data *chunk_input;
+  unsigned long chunk_length;
+
+  // the input of the current chunk, when the host runs the bank in
+  // place and the output shares memory with it
+  LADSPA_Data input_copy[BANK_CHUNK];
+
+  // optional helper threads
+  unsigned long thread_count;
+  worker_type *workers;
+  pthread_barrier_t start_barrier;
+  pthread_barrier_t done_barrier;
+  int quit;
+
+  // held while activate starts the helpers, and set if it couldn't
+  pthread_mutex_t starting;
+  int start_failed;
+} filter_type;
+
+
+/**
+ * Fill in the default table, a harmonic series.
+ */
+static void default_table(filter_type *filter)
+{
+  unsigned long i;
+
+  filter->mode_count = MAX_MODES;
+  for(i = 0; i < MAX_MODES; i ++) {
+    filter->ratio[i] = i + 1;
+    filter->bandwidth[i] = 1;
+    filter->amplitude[i] = 1. / (i + 1);
+  }
+}
+
+/**
+ * Read the table from the file named by RESON_BANK_TABLE. Returns
+ * 0 if there is no such file or it doesn't contain any modes.
+ */
+static int read_table(filter_type *filter)
+{
+  const char *path = getenv("RESON_BANK_TABLE");
+  char line[256];
+  float ratio, bandwidth, amplitude;
+  FILE *file;
+
+  if(!path || !(file = fopen(path, "r")))
+    return 0;
+
+  filter->mode_count = 0;
+  while(filter->mode_count < MAX_MODES && fgets(line, sizeof(line), file)) {
+    if(line[0] == '#')
+      continue;
+    if(sscanf(line, "%f %f %f", &ratio, &bandwidth, &amplitude) != 3)
+      continue;
+
+    filter->ratio[filter->mode_count] = ratio;
+    filter->bandwidth[filter->mode_count] = bandwidth;
+    filter->amplitude[filter->mode_count] = amplitude;
+    filter->mode_count ++;
+  }
+  fclose(file);
+
+  return filter->mode_count > 0;
+}
+
+/**
+ * Compute the coefficients of modes [first, last) for the given
+ * fundamental and bandwidth, the same way reson.c does for a single
+ * resonator. Modes above the Nyquist frequency, beyond the table or
+ * beyond the Modes control are silent.
+ */
+static void get_coefficients(filter_type *filter, unsigned long first,
+                             unsigned long last, float freq, float bw,
+                             unsigned long mode_limit, LADSPA_Data *gain,
+                             LADSPA_Data *b1, LADSPA_Data *b2)
+{
+  unsigned long i;
+  float mode_freq, pole_radius, pole_angle;
+
+  for(i = first; i < last; i ++) {
+    mode_freq = freq * filter->ratio[i];
+    pole_radius = 1 - M_PI * bw * filter->bandwidth[i] / filter->sample_rate;
+
+    if(i >= mode_limit || mode_freq >= filter->sample_rate / 2 ||
+       pole_radius <= 0 || pole_radius >= 1) {
+      gain[i] = b1[i] = b2[i] = 0;
+      continue;
+    }
+
+    pole_angle = acos(((2 * pole_radius) / (1 + pole_radius * pole_radius)) *
+                      cos(2 * M_PI * mode_freq / filter->sample_rate));
+
+    gain[i] = (1 - pole_radius * pole_radius) * sin(pole_angle) *
+      filter->amplitude[i];
+    b1[i] = 2 * pole_radius * cos(pole_angle);
+    b2[i] = pole_radius * pole_radius;
+  }
+}
+
+/**
+ * Run the modes [first, last) over segment_length samples and write
+ * the sum of their outputs. first and last are multiples of
+ * BANK_LANES. When interpolate is set the coefficients move one step
+ * towards their targets every sample. The input and the output never
+ * overlap here (see run_filter()).
+ */
+static inline void run_modes(filter_type *filter, unsigned long first,
+                             unsigned long last,
+                             const LADSPA_Data *restrict input,
+                             LADSPA_Data *restrict output,
+                             unsigned long segment_length,
+                             const int interpolate)
+{
+  LADSPA_Data *gain = filter->gain;
+  LADSPA_Data *b1 = filter->b1;
+  LADSPA_Data *b2 = filter->b2;
+  LADSPA_Data *history_1 = filter->history_1;
+  LADSPA_Data *history_2 = filter->history_2;
+  LADSPA_Data sum[BANK_LANES];
+  LADSPA_Data y;
+  unsigned long i, group, lane, mode;
+
+  for(i = 0; i < segment_length; i ++) {
+
+    for(lane = 0; lane < BANK_LANES; lane ++)
+      sum[lane] = 0;
+
+    for(group = first; group < last; group += BANK_LANES) {
+      for(lane = 0; lane < BANK_LANES; lane ++) {
+        mode = group + lane;
+
+        if(interpolate) {
+          gain[mode] += filter->gain_step[mode];
+          b1[mode] += filter->b1_step[mode];
+          b2[mode] += filter->b2_step[mode];
+        }
+
+        y = gain[mode] * input[i] + b1[mode] * history_1[mode] -
+          b2[mode] * history_2[mode];
+        history_2[mode] = history_1[mode];
+        history_1[mode] = y;
+        sum[lane] += y;
+      }
+    }
+
+    y = 0;
+    for(lane = 0; lane < BANK_LANES; lane ++)
+      y += sum[lane];
+    output[i] = y;
+  }
+}
+
+/**
+ * Run the modes [first, last) over the current chunk, recomputing
+ * their coefficients once per segment while the controls are ramping.
+ */
+static void run_chunk(filter_type *filter, unsigned long first,
+                      unsigned long last, LADSPA_Data *output)
+{
+  unsigned long segment, segment_length, offset, i;
+  LADSPA_Data *gain_step = filter->gain_step;
+  LADSPA_Data *b1_step = filter->b1_step;
+  LADSPA_Data *b2_step = filter->b2_step;
+
+  for(segment = 0, offset = 0; offset < filter->chunk_length;
+      segment ++, offset += segment_length) {
+
+    segment_length = smooth_segment(filter->chunk_length - offset);
+
+    if(filter->segment_moving[segment]) {
+      // compute the targets into the step arrays, then turn
+      // them into per-sample steps.
+      get_coefficients(filter, first, last, filter->segment_freq[segment],
+                       filter->segment_bw[segment], filter->active_modes,
+                       gain_step, b1_step, b2_step);
+      for(i = first; i < last; i ++) {
+        gain_step[i] = (gain_step[i] - filter->gain[i]) / segment_length;
+        b1_step[i] = (b1_step[i] - filter->b1[i]) / segment_length;
+        b2_step[i] = (b2_step[i] - filter->b2[i]) / segment_length;
+      }
+
+      run_modes(filter, first, last, filter->chunk_input + offset,
+                output + offset, segment_length, 1);
+    }
+    else
+      run_modes(filter, first, last, filter->chunk_input + offset,
+                output + offset, segment_length, 0);
+  }
+}
+
+/**
+ * Helper threads wait for a chunk, run their range of modes
+ * into their own output buffer and wait again.
+ */
+static void *run_worker(void *data)
+{
+  worker_type *worker = (worker_type *)data;
+  filter_type *filter = (filter_type *)worker->filter;
+
+  // wait until activate has started every helper, or given up
+  pthread_mutex_lock(&filter->starting);
+  pthread_mutex_unlock(&filter->starting);
+  if(filter->start_failed)
+    return NULL;
+
+  while(1) {
+    pthread_barrier_wait(&filter->start_barrier);
+    if(filter->quit)
+      break;
+
+    if(worker->first_mode < worker->last_mode)
+      run_chunk(filter, worker->first_mode, worker->last_mode,
+                worker->output);
+
+    pthread_barrier_wait(&filter->done_barrier);
+  }
+
+  return NULL;
+}
+
+/**
+ * Construct a new plugin instance.
+ */
+static LADSPA_Handle instantiate_filter(const LADSPA_Descriptor *descriptor,
+                                        unsigned long sample_rate)
+{
+  filter_type *filter = calloc(1, sizeof(filter_type));
+  void *arrays;
+
+  if(!filter)
+    return NULL;
+
+  // one cache-aligned allocation holds the table, the coefficients
+  // and the state, 11 arrays of MAX_MODES each.
+  if(posix_memalign(&arrays, 64, 11 * MAX_MODES * sizeof(LADSPA_Data))) {
+    free(filter);
+    return NULL;
+  }
+
+  filter->sample_rate = sample_rate;
+  filter->arrays = (LADSPA_Data *)arrays;
+  filter->ratio = filter->arrays;
+  filter->bandwidth = filter->arrays + 1 * MAX_MODES;
+  filter->amplitude = filter->arrays + 2 * MAX_MODES;
+  filter->gain = filter->arrays + 3 * MAX_MODES;
+  filter->b1 = filter->arrays + 4 * MAX_MODES;
+  filter->b2 = filter->arrays + 5 * MAX_MODES;
+  filter->gain_step = filter->arrays + 6 * MAX_MODES;
+  filter->b1_step = filter->arrays + 7 * MAX_MODES;
+  filter->b2_step = filter->arrays + 8 * MAX_MODES;
+  filter->history_1 = filter->arrays + 9 * MAX_MODES;
+  filter->history_2 = filter->arrays + 10 * MAX_MODES;
+  memset(filter->arrays, 0, 11 * MAX_MODES * sizeof(LADSPA_Data));
+
+  if(!read_table(filter))
+    default_table(filter);
+
+  return filter;
+}
+
+static void activate_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  const char *threads = getenv("RESON_BANK_THREADS");
+  unsigned long i;
+
+  memset(filter->history_1, 0, MAX_MODES * sizeof(LADSPA_Data));
+  memset(filter->history_2, 0, MAX_MODES * sizeof(LADSPA_Data));
+  filter->active_modes = 0;
+  smooth_reset(&filter->freq);
+  smooth_reset(&filter->bw);
+
+  filter->thread_count = threads ? strtoul(threads, NULL, 10) : 1;
+  if(filter->thread_count > MAX_THREADS)
+    filter->thread_count = MAX_THREADS;
+  if(filter->thread_count > filter->mode_count / MIN_MODES_PER_THREAD)
+    filter->thread_count = filter->mode_count / MIN_MODES_PER_THREAD;
+
+  filter->workers = NULL;
+  filter->quit = 0;
+  if(filter->thread_count <= 1) {
+    filter->thread_count = 1;
+    return;
+  }
+
+  filter->workers = calloc(filter->thread_count - 1, sizeof(worker_type));
+  if(!filter->workers) {
+    filter->thread_count = 1;
+    return;
+  }
+
+  if(pthread_barrier_init(&filter->start_barrier, NULL,
+                          filter->thread_count)) {
+    free(filter->workers);
+    filter->workers = NULL;
+    filter->thread_count = 1;
+    return;
+  }
+  if(pthread_barrier_init(&filter->done_barrier, NULL,
+                          filter->thread_count)) {
+    pthread_barrier_destroy(&filter->start_barrier);
+    free(filter->workers);
+    filter->workers = NULL;
+    filter->thread_count = 1;
+    return;
+  }
+
+  // the helpers wait for all of them to be started, so if one can't
+  // be, those that were can be stopped before they touch the barriers,
+  // and the bank runs on the host's thread alone
+  filter->start_failed = 0;
+  pthread_mutex_init(&filter->starting, NULL);
+  pthread_mutex_lock(&filter->starting);
+  for(i = 0; i < filter->thread_count - 1; i ++) {
+    filter->workers[i].filter = filter;
+    if(pthread_create(&filter->workers[i].thread, NULL, run_worker,
+                      &filter->workers[i]))
+      break;
+  }
+  if(i < filter->thread_count - 1)
+    filter->start_failed = 1;
+  pthread_mutex_unlock(&filter->starting);
+
+  if(filter->start_failed) {
+    while(i -- > 0)
+      pthread_join(filter->workers[i].thread, NULL);
+    pthread_barrier_destroy(&filter->start_barrier);
+    pthread_barrier_destroy(&filter->done_barrier);
+    free(filter->workers);
+    filter->workers = NULL;
+    filter->thread_count = 1;
+  }
+  pthread_mutex_destroy(&filter->starting);
+}
+
+/**
+ * Connect a port to a data location.
+*/
+static void connect_port_to_filter(LADSPA_Handle instance,
+                                   unsigned long port,
+                                   LADSPA_Data *data_location)
+{
+  filter_type *filter;
+
+  filter = (filter_type *)instance;
+  switch(port) {
+  case FREQ_CONTROL:
+    filter->freq_control_value = data_location;
+    break;
+  case BW_CONTROL:
+    filter->bw_control_value = data_location;
+    break;
+  case MODES_CONTROL:
+    filter->modes_control_value = data_location;
+    break;
+  case INPUT:
+    filter->input_buffer = data_location;
+    break;
+  case OUTPUT:
+    filter->output_buffer = data_location;
+    break;
+  }
+}
+
+/**
+ * This is where the action happens.
+ */
+static void run_filter(LADSPA_Handle instance, unsigned long sample_count)
+{
+  filter_type *filter = (filter_type *)instance;
+  LADSPA_Data *output = filter->output_buffer;
+  unsigned long modes, previous_modes, process_modes, per_thread;
+  unsigned long segment, segment_length, offset, i, j;
+
+  // modes that are switched on or off by the Modes control fade in
+  // or out over this block, so they're processed until the end of it.
+  // the modes are processed in whole lane groups, and those past the
+  // control in the last group are silent.
+  previous_modes = filter->active_modes;
+  modes = (unsigned long)kernel_clamp(*filter->modes_control_value,
+                                      MODES_LOWER, MODES_UPPER);
+  if(modes > filter->mode_count)
+    modes = filter->mode_count;
+  process_modes = modes > previous_modes ? modes : previous_modes;
+  process_modes = (process_modes + BANK_LANES - 1) / BANK_LANES * BANK_LANES;
+  filter->active_modes = modes;
+
+  smooth_start(&filter->bw, kernel_clamp(*filter->bw_control_value,
+                                          BW_LOWER, BW_UPPER),
+               sample_count);
+  if(smooth_start(&filter->freq,
+                  kernel_clamp(*filter->freq_control_value,
+                               FREQ_LOWER, FREQ_UPPER),
+                  sample_count))
+    get_coefficients(filter, 0, MAX_MODES, filter->freq.value,
+                     filter->bw.value, modes,
+                     filter->gain, filter->b1, filter->b2);
+
+  // split the modes between the threads in whole lane groups
+  per_thread = (process_modes / BANK_LANES + filter->thread_count - 1) /
+    filter->thread_count * BANK_LANES;
+  for(i = 0; i < filter->thread_count - 1; i ++) {
+    filter->workers[i].first_mode = (i + 1) * per_thread;
+    filter->workers[i].last_mode = (i + 2) * per_thread;
+    if(filter->workers[i].first_mode > process_modes)
+      filter->workers[i].first_mode = process_modes;
+    if(filter->workers[i].last_mode > process_modes)
+      filter->workers[i].last_mode = process_modes;
+  }
+  if(per_thread > process_modes)
+    per_thread = process_modes;
+
+  for(offset = 0; offset < sample_count; offset += filter->chunk_length) {
+    filter->chunk_input = filter->input_buffer + offset;
+    filter->chunk_length = sample_count - offset < BANK_CHUNK ?
+      sample_count - offset : BANK_CHUNK;
+
+    // run in place, the host thread would overwrite the input while
+    // the helper threads are still reading it, so then the modes read
+    // a copy of the chunk instead. out of place they read the host's
+    // buffer directly.
+    if(filter->chunk_input < output + offset + filter->chunk_length &&
+       output + offset < filter->chunk_input + filter->chunk_length) {
+      memcpy(filter->input_copy, filter->chunk_input,
+             filter->chunk_length * sizeof(LADSPA_Data));
+      filter->chunk_input = filter->input_copy;
+    }
+
+    // advance the control ramps here rather than in each thread
+    for(segment = 0, i = 0; i < filter->chunk_length;
+        segment ++, i += segment_length) {
+      segment_length = smooth_segment(filter->chunk_length - i);
+      filter->segment_moving[segment] = filter->freq.value !=
+        filter->freq.target || filter->bw.value != filter->bw.target ||
+        modes != previous_modes;
+      filter->segment_freq[segment] = smooth_advance(&filter->freq,
+                                                     segment_length);
+      filter->segment_bw[segment] = smooth_advance(&filter->bw,
+                                                   segment_length);
+    }
+
+    if(filter->thread_count > 1)
+      pthread_barrier_wait(&filter->start_barrier);
+
+    run_chunk(filter, 0, per_thread, output + offset);
+
+    if(filter->thread_count > 1) {
+      pthread_barrier_wait(&filter->done_barrier);
+      for(i = 0; i < filter->thread_count - 1; i ++)
+        if(filter->workers[i].first_mode < filter->workers[i].last_mode)
+          for(j = 0; j < filter->chunk_length; j ++)
+            output[offset + j] += filter->workers[i].output[j];
+    }
+  }
+
+  smooth_end(&filter->freq);
+  smooth_end(&filter->bw);
+
+  // silence the state of modes that have now faded out
+  for(i = modes; i < process_modes; i ++)
+    filter->history_1[i] = filter->history_2[i] = 0;
+}
+
+static void deactivate_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  unsigned long i;
+
+  if(filter->workers) {
+    filter->quit = 1;
+    pthread_barrier_wait(&filter->start_barrier);
+    for(i = 0; i < filter->thread_count - 1; i ++)
+      pthread_join(filter->workers[i].thread, NULL);
+    pthread_barrier_destroy(&filter->start_barrier);
+    pthread_barrier_destroy(&filter->done_barrier);
+    free(filter->workers);
+    filter->workers = NULL;
+  }
+}
+
+static void cleanup_filter(LADSPA_Handle instance)
+{
+  filter_type *filter = (filter_type *)instance;
+  free(filter->arrays);
+  free(instance);
+}
+
+/**
+ * The ports of the plugin.
+ */
+static const LADSPA_PortDescriptor port_descriptors[] = {
+  [FREQ_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [BW_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [MODES_CONTROL] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL,
+  [INPUT] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+  [OUTPUT] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+
+static const char *const port_names[] = {
+  [FREQ_CONTROL] = "Fundamental",
+  [BW_CONTROL] = "Bandwidth",
+  [MODES_CONTROL] = "Modes",
+  [INPUT] = "Input",
+  [OUTPUT] = "Output"
+};
+
+static const LADSPA_PortRangeHint port_range_hints[] = {
+  [FREQ_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                     | LADSPA_HINT_BOUNDED_ABOVE
+                     | LADSPA_HINT_LOGARITHMIC
+                     | LADSPA_HINT_DEFAULT_440,
+                     FREQ_LOWER, FREQ_UPPER },
+  [BW_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                   | LADSPA_HINT_BOUNDED_ABOVE
+                   | LADSPA_HINT_LOGARITHMIC
+                   | LADSPA_HINT_DEFAULT_LOW,
+                   BW_LOWER, BW_UPPER },
+  [MODES_CONTROL] = { LADSPA_HINT_BOUNDED_BELOW
+                      | LADSPA_HINT_BOUNDED_ABOVE
+                      | LADSPA_HINT_INTEGER
+                      | LADSPA_HINT_DEFAULT_MAXIMUM,
+                      MODES_LOWER, MODES_UPPER },
+  [INPUT] = { 0, 0, 0 },
+  [OUTPUT] = { 0, 0, 0 }
+};
+
+/**
+ * The descriptors the host will be using. They are constant data, so
+ * there is nothing to build when the library is loaded and nothing
+ * to free when it is unloaded.
+ */
+static const LADSPA_Descriptor mono_descriptor = {
+  .UniqueID = 0x00654330,
+  .Label = "reson_bank_mono",
+  .Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE,
+  .Name = "Reson filter bank (mono)",
+  .Maker = "Andreas Jansson",
+  .Copyright = "GPL-3.0",
+  .PortCount = 5,
+  .PortDescriptors = port_descriptors,
+  .PortNames = port_names,
+  .PortRangeHints = port_range_hints,
+  .ImplementationData = NULL,
+  .instantiate = instantiate_filter,
+  .connect_port = connect_port_to_filter,
+  .activate = activate_filter,
+  .run = run_filter,
+  .run_adding = NULL,
+  .set_run_adding_gain = NULL,
+  .deactivate = deactivate_filter,
+  .cleanup = cleanup_filter
+};
+
+/* Return a descriptor of the requested plugin type. There is only
+   one plugin type available in this library. */
+__attribute__ ((visibility ("default")))
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index)
+{
+  /* Return the requested descriptor or null if the index is out of
+     range. */
+  switch (index) {
+  case 0:
+    return &mono_descriptor;
+  default:
+    return NULL;
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ * scan.c - Time how long it takes to load and scan plugin libraries
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Does what a host does when it scans its plugin directory at startup:
+ * opens each library and reads every descriptor in it. Prints how long
+ * that took and how much the resident set size of the process grew.
+ * Only the first scan in a process is representative, so run it
+ * several times from the shell rather than looping here.
+ *
+ *   scan library.so...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include "ladspa.h"
+
+/**
+ * The resident set size of this process in kB, or -1.
+ */
+long get_rss(void)
+{
+  char line[256];
+  long rss = -1;
+  FILE *file = fopen("/proc/self/status", "r");
+
+  if(!file)
+    return -1;
+
+  while(fgets(line, sizeof(line), file))
+    if(sscanf(line, "VmRSS: %ld", &rss) == 1)
+      break;
+
+  fclose(file);
+
+  return rss;
+}
+
+int main(int argc, char **argv)
+{
+  LADSPA_Descriptor_Function get_descriptor;
+  const LADSPA_Descriptor *descriptor;
+  struct timespec start, end;
+  unsigned long index, port, descriptors = 0;
+  size_t checksum = 0;
+  long rss_before, rss_after;
+  void *library;
+  int i;
+
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s library.so...\n", argv[0]);
+    return 1;
+  }
+
+  rss_before = get_rss();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for(i = 1; i < argc; i ++) {
+    library = dlopen(argv[i], RTLD_NOW | RTLD_LOCAL);
+    if(!library) {
+      fprintf(stderr, "%s\n", dlerror());
+      return 1;
+    }
+
+    get_descriptor = (LADSPA_Descriptor_Function)
+      dlsym(library, "ladspa_descriptor");
+    if(!get_descriptor) {
+      fprintf(stderr, "%s\n", dlerror());
+      return 1;
+    }
+
+    // read everything a host would show in its plugin list
+    for(index = 0; (descriptor = get_descriptor(index)); index ++) {
+      checksum += descriptor->UniqueID + strlen(descriptor->Label) +
+        strlen(descriptor->Name);
+      for(port = 0; port < descriptor->PortCount; port ++)
+        checksum += descriptor->PortDescriptors[port] +
+          descriptor->PortRangeHints[port].HintDescriptor +
+          strlen(descriptor->PortNames[port]);
+      descriptors ++;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  rss_after = get_rss();
+
+  printf("%d libraries %lu descriptors %9.1f us rss +%ld kB (%zx)\n",
+         argc - 1, descriptors,
+         (end.tv_sec - start.tv_sec) * 1e6 +
+         (end.tv_nsec - start.tv_nsec) / 1e3,
+         rss_after - rss_before, checksum);
+
+  return 0;
+}
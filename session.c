@@ -0,0 +1,214 @@
+/*
+ * session.c - Time a mix of many tracks on a growing number of cores
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Builds a synthetic session as a graph (see graph.h): -t tracks of
+ * noise, each through one instance of every plugin given, in order,
+ * the tracks mixed -g at a time into buses and the buses into a
+ * master bus. With four plugins, the default 125 tracks make 500
+ * instances.
+ *
+ * The session is run with 1, 2, 4, ... threads, up to -j (one per
+ * core by default), and for each it prints the time per block, the
+ * speedup over one thread, how many blocks missed the deadline (a
+ * block's length of audio), how many nodes ran on their home thread
+ * and how many were stolen.
+ *
+ *   session [-t tracks] [-g tracks_per_bus] [-b block_size]
+ *           [-s seconds] [-r sample_rate] [-j threads]
+ *           library.so label...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "graph.h"
+
+#define MAX_LABELS 16
+
+unsigned long block_size = 256;
+unsigned long sample_rate = 48000;
+double seconds = 5;
+int track_count = 125;
+int tracks_per_bus = 16;
+int max_threads;
+
+host_stage_type stages[MAX_LABELS];
+int stage_count;
+
+/**
+ * Build the session, and note the nodes that hold each track's noise
+ * in sources. Returns 0 if it can't.
+ */
+int build_session(graph_type *graph, int channels, int *sources)
+{
+  int *track_ends = malloc(track_count * sizeof(int));
+  int *buses = malloc((track_count / tracks_per_bus + 1) * sizeof(int));
+  int track, stage, node, bus_count = 0, ok = 0;
+
+  graph_init(graph, channels);
+  for(track = 0; track < track_count; track ++) {
+    // a bus with no inputs only holds the noise the track starts from
+    if((node = sources[track] = graph_add_node(graph, NULL, NULL, 0)) < 0)
+      goto done;
+    for(stage = 0; stage < stage_count; stage ++)
+      if((node = graph_add_node(graph, &stages[stage], &node, 1)) < 0)
+        goto done;
+    track_ends[track] = node;
+  }
+
+  for(track = 0; track < track_count; track += tracks_per_bus)
+    if((buses[bus_count ++] =
+        graph_add_node(graph, NULL, track_ends + track,
+                       track_count - track < tracks_per_bus ?
+                       track_count - track : tracks_per_bus)) < 0)
+      goto done;
+  ok = graph_add_node(graph, NULL, buses, bus_count) >= 0;
+
+done:
+  free(track_ends);
+  free(buses);
+  return ok;
+}
+
+/**
+ * Run the session on a number of threads and print how it went.
+ * Returns the time per block, or 0 if it couldn't be run.
+ */
+double run_session(int threads, int channels, double one_thread)
+{
+  static graph_type graph;
+  int *sources = malloc(track_count * sizeof(int));
+  unsigned long total, done, runs = 0, home_runs = 0, steals = 0, i;
+  double per_block;
+  int track, channel, pass, worker;
+
+  if(!build_session(&graph, channels, sources) ||
+     !graph_start(&graph, sample_rate, block_size, threads)) {
+    free(sources);
+    return 0;
+  }
+
+  for(track = 0; track < track_count; track ++)
+    for(channel = 0; channel < channels; channel ++)
+      for(i = 0; i < block_size; i ++)
+        graph_buffers(&graph, sources[track])[channel][i] =
+          (float)rand() / RAND_MAX - .5;
+  free(sources);
+
+  // one short pass to warm up the caches, then the timed one
+  for(pass = 0; pass < 2; pass ++) {
+    total = pass ? seconds * sample_rate : sample_rate / 10;
+    graph.total = graph.worst = 0;
+    graph.blocks = graph.misses = 0;
+    for(worker = 0; worker < threads; worker ++)
+      graph.workers[worker].runs = graph.workers[worker].home_runs =
+        graph.workers[worker].steals = 0;
+
+    for(done = 0; done < total; done += block_size)
+      graph_run(&graph, block_size);
+  }
+
+  for(worker = 0; worker < threads; worker ++) {
+    runs += graph.workers[worker].runs;
+    home_runs += graph.workers[worker].home_runs;
+    steals += graph.workers[worker].steals;
+  }
+  per_block = graph.total / graph.blocks;
+  printf("%3d threads %10.1f us/block %6.2fx   %lu of %lu blocks over "
+         "%.1f us, worst %.1f   %5.1f%% at home, %lu steals\n", threads,
+         1e6 * per_block, one_thread ? one_thread / per_block : 1,
+         graph.misses, graph.blocks, 1e6 * graph.deadline, 1e6 * graph.worst,
+         100.0 * home_runs / runs, steals);
+
+  graph_stop(&graph);
+  return per_block;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-t tracks] [-g tracks_per_bus] "
+          "[-b block_size] [-s seconds] [-r sample_rate] [-j threads] "
+          "library.so label...\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  const LADSPA_Descriptor *descriptor;
+  double one_thread = 0, per_block;
+  int option, label, threads, channels;
+
+  max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  while((option = getopt(argc, argv, "t:g:b:s:r:j:")) != -1) {
+    switch(option) {
+    case 't':
+      track_count = atoi(optarg);
+      break;
+    case 'g':
+      tracks_per_bus = atoi(optarg);
+      break;
+    case 'b':
+      block_size = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      seconds = atof(optarg);
+      break;
+    case 'r':
+      sample_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      max_threads = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  stage_count = argc - optind - 1;
+  if(stage_count < 1 || stage_count > MAX_LABELS || track_count < 1 ||
+     tracks_per_bus < 1 || block_size == 0 || sample_rate == 0 ||
+     max_threads < 1)
+    usage(argv[0]);
+
+  for(label = 0; label < stage_count; label ++) {
+    descriptor = host_find_plugin(argv[optind], argv[optind + 1 + label]);
+    if(!descriptor || !host_make_stage(&stages[label], descriptor))
+      return 1;
+  }
+  if(!(channels = host_chain_channels(stages, stage_count)))
+    return 1;
+
+  printf("%d tracks of %d plugins, %d instances, block %lu\n", track_count,
+         stage_count, track_count * stage_count, block_size);
+  for(threads = 1; threads < max_threads; threads *= 2) {
+    if(!(per_block = run_session(threads, channels, one_thread)))
+      return 1;
+    if(threads == 1)
+      one_thread = per_block;
+  }
+  if(!run_session(max_threads, channels, one_thread))
+    return 1;
+
+  return 0;
+}
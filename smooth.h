@@ -0,0 +1,132 @@
+/*
+ * smooth.h - Control-rate parameter smoothing shared by the plugins
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * The host can only change a control port between two calls to run(),
+ * so without smoothing every parameter change is a step at the block
+ * boundary. Here each control value is instead ramped linearly from
+ * its previous value to its new value over the length of the block.
+ *
+ * Coefficients that are expensive to compute (pow, cos, acos, ...)
+ * are only recomputed from the ramped control value once every
+ * SMOOTH_INTERVAL samples, and are linearly interpolated in between.
+ * Cheap coefficients can follow the ramp sample by sample.
+ */
+
+#ifndef SMOOTH_H
+#define SMOOTH_H
+
+#include "ladspa.h"
+
+#define SMOOTH_INTERVAL 32
+
+/**
+ * A control value that is being ramped towards its target.
+ */
+typedef struct {
+  LADSPA_Data value;
+  LADSPA_Data target;
+  LADSPA_Data step;
+  unsigned long remaining;
+  int primed;
+} smooth_type;
+
+/**
+ * Forget the previous value, so that the next block starts at
+ * the target instead of ramping up to it. Call from activate().
+ */
+static inline void smooth_reset(smooth_type *smooth)
+{
+  smooth->step = 0;
+  smooth->remaining = 0;
+  smooth->primed = 0;
+}
+
+/**
+ * Start ramping towards target over sample_count samples. Returns
+ * 1 if this is the first block after a reset, in which case the value
+ * jumps straight to the target and the caller needs to compute its
+ * initial coefficients.
+ */
+static inline int smooth_start(smooth_type *smooth, LADSPA_Data target,
+                               unsigned long sample_count)
+{
+  int first = !smooth->primed;
+
+  if(first) {
+    smooth->value = target;
+    smooth->primed = 1;
+  }
+
+  smooth->target = target;
+  smooth->remaining = sample_count;
+  smooth->step = sample_count > 0 ?
+    (target - smooth->value) / sample_count : 0;
+
+  return first;
+}
+
+/**
+ * Advance the ramp by sample_count samples and return the new value.
+ * The last sample of the block always gets exactly the target, so
+ * integer controls don't get truncated to one below their value.
+ */
+static inline LADSPA_Data smooth_advance(smooth_type *smooth,
+                                         unsigned long sample_count)
+{
+  if(sample_count >= smooth->remaining) {
+    smooth->remaining = 0;
+    smooth->value = smooth->target;
+  }
+  else {
+    smooth->remaining -= sample_count;
+    smooth->value += smooth->step * sample_count;
+  }
+
+  return smooth->value;
+}
+
+/**
+ * Advance the ramp by one sample and return the new value.
+ */
+static inline LADSPA_Data smooth_next(smooth_type *smooth)
+{
+  return smooth_advance(smooth, 1);
+}
+
+/**
+ * Snap to the target at the end of a block, so that rounding errors
+ * in the ramp don't accumulate from block to block.
+ */
+static inline void smooth_end(smooth_type *smooth)
+{
+  smooth->value = smooth->target;
+  smooth->step = 0;
+  smooth->remaining = 0;
+}
+
+/**
+ * Length of the next coefficient segment, at most SMOOTH_INTERVAL.
+ */
+static inline unsigned long smooth_segment(unsigned long sample_count)
+{
+  return sample_count < SMOOTH_INTERVAL ? sample_count : SMOOTH_INTERVAL;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * state.h - Saving and restoring what an instance is in the middle of
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * LADSPA has no way for a host to save the state of an instance, so a
+ * host that seeks has to run a fresh instance over the audio before
+ * the seek point until its histories have filled up again. The plugins
+ * that include this keep all of their state, histories, positions,
+ * previous samples and control ramps, at the end of the instance, in
+ * the same allocation. A snapshot is a copy of those bytes, and
+ * restoring one copies them back, so a host can checkpoint an
+ * instance as often as it likes and resume from any checkpoint with
+ * one memcpy. The port connections and the kernel come before the
+ * state and aren't touched, so a restored instance needs no setting
+ * up again, and restoring into a second instance clones the first.
+ *
+ * A host finds the interface through ladspa_state(), exported next to
+ * ladspa_descriptor(), which returns it for the library's descriptors
+ * and null for any others. A snapshot can be restored into any
+ * activated instance of the same descriptor at the same sample rate;
+ * they all have the same size().
+ */
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "ladspa.h"
+
+typedef struct {
+  unsigned long (*size)(LADSPA_Handle instance);
+  void (*save)(LADSPA_Handle instance, void *snapshot);
+  void (*restore)(LADSPA_Handle instance, const void *snapshot);
+} state_interface_type;
+
+typedef const state_interface_type *
+(*state_function_type)(const LADSPA_Descriptor *descriptor);
+
+/**
+ * Define state_interface for a filter_type whose state runs from its
+ * member first to instance_size bytes from its start.
+ */
+#define STATE_INTERFACE(first)                                          \
+  static unsigned long state_size(LADSPA_Handle instance)               \
+  {                                                                     \
+    return ((filter_type *)instance)->instance_size -                   \
+      offsetof(filter_type, first);                                     \
+  }                                                                     \
+  static void state_save(LADSPA_Handle instance, void *snapshot)        \
+  {                                                                     \
+    memcpy(snapshot, (char *)instance + offsetof(filter_type, first),   \
+           state_size(instance));                                       \
+  }                                                                     \
+  static void state_restore(LADSPA_Handle instance,                     \
+                            const void *snapshot)                       \
+  {                                                                     \
+    memcpy((char *)instance + offsetof(filter_type, first), snapshot,   \
+           state_size(instance));                                       \
+  }                                                                     \
+  static const state_interface_type state_interface = {                 \
+    state_size, state_save, state_restore                               \
+  }
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * stream.h - What streamd and its clients share
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A client of streamd connects to its Unix socket (SOCK_SEQPACKET)
+ * and asks for a number of mono streams through one of the kernels of
+ * kernel_class.h, with a stream_request_type. The daemon answers with
+ * a stream_reply_type and, unless it failed, the file descriptor of a
+ * shared memory region (SCM_RIGHTS) that holds a ring for each
+ * stream, stream_size() bytes apiece, sealed so that its size can't
+ * change. A client can ask for streams as many times as it likes on
+ * one connection, and its streams go away when it hangs up.
+ *
+ * Audio goes through the rings in blocks of the daemon's block size,
+ * STREAM_SLOTS of them each way. The client writes a block into the
+ * next input slot, notes when it sent it and bumps input_head; the
+ * daemon processes it, writes the output block into the next output
+ * slot, with the time the input was sent, and bumps output_head; the
+ * client reads it and bumps output_tail. Each counter only ever
+ * grows and has one writer, so the rings need no locks. The client
+ * can change the controls at any time, and the daemon reads them once
+ * a block.
+ *
+ * The daemon keeps the statistics of each stream in its ring, where
+ * the client can read them too: how many blocks it processed, how
+ * many times the client was late with a block (an underrun, which
+ * the daemon fills in with silence) or behind with reading its output
+ * (an overrun, which drops a block), and a histogram of the latency,
+ * from when the client sent a block to when its output was ready.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+
+#include "ladspa.h"
+#include "kernel_class.h"
+
+#define STREAM_SOCKET       "streamd.sock"
+#define STREAM_SLOTS        8
+#define STREAM_NAME_LENGTH  32
+#define STREAM_ERROR_LENGTH 128
+
+// quarter octaves of latency, from 1 us up to about 65 ms
+#define STREAM_LATENCY_BUCKETS   64
+#define STREAM_BUCKETS_PER_OCTAVE 4
+
+/**
+ * A client's request for count streams through a kernel, with the
+ * controls they start with.
+ */
+typedef struct {
+  char kernel[STREAM_NAME_LENGTH];
+  LADSPA_Data controls[KERNEL_CLASS_MAX_CONTROLS];
+  unsigned int count;
+} stream_request_type;
+
+/**
+ * The daemon's answer. The streams are numbered from first_stream,
+ * for its reports.
+ */
+typedef struct {
+  char error[STREAM_ERROR_LENGTH];
+  unsigned int first_stream;
+  unsigned long sample_rate;
+  unsigned long block_size;
+} stream_reply_type;
+
+/**
+ * The head of a stream's ring. The blocks of audio follow it, the
+ * input slots first.
+ */
+typedef struct {
+  // written by the client
+  _Alignas(64) atomic_ulong input_head;
+  _Atomic(LADSPA_Data) controls[KERNEL_CLASS_MAX_CONTROLS];
+  double input_sent[STREAM_SLOTS];
+
+  // written by the client
+  _Alignas(64) atomic_ulong output_tail;
+
+  // written by the daemon
+  _Alignas(64) atomic_ulong input_tail;
+  atomic_ulong output_head;
+  double output_sent[STREAM_SLOTS];
+
+  // the statistics, also written by the daemon
+  unsigned long blocks;
+  unsigned long underruns;
+  unsigned long overruns;
+  double latency_total;
+  double latency_max;
+  unsigned long latency[STREAM_LATENCY_BUCKETS];
+} stream_ring_type;
+
+static inline double stream_seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * How many bytes a ring takes, with its blocks.
+ */
+static inline unsigned long stream_size(unsigned long block_size)
+{
+  unsigned long size = sizeof(stream_ring_type) +
+    2 * STREAM_SLOTS * block_size * sizeof(LADSPA_Data);
+
+  return (size + 63) & ~63ul;
+}
+
+/**
+ * The ring of stream index in a shared memory region.
+ */
+static inline stream_ring_type *stream_ring(void *memory,
+                                            unsigned long block_size,
+                                            unsigned int index)
+{
+  return (stream_ring_type *)((char *)memory +
+                              index * stream_size(block_size));
+}
+
+/**
+ * The input block of block number n.
+ */
+static inline LADSPA_Data *stream_input(stream_ring_type *ring,
+                                        unsigned long block_size,
+                                        unsigned long n)
+{
+  return (LADSPA_Data *)(ring + 1) + (n % STREAM_SLOTS) * block_size;
+}
+
+/**
+ * The output block of block number n.
+ */
+static inline LADSPA_Data *stream_output(stream_ring_type *ring,
+                                         unsigned long block_size,
+                                         unsigned long n)
+{
+  return (LADSPA_Data *)(ring + 1) +
+    (STREAM_SLOTS + n % STREAM_SLOTS) * block_size;
+}
+
+/**
+ * Count a latency, in seconds, in a histogram.
+ */
+static inline void stream_count_latency(unsigned long *histogram,
+                                        double latency)
+{
+  int bucket = 0;
+
+  if(latency > 1e-6)
+    bucket = STREAM_BUCKETS_PER_OCTAVE * log2(latency * 1e6);
+  if(bucket >= STREAM_LATENCY_BUCKETS)
+    bucket = STREAM_LATENCY_BUCKETS - 1;
+
+  histogram[bucket] ++;
+}
+
+/**
+ * The latency below which a fraction of those in a histogram are, in
+ * seconds, to the nearest quarter octave above, but no more than the
+ * largest, max.
+ */
+static inline double stream_percentile(const unsigned long *histogram,
+                                       double fraction, double max)
+{
+  double upper;
+  unsigned long total = 0, count = 0;
+  int bucket;
+
+  for(bucket = 0; bucket < STREAM_LATENCY_BUCKETS; bucket ++)
+    total += histogram[bucket];
+
+  for(bucket = 0; bucket < STREAM_LATENCY_BUCKETS - 1; bucket ++)
+    if((count += histogram[bucket]) >= fraction * total)
+      break;
+
+  upper = 1e-6 * pow(2, (bucket + 1.) / STREAM_BUCKETS_PER_OCTAVE);
+  return upper < max ? upper : max;
+}
+
+#endif
@@ -0,0 +1,803 @@
+/*
+ * streamd.c - Filter many streams at once for clients on the machine
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A daemon that runs mono streams through the kernels of
+ * kernel_class.h for clients on the same machine, which hand it their
+ * audio through shared memory rings (see stream.h for the protocol).
+ *
+ * Streams through the same kernel are batched: up to
+ * KERNEL_MAX_CHANNELS of them are the channels of one instance of the
+ * kernel, a group, so one call filters them all, with the loops over
+ * channels vectorised across the streams. Each lane of a group reads
+ * its stream's input slot and writes its output slot in place, so
+ * nothing is copied. A lane is cleared for each new stream, and a
+ * group is freed when its last stream goes.
+ *
+ * The groups are shared out between -j threads, one per core by
+ * default, and each thread processes all of its groups once every
+ * block, on a clock like a sound card's. A stream whose client hasn't
+ * sent a block in time gets silence instead (an underrun), and a
+ * stream whose client doesn't read its output in time loses a block
+ * (an overrun). A thread that falls behind runs its next cycles
+ * straight away to catch up, since the clients' clocks don't wait for
+ * it either, and otherwise their blocks would queue up for good.
+ *
+ * Every -t seconds the daemon prints how many streams it has, how busy
+ * its threads are, how many cycles were late and the latency of the
+ * blocks since the last report. SIGUSR1 prints the statistics of
+ * every stream, as a table on stdout.
+ *
+ *   streamd [-s socket] [-b block_size] [-r sample_rate] [-j threads]
+ *           [-t seconds]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "ladspa.h"
+#include "kernel_class.h"
+#include "stream.h"
+
+#define MAX_THREADS 256
+#define LANES       KERNEL_MAX_CHANNELS
+
+typedef struct group_type group_type;
+
+/**
+ * A stream, and the lane of the group it's in.
+ */
+typedef struct {
+  stream_ring_type *ring;
+  unsigned int id;
+  const kernel_class_type *class;
+  int worker;
+  group_type *group;
+  int lane;
+
+  // whether the client has sent a block yet
+  int started;
+} stream_type;
+
+/**
+ * Streams through the same kernel, lane n as channel n of one
+ * instance of it.
+ */
+struct group_type {
+  const kernel_class_type *class;
+  void *kernel;
+  stream_type *lanes[LANES];
+  int used;
+  group_type *next;
+};
+
+/**
+ * A thread and the groups it runs. The lock is held while it runs
+ * them, and to add or remove streams.
+ */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  group_type *groups;
+  int group_count;
+  int stream_count;
+
+  // where the output of the lanes that have nowhere else to put it
+  // goes, a block for each
+  LADSPA_Data *scratch;
+
+  // the statistics since the last report
+  double busy;
+  unsigned long cycles;
+  unsigned long late;
+  unsigned long underruns;
+  unsigned long overruns;
+  double latency_max;
+  unsigned long latency[STREAM_LATENCY_BUCKETS];
+} worker_type;
+
+/**
+ * Streams a client asked for at once, with their rings in one region
+ * of shared memory.
+ */
+typedef struct {
+  void *memory;
+  size_t size;
+  stream_type *streams;
+  unsigned int count;
+} region_type;
+
+typedef struct {
+  int socket;
+  region_type *regions;
+  int region_count;
+} connection_type;
+
+const char *socket_path = STREAM_SOCKET;
+unsigned long block_size = 256;
+unsigned long sample_rate = 48000;
+double report_seconds = 5;
+
+worker_type workers[MAX_THREADS];
+int thread_count;
+connection_type *connections;
+int connection_count;
+unsigned int next_stream = 0;
+
+// the input of the lanes without a stream, or whose client is late
+LADSPA_Data *silence;
+
+volatile sig_atomic_t stopping = 0;
+volatile sig_atomic_t listing = 0;
+
+/**
+ * Filter a block of every stream of a group.
+ */
+static void run_group(worker_type *worker, group_type *group)
+{
+  const kernel_class_type *class = group->class;
+  LADSPA_Data values[KERNEL_CLASS_MAX_CONTROLS][LANES];
+  LADSPA_Data *controls[KERNEL_CLASS_MAX_CONTROLS];
+  LADSPA_Data *inputs[LANES], *outputs[LANES];
+  int has_input[LANES], has_output[LANES];
+  unsigned long input_tail, output_head;
+  kernel_io_type input, output;
+  stream_ring_type *ring;
+  stream_type *stream;
+  double done, sent, latency;
+  int lane, k;
+
+  for(lane = 0; lane < LANES; lane ++) {
+    stream = group->lanes[lane];
+    inputs[lane] = silence;
+    outputs[lane] = worker->scratch + lane * block_size;
+    has_input[lane] = has_output[lane] = 0;
+    for(k = 0; k < class->control_count; k ++)
+      values[k][lane] = class->controls[k].lower;
+    if(!stream)
+      continue;
+
+    ring = stream->ring;
+    for(k = 0; k < class->control_count; k ++)
+      values[k][lane] =
+        kernel_class_clamp(&class->controls[k], sample_rate,
+                           atomic_load_explicit(&ring->controls[k],
+                                                memory_order_relaxed));
+
+    input_tail = atomic_load_explicit(&ring->input_tail,
+                                      memory_order_relaxed);
+    if(atomic_load_explicit(&ring->input_head, memory_order_acquire) ==
+       input_tail) {
+      if(stream->started) {
+        ring->underruns ++;
+        worker->underruns ++;
+      }
+      continue;
+    }
+    inputs[lane] = stream_input(ring, block_size, input_tail);
+    has_input[lane] = stream->started = 1;
+
+    output_head = atomic_load_explicit(&ring->output_head,
+                                       memory_order_relaxed);
+    if(output_head - atomic_load_explicit(&ring->output_tail,
+                                          memory_order_acquire) <
+       STREAM_SLOTS) {
+      outputs[lane] = stream_output(ring, block_size, output_head);
+      has_output[lane] = 1;
+    }
+    else {
+      ring->overruns ++;
+      worker->overruns ++;
+    }
+  }
+
+  for(k = 0; k < class->control_count; k ++)
+    controls[k] = values[k];
+  kernel_planar(&input, inputs);
+  kernel_planar(&output, outputs);
+  class->process(group->kernel, controls, &input, &output, block_size,
+                 LANES);
+  done = stream_seconds();
+
+  for(lane = 0; lane < LANES; lane ++) {
+    if(!has_input[lane])
+      continue;
+
+    ring = group->lanes[lane]->ring;
+    input_tail = atomic_load_explicit(&ring->input_tail,
+                                      memory_order_relaxed);
+    sent = ring->input_sent[input_tail % STREAM_SLOTS];
+    if(has_output[lane]) {
+      output_head = atomic_load_explicit(&ring->output_head,
+                                         memory_order_relaxed);
+      ring->output_sent[output_head % STREAM_SLOTS] = sent;
+      atomic_store_explicit(&ring->output_head, output_head + 1,
+                            memory_order_release);
+    }
+    atomic_store_explicit(&ring->input_tail, input_tail + 1,
+                          memory_order_release);
+
+    latency = done - sent;
+    ring->blocks ++;
+    ring->latency_total += latency;
+    if(latency > ring->latency_max)
+      ring->latency_max = latency;
+    if(latency > worker->latency_max)
+      worker->latency_max = latency;
+    stream_count_latency(ring->latency, latency);
+    stream_count_latency(worker->latency, latency);
+  }
+}
+
+/**
+ * A worker's thread: run all of its groups once a block.
+ */
+static void *run_worker(void *data)
+{
+  worker_type *worker = (worker_type *)data;
+  double period = (double)block_size / sample_rate;
+  double next = stream_seconds(), start, end;
+  struct timespec wake;
+  group_type *group;
+
+  while(!stopping) {
+    pthread_mutex_lock(&worker->lock);
+    start = stream_seconds();
+    for(group = worker->groups; group; group = group->next)
+      run_group(worker, group);
+    end = stream_seconds();
+
+    // a cycle that ends after the next one should have started is
+    // late, and the next ones run straight away to catch up. a thread
+    // more than the rings hold behind has lost those blocks anyway,
+    // and its clock starts over.
+    next += period;
+    worker->busy += end - start;
+    worker->cycles ++;
+    if(end > next)
+      worker->late ++;
+    if(end > next + STREAM_SLOTS * period)
+      next = end;
+    pthread_mutex_unlock(&worker->lock);
+
+    wake.tv_sec = next;
+    wake.tv_nsec = (next - wake.tv_sec) * 1e9;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) ==
+          EINTR)
+      ;
+  }
+
+  return NULL;
+}
+
+/**
+ * Put a stream in a free lane of a group through its kernel, on the
+ * thread with the fewest streams, with a new group if need be.
+ * Returns 0 if it can't.
+ */
+static int add_stream(stream_type *stream)
+{
+  worker_type *worker;
+  group_type *group;
+  int i;
+
+  stream->worker = 0;
+  for(i = 1; i < thread_count; i ++)
+    if(workers[i].stream_count < workers[stream->worker].stream_count)
+      stream->worker = i;
+  worker = &workers[stream->worker];
+
+  pthread_mutex_lock(&worker->lock);
+  for(group = worker->groups; group; group = group->next)
+    if(group->class == stream->class && group->used < LANES)
+      break;
+
+  if(!group) {
+    if(!(group = calloc(1, sizeof(group_type))) ||
+       !(group->kernel = malloc(stream->class->size(sample_rate, LANES)))) {
+      free(group);
+      pthread_mutex_unlock(&worker->lock);
+      return 0;
+    }
+    group->class = stream->class;
+    group->class->init(group->kernel, sample_rate, LANES);
+    group->next = worker->groups;
+    worker->groups = group;
+    worker->group_count ++;
+  }
+
+  for(i = 0; group->lanes[i]; i ++)
+    ;
+  group->class->reset_channel(group->kernel, i);
+  group->lanes[i] = stream;
+  group->used ++;
+  stream->group = group;
+  stream->lane = i;
+  worker->stream_count ++;
+  pthread_mutex_unlock(&worker->lock);
+
+  return 1;
+}
+
+static void remove_stream(stream_type *stream)
+{
+  worker_type *worker = &workers[stream->worker];
+  group_type *group = stream->group, **link;
+
+  pthread_mutex_lock(&worker->lock);
+  group->lanes[stream->lane] = NULL;
+  worker->stream_count --;
+  if(-- group->used == 0) {
+    for(link = &worker->groups; *link != group; link = &(*link)->next)
+      ;
+    *link = group->next;
+    worker->group_count --;
+    free(group->kernel);
+    free(group);
+  }
+  pthread_mutex_unlock(&worker->lock);
+}
+
+static void close_region(region_type *region, unsigned int added)
+{
+  unsigned int i;
+
+  for(i = 0; i < added; i ++)
+    remove_stream(&region->streams[i]);
+  free(region->streams);
+  munmap(region->memory, region->size);
+}
+
+/**
+ * Set up the streams of a request in a new region of shared memory.
+ * Returns its file descriptor, or -1 and sets errno.
+ */
+static int open_region(connection_type *connection,
+                       const kernel_class_type *class,
+                       const stream_request_type *request,
+                       stream_reply_type *reply)
+{
+  region_type *regions, *region;
+  stream_ring_type *ring;
+  unsigned int added;
+  int memory, k;
+
+  regions = realloc(connection->regions, (connection->region_count + 1) *
+                    sizeof(region_type));
+  if(!regions)
+    return -1;
+  connection->regions = regions;
+  region = &regions[connection->region_count];
+  region->count = request->count;
+  region->size = request->count * stream_size(block_size);
+
+  // the client gets the file descriptor too, so the size is sealed: a
+  // client that shrank the memory would crash the daemon with SIGBUS
+  if((memory = memfd_create("streamd", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    return -1;
+  if(ftruncate(memory, region->size) ||
+     fcntl(memory, F_ADD_SEALS,
+           F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) ||
+     (region->memory = mmap(NULL, region->size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, memory, 0)) == MAP_FAILED) {
+    close(memory);
+    return -1;
+  }
+  if(!(region->streams = calloc(request->count, sizeof(stream_type)))) {
+    munmap(region->memory, region->size);
+    close(memory);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  // the memory starts out zero, so the rings are empty
+  for(added = 0; added < request->count; added ++) {
+    ring = stream_ring(region->memory, block_size, added);
+    for(k = 0; k < class->control_count; k ++)
+      atomic_store(&ring->controls[k],
+                   kernel_class_clamp(&class->controls[k], sample_rate,
+                                      request->controls[k]));
+    region->streams[added].ring = ring;
+    region->streams[added].id = next_stream + added;
+    region->streams[added].class = class;
+    if(!add_stream(&region->streams[added])) {
+      close_region(region, added);
+      close(memory);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  reply->first_stream = next_stream;
+  next_stream += request->count;
+  connection->region_count ++;
+  return memory;
+}
+
+/**
+ * Send a reply, with a file descriptor unless it's negative.
+ */
+static void send_reply(int socket, stream_reply_type *reply, int memory)
+{
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { reply, sizeof(*reply) };
+  struct msghdr message;
+  struct cmsghdr *header;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  if(memory >= 0) {
+    memset(control, 0, sizeof(control));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &memory, sizeof(int));
+  }
+
+  sendmsg(socket, &message, MSG_NOSIGNAL);
+}
+
+/**
+ * Answer a request from a client. Returns 0 if the client hung up.
+ */
+static int handle_request(connection_type *connection)
+{
+  stream_request_type request;
+  stream_reply_type reply;
+  const kernel_class_type *class;
+  ssize_t length;
+  int memory = -1;
+
+  length = recv(connection->socket, &request, sizeof(request), 0);
+  if(length <= 0)
+    return 0;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.sample_rate = sample_rate;
+  reply.block_size = block_size;
+  request.kernel[STREAM_NAME_LENGTH - 1] = 0;
+
+  if(length != sizeof(request))
+    snprintf(reply.error, sizeof(reply.error), "malformed request");
+  else if(!(class = kernel_class_find(request.kernel)))
+    snprintf(reply.error, sizeof(reply.error), "no kernel called %s",
+             request.kernel);
+  else if(request.count == 0 ||
+          request.count > (1ul << 30) / stream_size(block_size))
+    snprintf(reply.error, sizeof(reply.error), "can't open %u streams",
+             request.count);
+  else if((memory = open_region(connection, class, &request, &reply)) < 0)
+    snprintf(reply.error, sizeof(reply.error), "%s", strerror(errno));
+
+  send_reply(connection->socket, &reply, memory);
+  if(memory >= 0)
+    close(memory);
+
+  return 1;
+}
+
+static void close_connection(int index)
+{
+  connection_type *connection = &connections[index];
+  int region;
+
+  for(region = 0; region < connection->region_count; region ++)
+    close_region(&connection->regions[region],
+                 connection->regions[region].count);
+  free(connection->regions);
+  close(connection->socket);
+  connections[index] = connections[-- connection_count];
+}
+
+static int add_connection(int socket)
+{
+  connection_type *grown;
+
+  if(!(grown = realloc(connections, (connection_count + 1) *
+                       sizeof(connection_type)))) {
+    close(socket);
+    return 0;
+  }
+  connections = grown;
+  connections[connection_count].socket = socket;
+  connections[connection_count].regions = NULL;
+  connections[connection_count].region_count = 0;
+  connection_count ++;
+
+  return 1;
+}
+
+/**
+ * Print what the threads did since the last report, and start over.
+ */
+static void report(double seconds)
+{
+  unsigned long latency[STREAM_LATENCY_BUCKETS];
+  unsigned long cycles = 0, late = 0, underruns = 0, overruns = 0;
+  int streams = 0, groups = 0, i, bucket;
+  double busy = 0, latency_max = 0;
+  worker_type *worker;
+
+  memset(latency, 0, sizeof(latency));
+  for(i = 0; i < thread_count; i ++) {
+    worker = &workers[i];
+    pthread_mutex_lock(&worker->lock);
+    streams += worker->stream_count;
+    groups += worker->group_count;
+    busy += worker->busy;
+    cycles += worker->cycles;
+    late += worker->late;
+    underruns += worker->underruns;
+    overruns += worker->overruns;
+    if(worker->latency_max > latency_max)
+      latency_max = worker->latency_max;
+    for(bucket = 0; bucket < STREAM_LATENCY_BUCKETS; bucket ++)
+      latency[bucket] += worker->latency[bucket];
+
+    worker->busy = worker->latency_max = 0;
+    worker->cycles = worker->late = 0;
+    worker->underruns = worker->overruns = 0;
+    memset(worker->latency, 0, sizeof(worker->latency));
+    pthread_mutex_unlock(&worker->lock);
+  }
+
+  fprintf(stderr, "%d streams in %d groups, %4.1f%% busy, %lu of %lu "
+          "cycles late, latency p50 %.0f us p99 %.0f us max %.0f us, "
+          "%lu underruns, %lu overruns\n", streams, groups,
+          100 * busy / (seconds * thread_count), late, cycles,
+          1e6 * stream_percentile(latency, .5, latency_max),
+          1e6 * stream_percentile(latency, .99, latency_max),
+          1e6 * latency_max, underruns, overruns);
+}
+
+/**
+ * Print the statistics of every stream.
+ */
+static void list_streams(void)
+{
+  stream_ring_type *ring;
+  region_type *region;
+  int connection, i;
+  unsigned int stream;
+
+  printf("stream\tkernel\tblocks\tunderruns\toverruns\tmean_us\tp99_us\t"
+         "max_us\n");
+  for(connection = 0; connection < connection_count; connection ++)
+    for(i = 0; i < connections[connection].region_count; i ++) {
+      region = &connections[connection].regions[i];
+      for(stream = 0; stream < region->count; stream ++) {
+        ring = region->streams[stream].ring;
+        printf("%u\t%s\t%lu\t%lu\t%lu\t%.0f\t%.0f\t%.0f\n",
+               region->streams[stream].id,
+               region->streams[stream].class->name, ring->blocks,
+               ring->underruns, ring->overruns, ring->blocks ?
+               1e6 * ring->latency_total / ring->blocks : 0,
+               1e6 * stream_percentile(ring->latency, .99,
+                                       ring->latency_max),
+               1e6 * ring->latency_max);
+      }
+    }
+  fflush(stdout);
+}
+
+/**
+ * Listen on the socket, unless another daemon already is. Returns the
+ * socket, or -1 and says why.
+ */
+static int listen_on(const char *path)
+{
+  struct sockaddr_un address;
+  int listener, other, failed;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "%s: path too long\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  if((listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  // a socket that no one answers on is left over from a daemon that
+  // is gone
+  failed = bind(listener, (struct sockaddr *)&address, sizeof(address));
+  if(failed && errno == EADDRINUSE) {
+    other = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(other >= 0 &&
+       connect(other, (struct sockaddr *)&address, sizeof(address)) == 0) {
+      fprintf(stderr, "%s: another daemon is listening\n", path);
+      close(other);
+      close(listener);
+      return -1;
+    }
+    if(other >= 0)
+      close(other);
+    unlink(path);
+    failed = bind(listener, (struct sockaddr *)&address, sizeof(address));
+  }
+  if(failed || listen(listener, 64)) {
+    perror(path);
+    close(listener);
+    return -1;
+  }
+
+  return listener;
+}
+
+static void on_signal(int signal)
+{
+  if(signal == SIGUSR1)
+    listing = 1;
+  else
+    stopping = 1;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s socket] [-b block_size] [-r sample_rate] "
+          "[-j threads] [-t seconds]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct pollfd *polls = NULL;
+  struct sigaction action;
+  sigset_t signals, old_signals;
+  double last_report, now;
+  int listener, option, ready, socket, i, timeout;
+
+  thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while((option = getopt(argc, argv, "s:b:r:j:t:")) != -1) {
+    switch(option) {
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'b':
+      block_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      sample_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      thread_count = atoi(optarg);
+      break;
+    case 't':
+      report_seconds = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(optind != argc || block_size == 0 || sample_rate == 0 ||
+     thread_count < 1 || thread_count > MAX_THREADS || report_seconds < 0)
+    usage(argv[0]);
+
+  if(!(silence = calloc(block_size, sizeof(LADSPA_Data))))
+    return 1;
+  if((listener = listen_on(socket_path)) < 0)
+    return 1;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGUSR1, &action, NULL);
+
+  // the signals go to the main thread, to wake it from poll()
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+  for(i = 0; i < thread_count; i ++) {
+    pthread_mutex_init(&workers[i].lock, NULL);
+    if(!(workers[i].scratch = malloc(LANES * block_size *
+                                     sizeof(LADSPA_Data))) ||
+       pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+      fprintf(stderr, "can't start %d threads\n", thread_count);
+      return 1;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  fprintf(stderr, "listening on %s, %lu samples at %lu Hz, %d threads\n",
+          socket_path, block_size, sample_rate, thread_count);
+
+  last_report = stream_seconds();
+  while(!stopping) {
+    if(!(polls = realloc(polls, (connection_count + 1) *
+                         sizeof(struct pollfd))))
+      break;
+    polls[0].fd = listener;
+    polls[0].events = POLLIN;
+    for(i = 0; i < connection_count; i ++) {
+      polls[i + 1].fd = connections[i].socket;
+      polls[i + 1].events = POLLIN;
+    }
+
+    timeout = -1;
+    if(report_seconds > 0) {
+      timeout = 1000 * (last_report + report_seconds - stream_seconds());
+      if(timeout < 0)
+        timeout = 0;
+    }
+    ready = poll(polls, connection_count + 1, timeout);
+    if(ready < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+
+    if(listing) {
+      listing = 0;
+      list_streams();
+    }
+    now = stream_seconds();
+    if(report_seconds > 0 && now >= last_report + report_seconds) {
+      report(now - last_report);
+      last_report = now;
+    }
+    if(ready <= 0)
+      continue;
+
+    // the connections are looked at last to first, since closing one
+    // moves the last one into its place
+    for(i = connection_count - 1; i >= 0; i --)
+      if(polls[i + 1].revents && !handle_request(&connections[i]))
+        close_connection(i);
+
+    if(polls[0].revents & POLLIN &&
+       (socket = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+      add_connection(socket);
+  }
+
+  stopping = 1;
+  for(i = 0; i < thread_count; i ++)
+    pthread_join(workers[i].thread, NULL);
+  while(connection_count > 0)
+    close_connection(connection_count - 1);
+  close(listener);
+  unlink(socket_path);
+  free(polls);
+
+  return 0;
+}
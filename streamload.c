@@ -0,0 +1,473 @@
+/*
+ * streamload.c - Drive streamd with many synthetic streams
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Opens -n streams on streamd (see stream.h), through the kernels
+ * given, round robin, each as kernel[:value,...] with the values of
+ * its controls, and feeds them noise in real time for -t seconds:
+ *
+ *   streamload -n 2000 -t 10 reson:1000,50 comb_lopass:30,.9
+ *
+ * The streams are opened -c at a time on a connection of their own,
+ * and fed by -j threads, each of which sends a block to all of its
+ * streams once every block's length of audio and reads back whatever
+ * output is ready. At the end it prints how many blocks went each
+ * way, how many of them the daemon had to fill in or drop, and the
+ * latency of the blocks, both as the daemon saw it (from when a block
+ * was sent to when its output was ready) and the round trip (to when
+ * the output was read), over all streams. With -v, it also prints
+ * them for each stream.
+ *
+ *   streamload [-s socket] [-n streams] [-c streams_per_connection]
+ *              [-t seconds] [-j threads] [-v] [kernel[:value,...]]...
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "ladspa.h"
+#include "kernel_class.h"
+#include "stream.h"
+
+#define MAX_KERNELS 16
+#define MAX_THREADS 256
+#define NOISE       65536
+
+/**
+ * A kernel to open streams through, with their controls.
+ */
+typedef struct {
+  const kernel_class_type *class;
+  LADSPA_Data controls[KERNEL_CLASS_MAX_CONTROLS];
+} kernel_type;
+
+/**
+ * A stream, and how it went.
+ */
+typedef struct {
+  stream_ring_type *ring;
+  unsigned int id;
+  kernel_type *kernel;
+  unsigned long noise;
+  unsigned long sent;
+  unsigned long received;
+  unsigned long blocked;
+
+  // the daemon's counts when the stream stopped, since it goes on
+  // counting underruns after that
+  unsigned long underruns;
+  unsigned long overruns;
+
+  double round_trip_max;
+  unsigned long round_trip[STREAM_LATENCY_BUCKETS];
+} stream_type;
+
+typedef struct {
+  pthread_t thread;
+  stream_type *streams;
+  int count;
+  unsigned long late;
+} thread_type;
+
+const char *socket_path = STREAM_SOCKET;
+int stream_count = 1000;
+int streams_per_connection = 250;
+double seconds = 10;
+int thread_count = 1;
+int verbose = 0;
+
+kernel_type kernels[MAX_KERNELS];
+int kernel_count = 0;
+
+stream_type *streams;
+unsigned long block_size;
+unsigned long sample_rate;
+// NOISE samples of noise, and a block more so any block of them can
+// be copied in one go
+LADSPA_Data *noise;
+double start_time;
+
+/**
+ * Read kernel[:value,...] into a kernel. Returns 0 and says why if it
+ * can't.
+ */
+int parse_kernel(kernel_type *kernel, const char *spec)
+{
+  char name[STREAM_NAME_LENGTH];
+  const char *values = strchr(spec, ':');
+  size_t length = values ? (size_t)(values - spec) : strlen(spec);
+  char *end;
+  int k;
+
+  if(length >= sizeof(name))
+    length = sizeof(name) - 1;
+  memcpy(name, spec, length);
+  name[length] = 0;
+  if(!(kernel->class = kernel_class_find(name))) {
+    fprintf(stderr, "%s: no such kernel\n", name);
+    return 0;
+  }
+
+  // the controls start at their lower bounds, like the daemon's
+  for(k = 0; k < kernel->class->control_count; k ++)
+    kernel->controls[k] = kernel->class->controls[k].lower;
+  for(k = 0; values && k < kernel->class->control_count; k ++) {
+    kernel->controls[k] = strtod(values + 1, &end);
+    if(end == values + 1 || (*end && *end != ',')) {
+      fprintf(stderr, "%s: bad control values\n", spec);
+      return 0;
+    }
+    values = *end ? end : NULL;
+  }
+
+  return 1;
+}
+
+/**
+ * Receive a reply, and the file descriptor that comes with it if it
+ * went well. Returns 0 and says why if it didn't.
+ */
+int receive_reply(int socket, stream_reply_type *reply, int *memory)
+{
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { reply, sizeof(*reply) };
+  struct msghdr message;
+  struct cmsghdr *header;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if(recvmsg(socket, &message, MSG_CMSG_CLOEXEC) != sizeof(*reply)) {
+    fprintf(stderr, "the daemon hung up\n");
+    return 0;
+  }
+  if(reply->error[0]) {
+    reply->error[STREAM_ERROR_LENGTH - 1] = 0;
+    fprintf(stderr, "the daemon said: %s\n", reply->error);
+    return 0;
+  }
+
+  header = CMSG_FIRSTHDR(&message);
+  if(!header || header->cmsg_type != SCM_RIGHTS) {
+    fprintf(stderr, "the daemon sent no memory\n");
+    return 0;
+  }
+  memcpy(memory, CMSG_DATA(header), sizeof(int));
+
+  return 1;
+}
+
+/**
+ * Open count streams from first on a new connection. The connection
+ * is left open for as long as the program runs. Returns 0 and says
+ * why if it can't.
+ */
+int open_streams(int first, int count)
+{
+  struct sockaddr_un address;
+  stream_request_type request;
+  stream_reply_type reply;
+  unsigned int i, opened;
+  void *memory;
+  int connection, region, kernel, k;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+  if((connection = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+     connect(connection, (struct sockaddr *)&address, sizeof(address))) {
+    perror(socket_path);
+    return 0;
+  }
+
+  // one request for the streams through each kernel
+  for(kernel = 0; kernel < kernel_count; kernel ++) {
+    memset(&request, 0, sizeof(request));
+    strcpy(request.kernel, kernels[kernel].class->name);
+    for(k = 0; k < KERNEL_CLASS_MAX_CONTROLS; k ++)
+      request.controls[k] = kernels[kernel].controls[k];
+    for(i = first; i < first + count; i ++)
+      if(i % kernel_count == kernel)
+        request.count ++;
+    if(request.count == 0)
+      continue;
+
+    if(send(connection, &request, sizeof(request), MSG_NOSIGNAL) < 0) {
+      perror("send");
+      return 0;
+    }
+    if(!receive_reply(connection, &reply, &region))
+      return 0;
+
+    block_size = reply.block_size;
+    sample_rate = reply.sample_rate;
+    memory = mmap(NULL, request.count * stream_size(block_size),
+                  PROT_READ | PROT_WRITE, MAP_SHARED, region, 0);
+    close(region);
+    if(memory == MAP_FAILED) {
+      perror("mmap");
+      return 0;
+    }
+
+    for(i = first, opened = 0; i < first + count; i ++)
+      if(i % kernel_count == kernel) {
+        streams[i].ring = stream_ring(memory, block_size, opened);
+        streams[i].id = reply.first_stream + opened ++;
+        streams[i].kernel = &kernels[kernel];
+        streams[i].noise = rand() % NOISE;
+      }
+  }
+
+  return 1;
+}
+
+/**
+ * Read every output block that is ready, and note how long it took.
+ */
+void receive(stream_type *stream)
+{
+  stream_ring_type *ring = stream->ring;
+  unsigned long tail = atomic_load_explicit(&ring->output_tail,
+                                            memory_order_relaxed);
+  double latency;
+
+  while(atomic_load_explicit(&ring->output_head, memory_order_acquire) !=
+        tail) {
+    latency = stream_seconds() - ring->output_sent[tail % STREAM_SLOTS];
+    if(latency > stream->round_trip_max)
+      stream->round_trip_max = latency;
+    stream_count_latency(stream->round_trip, latency);
+    stream->received ++;
+    atomic_store_explicit(&ring->output_tail, ++ tail,
+                          memory_order_release);
+  }
+}
+
+/**
+ * Send a block of noise, unless the ring is full.
+ */
+void send_block(stream_type *stream)
+{
+  stream_ring_type *ring = stream->ring;
+  unsigned long head = atomic_load_explicit(&ring->input_head,
+                                            memory_order_relaxed);
+
+  if(head - atomic_load_explicit(&ring->input_tail, memory_order_acquire) ==
+     STREAM_SLOTS) {
+    stream->blocked ++;
+    return;
+  }
+
+  memcpy(stream_input(ring, block_size, head), noise + stream->noise,
+         block_size * sizeof(LADSPA_Data));
+  stream->noise = (stream->noise + block_size) % NOISE;
+
+  ring->input_sent[head % STREAM_SLOTS] = stream_seconds();
+  atomic_store_explicit(&ring->input_head, head + 1, memory_order_release);
+  stream->sent ++;
+}
+
+/**
+ * A thread: feed its streams a block each, once a block, until the
+ * time is up, and then wait a moment for the last outputs.
+ */
+void *run_thread(void *data)
+{
+  thread_type *thread = (thread_type *)data;
+  double period = (double)block_size / sample_rate, next = start_time;
+  struct timespec wake;
+  int i;
+
+  while(next < start_time + seconds) {
+    for(i = 0; i < thread->count; i ++) {
+      receive(&thread->streams[i]);
+      send_block(&thread->streams[i]);
+    }
+
+    next += period;
+    if(stream_seconds() > next) {
+      thread->late ++;
+      next = stream_seconds();
+    }
+    wake.tv_sec = next;
+    wake.tv_nsec = (next - wake.tv_sec) * 1e9;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) ==
+          EINTR)
+      ;
+  }
+
+  for(i = 0; i < thread->count; i ++) {
+    thread->streams[i].underruns = thread->streams[i].ring->underruns;
+    thread->streams[i].overruns = thread->streams[i].ring->overruns;
+  }
+
+  for(next = stream_seconds() + STREAM_SLOTS * 2 * period;
+      stream_seconds() < next; usleep(1000))
+    for(i = 0; i < thread->count; i ++)
+      receive(&thread->streams[i]);
+
+  return NULL;
+}
+
+void print_latency(const char *name, const unsigned long *histogram,
+                   double max)
+{
+  printf("%-12s p50 %6.0f us   p99 %6.0f us   max %6.0f us\n", name,
+         1e6 * stream_percentile(histogram, .5, max),
+         1e6 * stream_percentile(histogram, .99, max), 1e6 * max);
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s socket] [-n streams] "
+          "[-c streams_per_connection] [-t seconds] [-j threads] [-v] "
+          "[kernel[:value,...]]...\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  static thread_type threads[MAX_THREADS];
+  unsigned long daemon_latency[STREAM_LATENCY_BUCKETS];
+  unsigned long round_trip[STREAM_LATENCY_BUCKETS];
+  unsigned long sent = 0, received = 0, blocked = 0, late = 0;
+  unsigned long underruns = 0, overruns = 0;
+  double daemon_max = 0, round_trip_max = 0;
+  stream_ring_type *ring;
+  stream_type *stream;
+  int option, i, bucket;
+
+  while((option = getopt(argc, argv, "s:n:c:t:j:v")) != -1) {
+    switch(option) {
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'n':
+      stream_count = atoi(optarg);
+      break;
+    case 'c':
+      streams_per_connection = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'j':
+      thread_count = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(stream_count < 1 || streams_per_connection < 1 || seconds <= 0 ||
+     thread_count < 1 || thread_count > MAX_THREADS ||
+     argc - optind > MAX_KERNELS)
+    usage(argv[0]);
+  if(thread_count > stream_count)
+    thread_count = stream_count;
+
+  for(i = optind; i < argc; i ++)
+    if(!parse_kernel(&kernels[kernel_count ++], argv[i]))
+      return 1;
+  if(kernel_count == 0 && !parse_kernel(&kernels[kernel_count ++], "reson"))
+    return 1;
+
+  if(!(streams = calloc(stream_count, sizeof(stream_type))))
+    return 1;
+  for(i = 0; i < stream_count; i += streams_per_connection)
+    if(!open_streams(i, stream_count - i < streams_per_connection ?
+                     stream_count - i : streams_per_connection))
+      return 1;
+
+  if(!(noise = malloc((NOISE + block_size) * sizeof(LADSPA_Data))))
+    return 1;
+  for(i = 0; i < NOISE + block_size; i ++)
+    noise[i] = (float)rand() / RAND_MAX - .5;
+
+  start_time = stream_seconds();
+  for(i = 0; i < thread_count; i ++) {
+    threads[i].streams = streams + (long)stream_count * i / thread_count;
+    threads[i].count = (long)stream_count * (i + 1) / thread_count -
+      (long)stream_count * i / thread_count;
+    if(pthread_create(&threads[i].thread, NULL, run_thread, &threads[i])) {
+      fprintf(stderr, "can't start %d threads\n", thread_count);
+      return 1;
+    }
+  }
+  for(i = 0; i < thread_count; i ++) {
+    pthread_join(threads[i].thread, NULL);
+    late += threads[i].late;
+  }
+
+  memset(daemon_latency, 0, sizeof(daemon_latency));
+  memset(round_trip, 0, sizeof(round_trip));
+  if(verbose)
+    printf("stream\tkernel\tsent\treceived\tblocked\tunderruns\t"
+           "overruns\tp99_us\tround_trip_p99_us\n");
+  for(i = 0; i < stream_count; i ++) {
+    stream = &streams[i];
+    ring = stream->ring;
+    sent += stream->sent;
+    received += stream->received;
+    blocked += stream->blocked;
+    underruns += stream->underruns;
+    overruns += stream->overruns;
+    if(ring->latency_max > daemon_max)
+      daemon_max = ring->latency_max;
+    if(stream->round_trip_max > round_trip_max)
+      round_trip_max = stream->round_trip_max;
+    for(bucket = 0; bucket < STREAM_LATENCY_BUCKETS; bucket ++) {
+      daemon_latency[bucket] += ring->latency[bucket];
+      round_trip[bucket] += stream->round_trip[bucket];
+    }
+    if(verbose)
+      printf("%u\t%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%.0f\t%.0f\n", stream->id,
+             stream->kernel->class->name, stream->sent, stream->received,
+             stream->blocked, stream->underruns, stream->overruns,
+             1e6 * stream_percentile(ring->latency, .99,
+                                     ring->latency_max),
+             1e6 * stream_percentile(stream->round_trip, .99,
+                                     stream->round_trip_max));
+  }
+
+  printf("%d streams, %lu samples at %lu Hz for %.1f s, %lu late "
+         "ticks\n", stream_count, block_size, sample_rate, seconds, late);
+  printf("%lu blocks sent, %lu received, %lu blocked, %lu underruns, "
+         "%lu overruns\n", sent, received, blocked, underruns, overruns);
+  print_latency("daemon", daemon_latency, daemon_max);
+  print_latency("round trip", round_trip, round_trip_max);
+
+  return 0;
+}
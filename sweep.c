@@ -0,0 +1,533 @@
+/*
+ * sweep.c - Render one source through every point of a parameter grid
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Renders a source file through a chain of plugins (see host.h) once
+ * for every combination of the control values on a grid, to the -o
+ * directory, as 00000.wav, 00001.wav, ... (or .raw for a raw source).
+ * sweep.tsv there lists the control values of each file. Each -g
+ * steps a control of the stage given by the -p before it from one
+ * value to another, evenly or, with log, logarithmically:
+ *
+ *   sweep -o out -p ./reson.so:reson_mono -g 0=100:4000:40:log
+ *         -g 1=10:500:20 source.wav
+ *
+ * renders 800 files. The first -g changes slowest.
+ *
+ * The source is decoded once, and all threads read it. Every thread
+ * (-j, one per core by default) has one instance of the chain, which
+ * it deactivates and activates again between renders, and one output
+ * buffer, so nothing is allocated per render. The renders stream to
+ * disk as they go, each -t seconds longer than the source for the
+ * chain to ring out.
+ *
+ *   sweep -o directory [-j threads] [-b block_size] [-t seconds]
+ *         [-r sample_rate] [-c channels]
+ *         {-p library.so:label[:port=value,...]
+ *          [-g port=from:to:steps[:log]]...}... source
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ladspa.h"
+#include "host.h"
+#include "audio.h"
+
+#define MAX_FILE_CHANNELS 64
+#define MAX_GRIDS         16
+#define OUTPUT_BUFFER     (1 << 20)
+#define PAGE_ALIGNMENT    4096
+
+/**
+ * A control stepped across the sweep.
+ */
+typedef struct {
+  int stage;
+  unsigned long port;
+  LADSPA_Data from;
+  LADSPA_Data to;
+  unsigned long steps;
+  int log;
+} grid_type;
+
+/**
+ * A thread with its own instances of the chain, one per lane, and
+ * its own buffers.
+ */
+typedef struct {
+  pthread_t thread;
+  host_chain_type chains[MAX_FILE_CHANNELS];
+  int lanes;
+  LADSPA_Data *buffers[MAX_FILE_CHANNELS];
+  unsigned char *output;
+  int failed;
+} worker_type;
+
+unsigned long block_size = 1024;
+unsigned long raw_sample_rate = 48000;
+int raw_channels = 1;
+double tail_seconds = 0;
+const char *output_directory = NULL;
+
+host_stage_type stages[HOST_MAX_STAGES];
+int stage_count = 0;
+int chain_channels;
+grid_type grids[MAX_GRIDS];
+int grid_count = 0;
+
+// the source, one buffer per channel, and how long each render is
+audio_input_type input;
+LADSPA_Data *source[MAX_FILE_CHANNELS];
+unsigned long output_frames;
+size_t output_size;
+size_t header_size;
+unsigned char header[AUDIO_WAV_HEADER];
+
+// the renders, and the next one a thread should take
+unsigned long render_count = 1;
+unsigned long next_render = 0;
+int name_digits;
+pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The value of a grid's control at one of its steps.
+ */
+LADSPA_Data grid_value(const grid_type *grid, unsigned long step)
+{
+  const LADSPA_PortRangeHint *hint =
+    stages[grid->stage].descriptor->PortRangeHints + grid->port;
+  double position = grid->steps > 1 ? (double)step / (grid->steps - 1) : 0;
+  double value;
+
+  if(grid->log)
+    value = grid->from * pow(grid->to / grid->from, position);
+  else
+    value = grid->from + (grid->to - grid->from) * position;
+  if(LADSPA_IS_HINT_INTEGER(hint->HintDescriptor))
+    value = floor(value + .5);
+
+  return value;
+}
+
+/**
+ * Which step of a grid a render is at. The last grid steps fastest.
+ */
+unsigned long grid_step(unsigned long render, int grid)
+{
+  int later;
+
+  for(later = grid_count - 1; later > grid; later --)
+    render /= grids[later].steps;
+
+  return render % grids[grid].steps;
+}
+
+/**
+ * Set the controls of every lane's chain to a render's point on the
+ * grid.
+ */
+void set_controls(worker_type *worker, unsigned long render)
+{
+  LADSPA_Data value;
+  int grid, lane;
+
+  for(grid = 0; grid < grid_count; grid ++) {
+    value = grid_value(&grids[grid], grid_step(render, grid));
+    for(lane = 0; lane < worker->lanes; lane ++)
+      worker->chains[lane].controls[grids[grid].stage][grids[grid].port] =
+        value;
+  }
+}
+
+/**
+ * The path of a render's output.
+ */
+void render_path(char *path, size_t size, unsigned long render)
+{
+  snprintf(path, size, "%s/%0*lu.%s", output_directory, name_digits, render,
+           input.wav ? "wav" : "raw");
+}
+
+/**
+ * Render the source at one point of the grid, block by block, with the
+ * output collected in the worker's buffer and written whenever it's
+ * full. Returns 0 and says why if it can't.
+ */
+int render_point(worker_type *worker, unsigned long render)
+{
+  char path[4096];
+  size_t used = 0, block_bytes;
+  off_t offset = header_size;
+  unsigned long frame, count, i;
+  int file, lane, channel;
+
+  render_path(path, sizeof(path), render);
+  if((file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+    perror(path);
+    return 0;
+  }
+
+  set_controls(worker, render);
+  for(lane = 0; lane < worker->lanes; lane ++)
+    host_chain_reset(&worker->chains[lane]);
+
+  if(!audio_write_all(file, header, header_size, 0))
+    goto failed;
+  for(frame = 0; frame < output_frames; frame += count) {
+    count = output_frames - frame < block_size ?
+      output_frames - frame : block_size;
+
+    // the source, and silence after it
+    for(channel = 0; channel < input.channels; channel ++) {
+      for(i = 0; i < count && frame + i < input.frames; i ++)
+        worker->buffers[channel][i] = source[channel][frame + i];
+      for(; i < count; i ++)
+        worker->buffers[channel][i] = 0;
+    }
+    for(lane = 0; lane < worker->lanes; lane ++)
+      host_chain_run(&worker->chains[lane],
+                     worker->buffers + lane * chain_channels, count);
+
+    block_bytes = count * input.channels * sizeof(float);
+    if(used + block_bytes > output_size) {
+      if(!audio_write_all(file, worker->output, used, offset))
+        goto failed;
+      offset += used;
+      used = 0;
+    }
+    for(i = 0; i < count; i ++)
+      for(channel = 0; channel < input.channels; channel ++) {
+        memcpy(worker->output + used, &worker->buffers[channel][i],
+               sizeof(float));
+        used += sizeof(float);
+      }
+  }
+  if(!audio_write_all(file, worker->output, used, offset))
+    goto failed;
+
+  if(close(file) < 0) {
+    perror(path);
+    return 0;
+  }
+  return 1;
+
+failed:
+  perror(path);
+  close(file);
+  return 0;
+}
+
+/**
+ * Take renders off the list and do them until there are none left.
+ */
+void *render_sweep(void *data)
+{
+  worker_type *worker = (worker_type *)data;
+  unsigned long render;
+
+  while(1) {
+    pthread_mutex_lock(&render_lock);
+    render = next_render < render_count ? next_render ++ : render_count;
+    pthread_mutex_unlock(&render_lock);
+    if(render == render_count)
+      break;
+
+    if(!render_point(worker, render))
+      worker->failed ++;
+  }
+
+  return NULL;
+}
+
+/**
+ * Instantiate a worker's chains and allocate its buffers. Returns 0 if
+ * it can't.
+ */
+int start_worker(worker_type *worker)
+{
+  int channel;
+
+  memset(worker, 0, sizeof(worker_type));
+  for(channel = 0; channel < input.channels; channel ++)
+    if(!(worker->buffers[channel] = malloc(block_size *
+                                           sizeof(LADSPA_Data))))
+      return 0;
+  if(posix_memalign((void **)&worker->output, PAGE_ALIGNMENT, output_size))
+    return 0;
+  for(; worker->lanes < input.channels / chain_channels; worker->lanes ++)
+    if(!host_chain_instantiate(&worker->chains[worker->lanes], stages,
+                               stage_count, input.sample_rate, block_size))
+      return 0;
+
+  return 1;
+}
+
+void stop_worker(worker_type *worker)
+{
+  int channel;
+
+  while(worker->lanes -- > 0)
+    host_chain_cleanup(&worker->chains[worker->lanes]);
+  for(channel = 0; channel < input.channels; channel ++)
+    free(worker->buffers[channel]);
+  free(worker->output);
+}
+
+/**
+ * Parse a grid, port=from:to:steps[:log], for the last stage given.
+ * Returns 0 and says why if it can't.
+ */
+int parse_grid(grid_type *grid, const char *spec)
+{
+  const LADSPA_Descriptor *descriptor;
+  char scale[8] = "";
+  int fields;
+
+  if(stage_count == 0) {
+    fprintf(stderr, "%s: -g comes after the -p it belongs to\n", spec);
+    return 0;
+  }
+  descriptor = stages[stage_count - 1].descriptor;
+
+  fields = sscanf(spec, "%lu=%f:%f:%lu:%7s", &grid->port, &grid->from,
+                  &grid->to, &grid->steps, scale);
+  if(fields < 4 || grid->steps == 0 ||
+     (fields == 5 && strcmp(scale, "log") != 0)) {
+    fprintf(stderr, "%s: expected port=from:to:steps[:log]\n", spec);
+    return 0;
+  }
+  if(grid->port >= descriptor->PortCount ||
+     !LADSPA_IS_PORT_CONTROL(descriptor->PortDescriptors[grid->port]) ||
+     !LADSPA_IS_PORT_INPUT(descriptor->PortDescriptors[grid->port])) {
+    fprintf(stderr, "%s: %s has no control port %lu\n", spec,
+            descriptor->Label, grid->port);
+    return 0;
+  }
+  grid->log = fields == 5;
+  if(grid->log && (grid->from <= 0 || grid->to <= 0)) {
+    fprintf(stderr, "%s: a log grid has to be above 0\n", spec);
+    return 0;
+  }
+  grid->stage = stage_count - 1;
+
+  return 1;
+}
+
+/**
+ * Write sweep.tsv, which lists the control values of each render.
+ * Returns 0 and says why if it can't.
+ */
+int write_index(void)
+{
+  char path[4096];
+  unsigned long render;
+  FILE *index;
+  int grid;
+
+  snprintf(path, sizeof(path), "%s/sweep.tsv", output_directory);
+  if(!(index = fopen(path, "w"))) {
+    perror(path);
+    return 0;
+  }
+
+  fprintf(index, "file");
+  for(grid = 0; grid < grid_count; grid ++)
+    fprintf(index, "\t%s:%s",
+            stages[grids[grid].stage].descriptor->Label,
+            stages[grids[grid].stage].descriptor->PortNames[grids[grid].port]);
+  fprintf(index, "\n");
+
+  for(render = 0; render < render_count; render ++) {
+    render_path(path, sizeof(path), render);
+    fprintf(index, "%s", strrchr(path, '/') + 1);
+    for(grid = 0; grid < grid_count; grid ++)
+      fprintf(index, "\t%g",
+              grid_value(&grids[grid], grid_step(render, grid)));
+    fprintf(index, "\n");
+  }
+
+  if(fclose(index) != 0) {
+    perror(path);
+    return 0;
+  }
+  return 1;
+}
+
+void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s -o directory [-j threads] [-b block_size] "
+          "[-t seconds] [-r sample_rate] [-c channels]\n"
+          "       {-p library.so:label[:port=value,...] "
+          "[-g port=from:to:steps[:log]]...}... source\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  static worker_type workers[256];
+  struct timespec start, end;
+  double elapsed, seconds;
+  long thread_count = sysconf(_SC_NPROCESSORS_ONLN), started;
+  unsigned long renders;
+  int option, i, channel, failed = 0;
+
+  while((option = getopt(argc, argv, "o:j:b:t:r:c:p:g:")) != -1) {
+    switch(option) {
+    case 'o':
+      output_directory = optarg;
+      break;
+    case 'j':
+      thread_count = atol(optarg);
+      break;
+    case 'b':
+      block_size = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      tail_seconds = atof(optarg);
+      break;
+    case 'r':
+      raw_sample_rate = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      raw_channels = atoi(optarg);
+      break;
+    case 'p':
+      if(stage_count == HOST_MAX_STAGES)
+        usage(argv[0]);
+      if(!host_load_stage(&stages[stage_count ++], optarg))
+        return 1;
+      break;
+    case 'g':
+      if(grid_count == MAX_GRIDS)
+        usage(argv[0]);
+      if(!parse_grid(&grids[grid_count ++], optarg))
+        return 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(!output_directory || stage_count == 0 || optind != argc - 1 ||
+     block_size == 0 || tail_seconds < 0 || raw_sample_rate == 0 ||
+     raw_channels < 1 || raw_channels > MAX_FILE_CHANNELS)
+    usage(argv[0]);
+  if(!(chain_channels = host_chain_channels(stages, stage_count)))
+    return 1;
+
+  // decode the source once, for every thread to read
+  if(!audio_open(&input, argv[optind], raw_sample_rate, raw_channels))
+    return 1;
+  if(input.channels > MAX_FILE_CHANNELS ||
+     input.channels % chain_channels != 0) {
+    fprintf(stderr, "%s: %d channels, the chain has %d\n", argv[optind],
+            input.channels, chain_channels);
+    return 1;
+  }
+  for(channel = 0; channel < input.channels; channel ++)
+    if(!(source[channel] = malloc((input.frames ? input.frames : 1) *
+                                  sizeof(LADSPA_Data)))) {
+      perror(argv[optind]);
+      return 1;
+    }
+  audio_read_frames(&input, 0, input.frames, 0, input.channels, source);
+  audio_close(&input);
+
+  output_frames = input.frames + tail_seconds * input.sample_rate;
+  header_size = input.wav ? AUDIO_WAV_HEADER : 0;
+
+  // room for at least one block, in whole pages
+  output_size = block_size * input.channels * sizeof(float);
+  if(output_size < OUTPUT_BUFFER)
+    output_size = OUTPUT_BUFFER;
+  output_size = (output_size + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT *
+    PAGE_ALIGNMENT;
+  if(input.wav)
+    audio_wav_header(header, input.channels, input.sample_rate,
+                     output_frames);
+
+  for(i = 0; i < grid_count; i ++)
+    render_count *= grids[i].steps;
+  for(renders = render_count - 1, name_digits = 1; renders >= 10;
+      renders /= 10)
+    name_digits ++;
+  if(name_digits < 5)
+    name_digits = 5;
+
+  if(mkdir(output_directory, 0777) < 0 && errno != EEXIST) {
+    perror(output_directory);
+    return 1;
+  }
+  if(!write_index())
+    return 1;
+
+  if(thread_count < 1)
+    thread_count = 1;
+  if((unsigned long)thread_count > render_count)
+    thread_count = render_count;
+  if(thread_count > (long)(sizeof(workers) / sizeof(workers[0])))
+    thread_count = sizeof(workers) / sizeof(workers[0]);
+  for(i = 0; i < thread_count; i ++)
+    if(!start_worker(&workers[i])) {
+      fprintf(stderr, "couldn't start %ld threads\n", thread_count);
+      return 1;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  // the threads share out the renders, so any that started can do the
+  // work of those that didn't
+  for(i = 1; i < thread_count; i ++)
+    if(pthread_create(&workers[i].thread, NULL, render_sweep,
+                      &workers[i])) {
+      fprintf(stderr, "couldn't start %ld threads, rendering on %d\n",
+              thread_count, i);
+      break;
+    }
+  started = i;
+  render_sweep(&workers[0]);
+  for(i = 1; i < started; i ++)
+    pthread_join(workers[i].thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  for(i = 0; i < thread_count; i ++) {
+    failed += workers[i].failed;
+    stop_worker(&workers[i]);
+  }
+
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  seconds = (double)(render_count - failed) * output_frames /
+    input.sample_rate;
+  printf("%lu renders of %.2f s in %.2f s on %ld threads, %.1f renders/s, "
+         "%.0fx real time\n", render_count - failed,
+         (double)output_frames / input.sample_rate, elapsed, started,
+         (render_count - failed) / elapsed, seconds / elapsed);
+
+  for(channel = 0; channel < input.channels; channel ++)
+    free(source[channel]);
+  return failed ? 1 : 0;
+}
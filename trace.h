@@ -0,0 +1,98 @@
+/*
+ * trace.h - The format of the traces capture.so records
+ * Copyright (C) 2011  Andreas Jansson <andreas@jansson.me.uk>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * A trace is everything a host did to the plugins of one library:
+ * every instance it made, every block it ran through them, with the
+ * control values and the input, and what came out. replay runs it
+ * again against any build of the plugins.
+ *
+ * It starts with a trace_header_type and the path of the library, and
+ * then has one record per call, each a trace_record_type and its
+ * payload. All numbers are in the byte order of the machine that
+ * recorded it, which is the one that should replay it.
+ *
+ * The payload of TRACE_INSTANTIATE is a trace_instance_type and the
+ * plugin's label. That of TRACE_RUN is a trace_run_type, then
+ * control_count trace_control_type for the controls that changed since
+ * the instance last ran, then, if layout_changed, one uint16_t per port
+ * giving the buffer each audio port is connected to (TRACE_NO_BUFFER
+ * for control ports and unconnected ones). Buffers are numbered in the
+ * order of the first port connected to them, so a plugin run in place
+ * has the same buffer on an input and an output. Last come
+ * sample_count floats for each buffer that an input is connected to,
+ * in the order of the buffers, as they were before the run, and the
+ * same for each buffer an output is connected to, after it.
+ *
+ * The other records have no payload.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC   "LADSPAtr"
+#define TRACE_VERSION 1
+
+#define TRACE_INSTANTIATE 1
+#define TRACE_ACTIVATE    2
+#define TRACE_RUN         3
+#define TRACE_DEACTIVATE  4
+#define TRACE_CLEANUP     5
+
+#define TRACE_NO_BUFFER 0xffff
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t library_length;
+} trace_header_type;
+
+typedef struct {
+  uint32_t type;
+  uint32_t instance;
+  uint64_t size;
+} trace_record_type;
+
+typedef struct {
+  uint32_t unique_id;
+  uint32_t port_count;
+  uint64_t sample_rate;
+} trace_instance_type;
+
+/**
+ * A call to run(), with the floating point control register of the
+ * thread that made it (MXCSR on x86, 0 elsewhere), which decides how
+ * denormals are handled.
+ */
+typedef struct {
+  uint64_t sample_count;
+  uint32_t control_count;
+  uint32_t layout_changed;
+  uint32_t fp_control;
+  uint32_t reserved;
+} trace_run_type;
+
+typedef struct {
+  uint32_t port;
+  float value;
+} trace_control_type;
+
+#endif